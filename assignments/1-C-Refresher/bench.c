@@ -0,0 +1,282 @@
+/*
+ * bench.c
+ *
+ * Times the stringfun kernels on generated corpora and prints one CSV
+ * line per corpus and operation. "make bench" runs it once for every
+ * STRINGFUN_SIMD setting, so the scalar and SIMD kernels end up side by
+ * side. The corpora come from a fixed seed and are the same on every
+ * run; their size is BENCH_MB_ENV MiB each, BENCH_MB by default.
+ *
+ * Columns: date, corpus, op, variant, bytes, seconds, gb_per_s,
+ * cycles_per_byte. The time is the best of BENCH_REPS runs. Cycles are
+ * TSC ticks, left empty where there is no TSC. Operations without a
+ * SIMD kernel (print, replace) time the same code in every variant.
+ */
+#define STRINGFUN_NO_MAIN
+#include "stringfun.c"
+
+#include <time.h>
+
+#define BENCH_MB_ENV "STRINGFUN_BENCH_MB"
+#define BENCH_MB 16
+#define BENCH_REPS 5
+
+typedef struct corpus {
+    const char *name;
+    char *text;             // NUL terminated, for setup_buff()
+    int len;
+    const char *search;     // replace op: pattern and replacement
+    const char *replace;
+} corpus_t;
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+/**
+ * rng
+ *
+ * xorshift64, reseeded for each corpus so each is reproducible alone.
+ */
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/**
+ * put_utf8
+ *
+ * Writes code point c as UTF-8, returns the bytes written.
+ */
+static int put_utf8(char *p, uint32_t c) {
+    if (c < 0x80) {
+        p[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        p[0] = 0xc0 | c >> 6;
+        p[1] = 0x80 | (c & 0x3f);
+        return 2;
+    }
+    if (c < 0x10000) {
+        p[0] = 0xe0 | c >> 12;
+        p[1] = 0x80 | (c >> 6 & 0x3f);
+        p[2] = 0x80 | (c & 0x3f);
+        return 3;
+    }
+    p[0] = 0xf0 | c >> 18;
+    p[1] = 0x80 | (c >> 12 & 0x3f);
+    p[2] = 0x80 | (c >> 6 & 0x3f);
+    p[3] = 0x80 | (c & 0x3f);
+    return 4;
+}
+
+/**
+ * gen_corpus
+ *
+ * Fills c->text with len bytes of one kind of text:
+ *   prose   : English words, short spaces and punctuation
+ *   spaces  : words between long runs of mixed whitespace
+ *   utf8    : words of 2, 3 and 4 byte characters
+ *   patho   : all 'a' with a rare 'b', against a pattern that matches
+ *             everywhere but its last byte
+ */
+static void gen_corpus(corpus_t *c, int len) {
+    static const char *words[] = {
+        "the", "of", "and", "a", "to", "in", "is", "you", "that", "it",
+        "he", "was", "for", "on", "are", "as", "with", "his", "they", "at",
+        "be", "this", "from", "buffer", "string", "whitespace", "reverse",
+        "benchmark", "characters", "implementation"
+    };
+    static const uint32_t ranges[][2] = {
+        { 0xc0, 0x17f }, { 0x3b1, 0x3c9 }, { 0x4e00, 0x9fff }, { 0x1f600, 0x1f64f }
+    };
+    static const char ws[] = " \t\n";
+    char *p;
+    int n = 0;
+
+    c->text = malloc(len + 1);
+    if (!c->text) {
+        printf("Memory allocation failed\n");
+        exit(99);
+    }
+    p = c->text;
+    rng_state = 0x2545f4914f6cdd1dULL ^ (uint64_t)c->name[0] << 32;
+
+    while (n < len) {
+        char tmp[128];
+        int k = 0;
+
+        if (strcmp(c->name, "prose") == 0) {
+            const char *w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+            k = strlen(w);
+            memcpy(tmp, w, k);
+            uint64_t r = rng() % 16;
+            tmp[k++] = r == 0 ? '.' : r == 1 ? ',' : ' ';
+            if (r < 2) {
+                tmp[k++] = r == 0 ? '\n' : ' ';
+            }
+        } else if (strcmp(c->name, "spaces") == 0) {
+            const char *w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+            k = strlen(w);
+            memcpy(tmp, w, k);
+            for (int r = 1 + rng() % 64; r > 0; r--) {
+                tmp[k++] = ws[rng() % 3];
+            }
+        } else if (strcmp(c->name, "utf8") == 0) {
+            for (int r = 1 + rng() % 8; r > 0; r--) {
+                const uint32_t *range = ranges[rng() % 4];
+                k += put_utf8(tmp + k, range[0] + rng() % (range[1] - range[0] + 1));
+            }
+            tmp[k++] = ' ';
+        } else {
+            memset(tmp, 'a', 64);
+            k = 64;
+            if (rng() % 64 == 0) {
+                tmp[rng() % 64] = 'b';
+            }
+        }
+
+        if (k > len - n) {
+            k = len - n;
+            // Do not leave half a character at the end
+            while (k > 0 && ((unsigned char)tmp[k] & 0xc0) == 0x80) {
+                k--;
+            }
+            memset(p + n + k, ' ', len - n - k);
+            memcpy(p + n, tmp, k);
+            break;
+        }
+        memcpy(p + n, tmp, k);
+        n += k;
+    }
+    p[len] = '\0';
+    c->len = len;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_X86_SIMD
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * run_op
+ *
+ * Runs one operation over the corpus. work is a copy for the operations
+ * that change the text in place.
+ */
+static void run_op(const char *op, const corpus_t *c, char *work) {
+    if (strcmp(op, "count") == 0) {
+        int in_word = 0;
+        count_word_starts(c->text, c->len, &in_word);
+    } else if (strcmp(op, "collapse") == 0) {
+        setup_buff(work, c->text, c->len);
+    } else if (strcmp(op, "reverse") == 0) {
+        reverse_string(work, c->len, c->len);
+    } else if (strcmp(op, "reverse_utf8") == 0) {
+        reverse_utf8(work, c->len, c->len);
+    } else if (strcmp(op, "print") == 0) {
+        print_words(c->text, c->len, c->len);
+    } else if (strcmp(op, "replace") == 0) {
+        stream_t st = { .mode = 'x' };
+        search_init(&st.find, c->search, strlen(c->search));
+        st.replace = c->replace;
+        st.replace_len = strlen(c->replace);
+        st.carry = malloc(2 * st.find.len);
+        for (int off = 0; off < c->len; off += STREAM_CHUNK_SZ) {
+            int n = c->len - off < STREAM_CHUNK_SZ ? c->len - off : STREAM_CHUNK_SZ;
+            stream_chunk(&st, c->text + off, n);
+        }
+        stream_end(&st);
+        free(st.carry);
+    }
+    out_flush();
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    static const char *variants[] = { "scalar", "sse2", "avx2" };
+    static const char *ops[] = {
+        "count", "collapse", "reverse", "reverse_utf8", "print", "replace"
+    };
+    corpus_t corpora[] = {
+        { "prose", NULL, 0, "the", "THE" },
+        { "spaces", NULL, 0, " \t", "_" },
+        { "utf8", NULL, 0, "\xc3\xa9", "e" },
+        { "patho", NULL, 0, "aaaaaaaaaaaaaaab", "X" },
+    };
+    const char *env = getenv(BENCH_MB_ENV);
+    int mb = env ? atoi(env) : BENCH_MB;
+    char date[32];
+    time_t t = time(NULL);
+
+    if (argc > 1 && strcmp(argv[1], "-H") == 0) {
+        printf("date,corpus,op,variant,bytes,seconds,gb_per_s,cycles_per_byte\n");
+        return 0;
+    }
+    if (mb < 1 || mb > 1024) {
+        printf("usage: %s [-H]  (%s=1..1024 MiB per corpus)\n", argv[0], BENCH_MB_ENV);
+        return 1;
+    }
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+    // Results go to the real stdout, what the operations print to /dev/null
+    FILE *csv = fdopen(dup(STDOUT_FILENO), "w");
+    if (!csv || !freopen("/dev/null", "w", stdout)) {
+        fprintf(stderr, "cannot redirect stdout\n");
+        return 2;
+    }
+    out.fd = fileno(stdout);
+
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        corpus_t *c = &corpora[i];
+        gen_corpus(c, mb * 1024 * 1024);
+        char *work = malloc(c->len + 1);
+        if (!work) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 99;
+        }
+
+        for (size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+            double best = 0;
+            uint64_t best_ticks = 0;
+
+            for (int r = 0; r < BENCH_REPS; r++) {
+                memcpy(work, c->text, c->len + 1);
+                double t0 = now();
+                uint64_t c0 = ticks();
+                run_op(ops[k], c, work);
+                uint64_t c1 = ticks();
+                double t1 = now();
+                if (r == 0 || t1 - t0 < best) {
+                    best = t1 - t0;
+                    best_ticks = c1 - c0;
+                }
+            }
+
+            fprintf(csv, "%s,%s,%s,%s,%d,%.6f,%.3f,", date, c->name, ops[k],
+                    variants[simd_level()], c->len, best, c->len / best / 1e9);
+            if (best_ticks) {
+                fprintf(csv, "%.3f", (double)best_ticks / c->len);
+            }
+            fprintf(csv, "\n");
+            fflush(csv);
+        }
+
+        free(work);
+        free(c->text);
+    }
+
+    fclose(csv);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# Runs every mode of stringfun at each STRINGFUN_SIMD level and with
+# several STRINGFUN_THREADS counts, and compares the output with that of
+# the scalar kernels on one thread. The small inputs put words,
+# whitespace, UTF-8 characters and invalid bytes on both sides of the
+# 16, 32 and 64 byte steps the kernels take; the large one is over the
+# size -c -i splits between threads and is also read from a pipe.
+#
+# usage: check.sh [./stringfun]
+
+BIN=${1:-./stringfun}
+LEVELS="scalar sse2 avx2"
+THREADS="1 2 3 7 64"
+SIZES="0 1 2 15 16 17 31 32 33 47 48 49 63 64 65 95 96 97 127 128 129 191 192 193"
+OFFSETS="0 1 2 3 5"
+
+T=$(mktemp -d) || exit 2
+trap 'rm -rf "$T"' EXIT
+fail=0
+
+# Patterns the inputs are cut from: ASCII words and whitespace, UTF-8
+# text with no-break and wide spaces, and control and invalid bytes.
+printf 'ab cd\tefg  hij\nk lmnop q\v\f\rrs tu  vwxyz\n' > "$T/ascii"
+printf 'a\303\251 \346\227\245\346\234\254\tx\342\202\254y  \360\237\230\200z\n \303\261\302\240w\342\200\203v \343\200\200u ' > "$T/utf8"
+printf 'a\001b \177 c\200d \303 e\340\200\200f\370\210\200\200\200g \355\240\200h\302\205i \n' > "$T/bad"
+for p in ascii utf8 bad; do
+    for i in 1 2 3 4 5 6 7 8; do
+        cat "$T/$p" "$T/$p" "$T/$p" "$T/$p" >> "$T/$p.long"
+    done
+done
+
+mkdir "$T/in"
+for p in ascii utf8 bad; do
+    for n in $SIZES; do
+        for o in $OFFSETS; do
+            tail -c +$((o + 1)) "$T/$p.long" | head -c "$n" > "$T/in/$p-$n-$o"
+        done
+    done
+done
+SMALL=$(ls "$T"/in/* | sort)
+
+# Just over the 8 MB that -c -i maps and counts on several threads, with
+# an odd size so the parts split words and characters in many places.
+cat "$T/ascii.long" "$T/utf8.long" "$T/bad.long" > "$T/big"
+for i in 1 2 3 4 5 6 7 8 9 10 11; do
+    cat "$T/big" "$T/big" > "$T/big2"
+    mv "$T/big2" "$T/big"
+done
+head -c 1048653 "$T/big" > "$T/big2"
+cat "$T/big2" >> "$T/big"
+
+printf 'cd\tCD\nab\tA\nabc\tXYZ\n\346\227\245\tsun\n' > "$T/pairs"
+
+# run NAME: every mode over the inputs, into $T/NAME
+run() {
+    out="$T/$1"
+    : > "$out"
+    for m in -c -w -r -R -l -m -a; do
+        echo "== $m" >> "$out"
+        $BIN $m -i $SMALL "$T/big" >> "$out" 2>&1
+        echo "rc $?" >> "$out"
+        $BIN $m -i - < "$T/big" >> "$out" 2>&1
+        echo "rc $?" >> "$out"
+    done
+    echo "== -x" >> "$out"
+    $BIN -x -i cd CDE $SMALL "$T/big" >> "$out" 2>&1
+    echo "rc $?" >> "$out"
+    echo "== -f" >> "$out"
+    $BIN -f 5 $SMALL "$T/big" >> "$out" 2>&1
+    echo "rc $?" >> "$out"
+    echo "== -X" >> "$out"
+    $BIN -X "$T/pairs" $SMALL "$T/big" >> "$out" 2>&1
+    echo "rc $?" >> "$out"
+    for f in $SMALL; do
+        s=$(cat "$f")
+        [ -n "$s" ] || continue
+        for m in -c -w -r -R; do
+            $BIN $m "$s" >> "$out" 2>&1
+            echo "rc $?" >> "$out"
+        done
+        $BIN -x "$s" cd CDE >> "$out" 2>&1
+        echo "rc $?" >> "$out"
+    done
+}
+
+STRINGFUN_SIMD=scalar STRINGFUN_THREADS=1 run want
+if ! grep -q '^== -a' "$T/want"; then
+    echo "check: $BIN did not run"
+    exit 2
+fi
+
+for l in $LEVELS; do
+    for j in $THREADS; do
+        [ "$l" = scalar ] && [ "$j" = 1 ] && continue
+        STRINGFUN_SIMD=$l STRINGFUN_THREADS=$j run got
+        if cmp -s "$T/want" "$T/got"; then
+            echo "ok   STRINGFUN_SIMD=$l STRINGFUN_THREADS=$j"
+        else
+            echo "FAIL STRINGFUN_SIMD=$l STRINGFUN_THREADS=$j"
+            diff "$T/want" "$T/got" | head -20
+            fail=1
+        fi
+    done
+done
+exit $fail
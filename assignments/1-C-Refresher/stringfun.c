@@ -2,216 +2,2663 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <locale.h>
+#include <wctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-#define BUFFER_SZ 50
+#define STREAM_CHUNK_SZ (1024 * 1024)   // bytes read at a time by -i
+
+/*
+ * -c -i maps regular files of at least PAR_MIN_SZ bytes and counts them
+ * on one thread per online CPU, or THREADS_ENV threads, at most
+ * MAX_THREADS. Smaller files and pipes are read in chunks.
+ */
+#define PAR_MIN_SZ (8 * 1024 * 1024)
+#define THREADS_ENV "STRINGFUN_THREADS"
+#define MAX_THREADS 64
+
+/*
+ * A search string prepared for search_next(): a Boyer-Moore-Horspool
+ * shift for every byte that can end the window, and the critical
+ * factorization Two-Way falls back on, needle[0..split] and the rest,
+ * with the period it shifts by.
+ */
+typedef struct searcher {
+    const char *needle;
+    int len;
+    int skip[256];
+    int split;
+    int period;
+    int periodic;           // the left part repeats within the period
+} searcher_t;
+#define SEARCH_WORK 4       // compare bytes per byte passed before Two-Way
+
+/*
+ * Aho-Corasick automaton over the reversed search strings of a -X pairs
+ * file. The goto and failure functions are folded into one table with a
+ * next state for every byte, so every input byte costs one lookup
+ * however many patterns there are. Run backwards over the text,
+ * match_len of the state reached at a byte is the longest pattern that
+ * starts there, through the failure links, 0 if none.
+ */
+typedef struct ac {
+    int n_states;
+    int cap;
+    int (*next)[256];
+    int *match_len;
+    int *match_pat;         // pattern of match_len
+    char **repl;            // replacement of each pattern
+    int *repl_len;
+    int n_pats;
+    int max_len;            // longest pattern
+} ac_t;
+
+/*
+ * -f counts words in an open addressing hash table with linear probing,
+ * kept at most half full. Words up to FREQ_INLINE bytes, most of them,
+ * are kept in the 32 byte entry itself, so a lookup touches one cache
+ * line. Longer ones are copied once into an arena and entries refer to
+ * them by offset, so the arena can grow with realloc. The hash kept in
+ * an entry skips most word compares and lets the table grow without
+ * hashing the words again. A word cut by a chunk boundary is gathered in
+ * part first.
+ */
+#define FREQ_INLINE 16
+#define FREQ_BATCH 16           // words looked up together
+
+typedef struct freq_entry {
+    uint32_t hash;          // low half of freq_hash(), the slot bits
+    uint32_t len;           // 0 for an empty slot
+    long long count;
+    union {
+        char word[FREQ_INLINE];
+        size_t off;         // longer words: offset in the arena
+    } key;
+} freq_entry_t;
+
+typedef struct freq {
+    freq_entry_t *slots;
+    size_t cap;             // power of two
+    size_t used;
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    char *part;
+    size_t part_len;
+    size_t part_cap;
+} freq_t;
+
+/*
+ * What -l, -m and -a count, the way GNU wc does in a UTF-8 locale:
+ * newlines, words, characters and bytes. A character is a valid UTF-8
+ * sequence; bytes that are not part of one count for nothing. Words are
+ * separated by whitespace characters and started by printable ones, the
+ * rest (control characters, for one) neither start nor end a word.
+ */
+typedef struct wc_counts {
+    long long lines;
+    long long words;
+    long long chars;
+    long long bytes;
+} wc_counts_t;
+
+/*
+ * What -m and -a carry from one chunk to the next: whether a word is open,
+ * and the character being decoded if the boundary cut it.
+ */
+typedef struct wc_state {
+    int in_word;
+    int need;               // continuation bytes still to come
+    uint32_t cp;            // code point so far
+    uint32_t min;           // smallest code point of its length
+} wc_state_t;
+
+/*
+ * State of a -c, -w, -x, -X, -r, -R, -f, -l, -m or -a run over files. A word can start in
+ * one chunk and end in the next, so whether the last byte of a chunk was
+ * inside a word is carried over to the next one. -x holds back the last
+ * len - 1 bytes of a chunk that could still begin a match. -r and -R
+ * read a whole file into memory before reversing it.
+ */
+typedef struct stream {
+    char mode;              // 'c', 'w', 'x', 'X', 'r', 'R', 'f', 'l', 'm' or 'a'
+    const char *name;       // file being read, NULL for stdin without "-"
+    int in_word;            // the previous chunk ended inside a word
+    long long words;        // words counted or printed, or matches replaced
+    long long word_len;     // -w: bytes of the word being printed
+    searcher_t find;        // -x: search string
+    const char *replace;    // -x: replacement
+    int replace_len;
+    char *carry;            // -x and -X: bytes held back
+    int n_carry;
+    ac_t *ac;               // -X: patterns
+    int *ac_at;             // -X: state at each byte of the scan
+    char *whole;            // -r and -R: the file read so far
+    size_t whole_len;
+    size_t whole_cap;
+    freq_t *freq;           // -f: words seen
+    wc_counts_t wc;         // -l, -m and -a: counts of the file being read
+    wc_counts_t wc_total;
+    wc_state_t wc_state;    // -m and -a: word and character between chunks
+    int wc_width;           // columns the counts are right aligned in
+} stream_t;
+
+/*
+ * The bytes isspace() accepts in the C locale, looked up without a call
+ * per byte.
+ */
+static const unsigned char space_tab[256] = {
+    ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1, [' '] = 1
+};
+
+/*
+ * Word counting and reversing kernels, see count_word_starts() and
+ * reverse_bytes(). SIMD_ENV set to scalar, sse2 or avx2 forces one, which
+ * is how they are checked against each other.
+ */
+#define SIMD_ENV "STRINGFUN_SIMD"
+#define SIMD_SCALAR 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+typedef long long (*count_kernel_fn)(const char *, int, int *);
+typedef void (*wc_kernel_fn)(const char *, int, wc_state_t *, wc_counts_t *);
+typedef uint64_t (*space_mask_fn)(const char *);
+
+/*
+ * One thread's share of a mapped file. Each part is counted as if it
+ * started outside a word; a word cut by the boundary is counted by both
+ * parts, which count_mapped() takes back out when adding them up.
+ */
+typedef struct count_part {
+    const char *p;
+    size_t len;
+    long long words;
+    int first_in_word;      // the first byte is part of a word
+    int last_in_word;       // the last byte is part of a word
+} count_part_t;
+
+/*
+ * Output of the word listings and buffer modes. Slices of at least
+ * OUT_COPY_MAX bytes are queued as they lie, in the user's buffer or the
+ * mapped input, and only read by writev(). Shorter ones and generated
+ * text such as indices and lengths are copied into scratch, where
+ * neighbours merge into one iovec. Everything queued goes out in one
+ * writev() once OUT_IOV iovecs or the scratch space are used up, or on
+ * out_flush(), which has to come before a queued slice is changed or
+ * unmapped.
+ */
+#define OUT_IOV 1024
+#define OUT_SCRATCH (64 * 1024)
+#define OUT_COPY_MAX 128
+
+typedef struct out {
+    int fd;
+    int failed;             // a write failed, the rest is dropped
+    int n_iov;
+    size_t n_scratch;
+    struct iovec iov[OUT_IOV];
+    char scratch[OUT_SCRATCH];
+} out_t;
+
+static out_t out = { .fd = STDOUT_FILENO };
 
 /* Prototypes */
 void usage(char *);
 void print_buff(char *, int);
+void out_flush(void);
+void out_bytes(const char *, size_t);
+void out_str(const char *);
+void out_field(const char *, long long, const char *);
+void out_word(long long, const char *, size_t);
 int setup_buff(char *, char *, int);
 int count_words(char *, int, int);
 int reverse_string(char *, int, int);
+int reverse_utf8(char *, int, int);
+void reverse_bytes(char *, size_t);
+void utf8_fix(char *, size_t);
 int print_words(char *, int, int);
 int replace_substring(char *, int, int, char *, char *);
+void search_init(searcher_t *, const char *, int);
+const char *search_next(const searcher_t *, const char *, const char *);
+long long count_word_starts(const char *, int, int *);
+void wc_count(const char *, int, wc_state_t *, wc_counts_t *);
+void wc_lines(const char *, int, wc_counts_t *);
+long long count_starts_scalar(const char *, int, int *);
+int collapse_spaces(char *, const char *, int);
+long long count_mapped(const char *, size_t, int);
+int ac_load(ac_t *, const char *);
+int freq_add(freq_t *, const char *, uint32_t);
+int freq_print(freq_t *, int);
+void stream_chunk(stream_t *, char *, int);
+void stream_end(stream_t *);
+int stream_files(stream_t *, char **, int);
+void wc_print(const stream_t *, const wc_counts_t *, const char *);
+int wc_width(char, char **, int);
+
+/**
+ * setup_buff
+ *
+ * Copies the user-supplied string into buff, which can be user_str itself,
+ * with every run of whitespace collapsed into a single space ' '. The
+ * result is not padded or terminated; every later operation is given its
+ * length. Returns:
+ *   -2 : if an argument is invalid
+ *   -1 : if the collapsed string does not fit in len bytes
+ *   >=0: the length of the user-supplied string after whitespace collapsing.
+ */
+int setup_buff(char *buff, char *user_str, int len) {
+    if (!buff || !user_str || len < 0) {
+        return -2;  // Error: Invalid arguments
+    }
+
+    size_t n = strlen(user_str);
+    if (n > (size_t)INT_MAX) {
+        return -1;
+    }
+    if (n <= (size_t)len) {
+        // Collapsing never writes past where it reads
+        return collapse_spaces(buff, user_str, n);
+    }
+
+    int count = 0;
+    int in_space = 0;
+    for (char *src = user_str; *src != '\0'; src++) {
+        int space = space_tab[(unsigned char)*src];
+        if (space && in_space) {
+            continue;
+        }
+        if (count == len) {
+            return -1;  // Error: Input string too large
+        }
+        buff[count++] = space ? ' ' : *src;
+        in_space = space;
+    }
+
+    return count;  // Return the length of the processed string
+}
+
+/**
+ * out_flush
+ *
+ * Writes out everything queued, going on after short writes.
+ */
+void out_flush(void) {
+    struct iovec *iov = out.iov;
+    int n = out.n_iov;
+
+    while (n > 0 && !out.failed) {
+        ssize_t w = writev(out.fd, iov, n);
+        if (w < 0) {
+            if (errno != EINTR) {
+                out.failed = 1;
+            }
+            continue;
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    out.n_iov = 0;
+    out.n_scratch = 0;
+}
+
+/**
+ * out_reserve
+ *
+ * Makes room for n bytes in scratch, n at most OUT_COPY_MAX, and queues
+ * them, merged into the last iovec when that ends where they start.
+ */
+static inline char *out_reserve(size_t n) {
+    if (out.n_scratch + n > OUT_SCRATCH || out.n_iov == OUT_IOV) {
+        out_flush();
+    }
+
+    char *dst = out.scratch + out.n_scratch;
+    struct iovec *last = out.n_iov > 0 ? &out.iov[out.n_iov - 1] : NULL;
+    if (last && (char *)last->iov_base + last->iov_len == dst) {
+        last->iov_len += n;
+    } else {
+        out.iov[out.n_iov].iov_base = dst;
+        out.iov[out.n_iov++].iov_len = n;
+    }
+    out.n_scratch += n;
+    return dst;
+}
+
+/**
+ * out_bytes
+ *
+ * Queues p[0..n). A long slice is not copied and has to stay as it is
+ * until the next out_flush().
+ */
+void out_bytes(const char *p, size_t n) {
+    if (n < OUT_COPY_MAX) {
+        memcpy(out_reserve(n), p, n);
+        return;
+    }
+    if (out.n_iov == OUT_IOV) {
+        out_flush();
+    }
+    out.iov[out.n_iov].iov_base = (void *)p;
+    out.iov[out.n_iov++].iov_len = n;
+}
+
+/**
+ * out_str
+ *
+ * Queues a string that stays put, like a literal.
+ */
+void out_str(const char *s) {
+    out_bytes(s, strlen(s));
+}
+
+/**
+ * fmt_num
+ *
+ * Writes v in decimal so that it ends at end, two digits per step.
+ * Returns where it starts.
+ */
+static char *fmt_num(char *end, long long v) {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    unsigned long long u = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+    char *d = end;
+
+    while (u >= 100) {
+        d -= 2;
+        memcpy(d, pairs + 2 * (u % 100), 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        d -= 2;
+        memcpy(d, pairs + 2 * u, 2);
+    } else {
+        *--d = '0' + u;
+    }
+    if (v < 0) {
+        *--d = '-';
+    }
+    return d;
+}
+
+/**
+ * out_field
+ *
+ * Queues pre, v in decimal and post as one fragment, the way the word
+ * listings put an index or a length between two bits of text. pre and
+ * post are short literals.
+ */
+void out_field(const char *pre, long long v, const char *post) {
+    char tmp[24];
+    char *d = fmt_num(tmp + sizeof(tmp), v);
+    size_t n_pre = strlen(pre), n_post = strlen(post);
+    size_t n_num = tmp + sizeof(tmp) - d;
+    char *p = out_reserve(n_pre + n_num + n_post);
+
+    memcpy(p, pre, n_pre);
+    memcpy(p + n_pre, d, n_num);
+    memcpy(p + n_pre + n_num, post, n_post);
+}
+
+/**
+ * out_word
+ *
+ * Queues the "idx. word (n)" line of a word listing. A word short enough
+ * to be copied goes out as one fragment with its index and length.
+ */
+void out_word(long long idx, const char *w, size_t n) {
+    if (n >= OUT_COPY_MAX) {
+        out_field("", idx, ". ");
+        out_bytes(w, n);
+        out_field(" (", n, ")\n");
+        return;
+    }
+
+    char tmp_idx[24], tmp_len[4];
+    char *d_idx = fmt_num(tmp_idx + sizeof(tmp_idx), idx);
+    char *d_len = fmt_num(tmp_len + sizeof(tmp_len), n);
+    size_t n_idx = tmp_idx + sizeof(tmp_idx) - d_idx;
+    size_t n_len = tmp_len + sizeof(tmp_len) - d_len;
+    char *p = out_reserve(n_idx + n + n_len + 6);
+
+    memcpy(p, d_idx, n_idx);
+    p += n_idx;
+    *p++ = '.';
+    *p++ = ' ';
+    memcpy(p, w, n);
+    p += n;
+    *p++ = ' ';
+    *p++ = '(';
+    memcpy(p, d_len, n_len);
+    p += n_len;
+    *p++ = ')';
+    *p = '\n';
+}
+
+/**
+ * print_buff
+ *
+ * Prints the entire buffer for debugging purposes.
+ */
+void print_buff(char *buff, int len) {
+    out_str("Buffer:  ");
+    out_bytes(buff, len);
+    out_str("\n");
+}
+
+/**
+ * usage
+ *
+ * Prints usage instructions for the program.
+ */
+void usage(char *exename) {
+    printf("usage: %s [-h|c|r|R|w|x] \"string\" [other args]  (-R reverses by UTF-8 character)\n", exename);
+    printf("       %s -c|w -i [file ...]  (reads the files, or stdin for - or none)\n", exename);
+    printf("       %s -r|R -i [file ...]  (writes each file reversed, to stdout)\n", exename);
+    printf("       %s -l|m|a -i [file ...]  (counts like wc -l, wc -m or wc -lwmc\n"
+           "           in a UTF-8 locale)\n", exename);
+    printf("       %s -x -i search replace [file ...]  (replaces every match, to stdout)\n", exename);
+    printf("       %s -f N [file ...]  (prints the N most frequent words)\n", exename);
+    printf("       %s -X pairs.txt [file ...]  (replaces every search<TAB>replace line\n"
+           "           of pairs.txt in one pass, leftmost longest match first)\n", exename);
+}
+
+/**
+ * count_starts_scalar
+ *
+ * Counts the bytes that start a word: not whitespace and following a byte
+ * that is. *in_word says whether the byte
+ * before p was inside a word and is updated for the next call.
+ */
+long long count_starts_scalar(const char *p, int len, int *in_word) {
+    long long count = 0;
+    int w = *in_word;
+
+    for (int i = 0; i < len; i++) {
+        unsigned char c = p[i];
+        int space = space_tab[c];
+        count += !space && !w;
+        w = !space;
+    }
+
+    *in_word = w;
+    return count;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Whitespace is ' ' or 9..13, tested as (c - 9) <= 4 unsigned.
+ * SPACE_SSE2(v) and SPACE_AVX2(v) give 0xff in every whitespace lane of
+ * v, using the constants SPACE_CONSTS_* sets up. Every SIMD kernel sets
+ * them up once before its loop, so even -O0 builds do not redo it per
+ * block, and this is the one place that defines whitespace for them.
+ */
+#define SPACE_CONSTS_SSE2 \
+    const __m128i sp = _mm_set1_epi8(' '); \
+    const __m128i tab = _mm_set1_epi8('\t'); \
+    const __m128i four = _mm_set1_epi8(4)
+#define SPACE_SSE2(v) ({ \
+    __m128i x_ = _mm_sub_epi8((v), tab); \
+    _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x_, four), x_), _mm_cmpeq_epi8((v), sp)); })
+#define SPACE_CONSTS_AVX2 \
+    const __m256i sp = _mm256_set1_epi8(' '); \
+    const __m256i tab = _mm256_set1_epi8('\t'); \
+    const __m256i four = _mm256_set1_epi8(4)
+#define SPACE_AVX2(v) ({ \
+    __m256i x_ = _mm256_sub_epi8((v), tab); \
+    _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x_, four), x_), _mm256_cmpeq_epi8((v), sp)); })
+
+/*
+ * The SIMD kernels classify 64 bytes per step into a bitmask with a bit
+ * set for every separator. Bit i starts a word when it is clear and bit
+ * i-1 is set, so ~m & (m << 1 | carry) has one bit per word start, where
+ * carry is the top bit of the previous step. The tail goes to the scalar
+ * kernel.
+ */
+__attribute__((target("sse2")))
+static inline uint64_t space_mask_sse2(const char *p) {
+    SPACE_CONSTS_SSE2;
+    uint64_t m = 0;
+
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        __m128i s = SPACE_SSE2(v);
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (16 * k);
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t space_mask_avx2(const char *p) {
+    SPACE_CONSTS_AVX2;
+    uint64_t m = 0;
+
+    for (int k = 0; k < 2; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * k));
+        __m256i s = SPACE_AVX2(v);
+        m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (32 * k);
+    }
+    return m;
+}
+
+__attribute__((target("sse2")))
+static long long count_starts_sse2(const char *p, int len, int *in_word) {
+    SPACE_CONSTS_SSE2;
+    uint64_t carry = !*in_word;
+    long long count = 0;
+    int i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        uint64_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            __m128i s = SPACE_SSE2(v);
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (16 * k);
+        }
+        count += __builtin_popcountll(~m & (m << 1 | carry));
+        carry = m >> 63;
+    }
+
+    *in_word = !carry;
+    return count + count_starts_scalar(p + i, len - i, in_word);
+}
+
+__attribute__((target("avx2,popcnt")))
+static long long count_starts_avx2(const char *p, int len, int *in_word) {
+    SPACE_CONSTS_AVX2;
+    uint64_t carry = !*in_word;
+    long long count = 0;
+    int i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        uint64_t m = 0;
+        for (int k = 0; k < 2; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i + 32 * k));
+            __m256i s = SPACE_AVX2(v);
+            m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (32 * k);
+        }
+        count += __builtin_popcountll(~m & (m << 1 | carry));
+        carry = m >> 63;
+    }
+
+    *in_word = !carry;
+    return count + count_starts_scalar(p + i, len - i, in_word);
+}
+#endif
+
+/**
+ * simd_level
+ *
+ * The widest kernels the CPU supports, asking cpuid through
+ * __builtin_cpu_supports(), unless SIMD_ENV names narrower ones. Decided
+ * on the first call.
+ */
+static int simd_level(void) {
+    static int level = -1;
+
+    if (level >= 0) {
+        return level;
+    }
+    const char *want = getenv(SIMD_ENV);
+
+    level = SIMD_SCALAR;
+    if (want && strcmp(want, "scalar") == 0) {
+        return level;
+    }
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && (!want || strcmp(want, "avx2") == 0)) {
+        level = SIMD_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        level = SIMD_SSE2;
+    }
+#endif
+    return level;
+}
+
+/**
+ * pick_kernel
+ *
+ * The word counting kernel for simd_level().
+ */
+static count_kernel_fn pick_kernel(void) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+        case SIMD_AVX2:
+            return count_starts_avx2;
+        case SIMD_SSE2:
+            return count_starts_sse2;
+    }
+#endif
+    return count_starts_scalar;
+}
+
+/**
+ * space_mask_scalar
+ *
+ * The whitespace bitmask of p[0..64), as the SIMD kernels make it.
+ */
+static uint64_t space_mask_scalar(const char *p) {
+    uint64_t m = 0;
+
+    for (int k = 0; k < 64; k++) {
+        m |= (uint64_t)space_tab[(unsigned char)p[k]] << k;
+    }
+    return m;
+}
+
+/**
+ * pick_space_mask
+ *
+ * The whitespace bitmask function for simd_level().
+ */
+static space_mask_fn pick_space_mask(void) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+        case SIMD_AVX2:
+            return space_mask_avx2;
+        case SIMD_SSE2:
+            return space_mask_sse2;
+    }
+#endif
+    return space_mask_scalar;
+}
+
+/**
+ * count_word_starts
+ *
+ * Counts the words that start in p[0..len), see count_starts_scalar(),
+ * with the kernel picked on the first call.
+ */
+long long count_word_starts(const char *p, int len, int *in_word) {
+    static count_kernel_fn kernel;
+
+    if (!kernel) {
+        kernel = pick_kernel();
+    }
+    return kernel(p, len, in_word);
+}
+
+/*
+ * How a character takes part in words, as wc sees it: the six ASCII
+ * whitespace bytes and printable whitespace separate words, other
+ * printable characters are part of one, and characters that are not
+ * printable are skipped.
+ */
+#define WC_SKIP 0
+#define WC_WORD 1
+#define WC_SPACE 2
+
+/**
+ * wc_class
+ *
+ * Classes a character past ASCII with the C library's tables for a UTF-8
+ * locale, so it agrees with wc, which also counts the no-break spaces
+ * U+00A0, U+2007, U+202F and U+2060 as whitespace. Classes below U+20000
+ * are kept once looked up. Without a UTF-8 locale only C1 controls are
+ * skipped and the no-break spaces separate.
+ */
+static int wc_class(uint32_t cp) {
+    static unsigned char known[0x20000];  // class + 1, 0 until looked up
+    static locale_t utf8;
+    static int tried;
+    int cls;
+
+    if (cp < 0x20000 && known[cp]) {
+        return known[cp] - 1;
+    }
+    if (!tried) {
+        utf8 = newlocale(LC_CTYPE_MASK, "C.UTF-8", (locale_t)0);
+        tried = 1;
+    }
+    int nbsp = cp == 0xa0 || cp == 0x2007 || cp == 0x202f || cp == 0x2060;
+    if (!utf8) {
+        cls = cp < 0xa0 ? WC_SKIP : nbsp ? WC_SPACE : WC_WORD;
+    } else if (!iswprint_l(cp, utf8)) {
+        cls = WC_SKIP;
+    } else {
+        cls = iswspace_l(cp, utf8) || nbsp ? WC_SPACE : WC_WORD;
+    }
+    if (cp < 0x20000) {
+        known[cp] = cls + 1;
+    }
+    return cls;
+}
+
+/**
+ * wc_decode
+ *
+ * Adds the lines, words and characters of p[0..len) to c, one byte at a
+ * time, going on from and leaving *ws. A sequence that is cut short or
+ * encodes a code point too small for its length, or a surrogate, counts
+ * for nothing, as do bytes that cannot start one; the byte that cut a
+ * sequence short starts afresh. Like glibc, sequences of up to six bytes
+ * are accepted.
+ */
+static void wc_decode(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    for (int i = 0; i < len; i++) {
+        unsigned char b = p[i];
+        int cls;
+
+        c->lines += b == '\n';
+        if (ws->need > 0) {
+            if ((b & 0xc0) == 0x80) {
+                ws->cp = ws->cp << 6 | (b & 0x3f);
+                if (--ws->need > 0 || ws->cp < ws->min ||
+                    (ws->cp >= 0xd800 && ws->cp <= 0xdfff)) {
+                    continue;
+                }
+                cls = wc_class(ws->cp);
+                c->chars++;
+                c->words += cls == WC_WORD && !ws->in_word;
+                ws->in_word = cls == WC_WORD || (cls == WC_SKIP && ws->in_word);
+                continue;
+            }
+            ws->need = 0;
+        }
+
+        if (b < 0x80) {
+            cls = space_tab[b] ? WC_SPACE : b > ' ' && b < 0x7f ? WC_WORD : WC_SKIP;
+            c->chars++;
+            c->words += cls == WC_WORD && !ws->in_word;
+            ws->in_word = cls == WC_WORD || (cls == WC_SKIP && ws->in_word);
+        } else if (b >= 0xc2 && b <= 0xfd) {
+            ws->need = b < 0xe0 ? 1 : b < 0xf0 ? 2 : b < 0xf8 ? 3 : b < 0xfc ? 4 : 5;
+            ws->cp = b & (0x3f >> ws->need);
+            ws->min = ws->need == 1 ? 0x80 : 1u << (5 * ws->need + 1);
+        }
+    }
+}
+
+/**
+ * wc_scalar
+ *
+ * Adds the lines, words, characters and bytes of p[0..len) to c, see
+ * wc_decode().
+ */
+static void wc_scalar(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    c->bytes += len;
+    wc_decode(p, len, ws, c);
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * The masks the SIMD wc kernels make of each 64 bytes, bit k for byte k.
+ */
+typedef struct wc_masks {
+    uint64_t space;         // ASCII whitespace
+    uint64_t text;          // whitespace, printable ASCII or not ASCII
+    uint64_t high;          // not ASCII
+    uint64_t lines;         // newlines
+} wc_masks_t;
+
+/**
+ * wc_high
+ *
+ * Decodes the characters past ASCII in a block of *len bytes at p, whose
+ * bytes are set in high, and adds the whitespace ones to *space. The
+ * block is cut short before a character that runs past its end. Returns
+ * the continuation bytes, or -1 if a character is not valid or not
+ * printable, and the block has to go through wc_decode().
+ */
+static int wc_high(const char *p, uint64_t high, uint64_t *space, int *len) {
+    int cont = 0;
+
+    while (high) {
+        int k = __builtin_ctzll(high);
+        unsigned char b = p[k];
+        if (b < 0xc2 || b > 0xf4) {
+            return -1;
+        }
+        int n = b < 0xe0 ? 1 : b < 0xf0 ? 2 : 3;
+        if (k + n >= *len) {
+            *len = k;
+            return cont;
+        }
+        uint32_t cp = b & (0x3f >> n);
+        for (int j = 1; j <= n; j++) {
+            unsigned char cb = p[k + j];
+            if ((cb & 0xc0) != 0x80) {
+                return -1;
+            }
+            cp = cp << 6 | (cb & 0x3f);
+        }
+        if (cp < (n == 1 ? 0x80u : 1u << (5 * n + 1)) || (cp >= 0xd800 && cp <= 0xdfff)) {
+            return -1;
+        }
+        int cls = wc_class(cp);
+        if (cls == WC_SKIP) {
+            return -1;
+        }
+        uint64_t bits = ((2ull << n) - 1) << k;
+        if (cls == WC_SPACE) {
+            *space |= bits;
+        }
+        high &= ~bits;
+        cont += n;
+    }
+    return cont;
+}
+
+/**
+ * wc_block
+ *
+ * Counts the 64 bytes at p from their masks for the SIMD wc kernels and
+ * returns how many it took. Words start where the whitespace mask does
+ * not follow a set bit, and characters are the bytes that do not
+ * continue one, as long as every byte is whitespace or printable ASCII
+ * or part of a character wc_high() takes. Anything else, and a
+ * character cut by the end of the last call, goes through wc_decode().
+ */
+static int wc_block(const char *p, wc_masks_t *mk, wc_state_t *ws, wc_counts_t *c) {
+    int n = 64, cont = 0;
+
+    if (ws->need) {
+        wc_decode(p, 1, ws, c);
+        return 1;
+    }
+    if (~mk->text || (mk->high && (cont = wc_high(p, mk->high, &mk->space, &n)) < 0)) {
+        wc_decode(p, 64, ws, c);
+        return 64;
+    }
+    uint64_t keep = n == 64 ? ~0ull : (1ull << n) - 1;
+    uint64_t m = mk->space & keep;
+    c->words += __builtin_popcountll(~m & (m << 1 | !ws->in_word) & keep);
+    c->lines += __builtin_popcountll(mk->lines & keep);
+    c->chars += n - cont;
+    ws->in_word = !(m >> (n - 1) & 1);
+    return n;
+}
+
+__attribute__((target("sse2")))
+static void wc_sse2(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    SPACE_CONSTS_SSE2;
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i bang = _mm_set1_epi8('!');
+    const __m128i graph = _mm_set1_epi8('~' - '!');
+    int i = 0;
+
+    c->bytes += len;
+    while (i + 64 <= len) {
+        wc_masks_t mk = { 0 };
+        uint64_t ascii = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            __m128i s = SPACE_SSE2(v);
+            __m128i x = _mm_sub_epi8(v, bang);
+            __m128i g = _mm_cmpeq_epi8(_mm_min_epu8(x, graph), x);
+            mk.space |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (16 * k);
+            ascii |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(s, g)) << (16 * k);
+            mk.high |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << (16 * k);
+            mk.lines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * k);
+        }
+        mk.text = ascii | mk.high;
+        i += wc_block(p + i, &mk, ws, c);
+    }
+    wc_decode(p + i, len - i, ws, c);
+}
+
+__attribute__((target("avx2")))
+static void wc_avx2(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    SPACE_CONSTS_AVX2;
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i bang = _mm256_set1_epi8('!');
+    const __m256i graph = _mm256_set1_epi8('~' - '!');
+    int i = 0;
+
+    c->bytes += len;
+    while (i + 64 <= len) {
+        wc_masks_t mk = { 0 };
+        uint64_t ascii = 0;
+        for (int k = 0; k < 2; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i + 32 * k));
+            __m256i s = SPACE_AVX2(v);
+            __m256i x = _mm256_sub_epi8(v, bang);
+            __m256i g = _mm256_cmpeq_epi8(_mm256_min_epu8(x, graph), x);
+            mk.space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (32 * k);
+            ascii |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(s, g)) << (32 * k);
+            mk.high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << (32 * k);
+            mk.lines |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)) << (32 * k);
+        }
+        mk.text = ascii | mk.high;
+        i += wc_block(p + i, &mk, ws, c);
+    }
+    wc_decode(p + i, len - i, ws, c);
+}
+
+/*
+ * -l prints nothing but lines, so its kernels only compare against '\n'.
+ * Each match subtracts -1 from a byte lane, and the lanes are added into
+ * 64 bit sums with sad_epu8 before 255 steps can overflow them.
+ */
+__attribute__((target("sse2")))
+static void lines_sse2(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    __m128i sum = _mm_setzero_si128();
+    int i = 0;
+
+    (void)ws;
+    while (i + 16 <= len) {
+        __m128i acc = _mm_setzero_si128();
+        for (int k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, _mm_setzero_si128()));
+    }
+    c->lines += _mm_cvtsi128_si64(sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+    c->bytes += i;
+    for (; i < len; i++) {
+        c->lines += p[i] == '\n';
+        c->bytes++;
+    }
+}
+
+__attribute__((target("avx2")))
+static void lines_avx2(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i sum = _mm256_setzero_si256();
+    int i = 0;
+
+    (void)ws;
+    while (i + 32 <= len) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int k = 0; k < 255 && i + 32 <= len; k++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+    }
+    c->lines += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+                _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+    c->bytes += i;
+    for (; i < len; i++) {
+        c->lines += p[i] == '\n';
+        c->bytes++;
+    }
+}
+#endif
+
+/**
+ * wc_count
+ *
+ * Adds the counts of p[0..len) to c, see wc_scalar(), with the kernel of
+ * simd_level() picked on the first call.
+ */
+void wc_count(const char *p, int len, wc_state_t *ws, wc_counts_t *c) {
+    static wc_kernel_fn kernel;
+
+    if (!kernel) {
+        kernel = wc_scalar;
+#ifdef HAVE_X86_SIMD
+        if (simd_level() == SIMD_AVX2) {
+            kernel = wc_avx2;
+        } else if (simd_level() == SIMD_SSE2) {
+            kernel = wc_sse2;
+        }
+#endif
+    }
+    kernel(p, len, ws, c);
+}
+
+/**
+ * wc_lines
+ *
+ * Adds the newlines and bytes of p[0..len) to c, for -l. Words and
+ * characters are left alone.
+ */
+void wc_lines(const char *p, int len, wc_counts_t *c) {
+    static wc_kernel_fn kernel;
+
+    if (!kernel) {
+        kernel = wc_scalar;
+#ifdef HAVE_X86_SIMD
+        if (simd_level() == SIMD_AVX2) {
+            kernel = lines_avx2;
+        } else if (simd_level() == SIMD_SSE2) {
+            kernel = lines_sse2;
+        }
+#endif
+    }
+    wc_state_t ws = { 0 };
+    kernel(p, len, &ws, c);
+}
+
+/**
+ * count_words
+ *
+ * Counts the number of words in the user string (up to str_len).
+ */
+int count_words(char *buff, int buff_len, int str_len) {
+    if (!buff || str_len > buff_len) {
+        return -1;
+    }
+
+    int in_word = 0;
+
+    return count_word_starts(buff, str_len, &in_word);
+}
+
+/**
+ * reverse_scalar
+ *
+ * Reverses p[i..j) one byte pair at a time, what the SIMD kernels leave
+ * in the middle.
+ */
+static void reverse_scalar(char *p, size_t i, size_t j) {
+    while (i + 1 < j) {
+        char temp = p[i];
+        p[i++] = p[--j];
+        p[j] = temp;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * The SIMD reverses load a block from each end, reverse the bytes of
+ * both in registers and store each at the other end, until less than two
+ * blocks are left in the middle. SSE2 has no byte shuffle, so it reverses
+ * the dwords, then the words in each dword, then the bytes in each word.
+ */
+__attribute__((target("sse2")))
+static void reverse_sse2(char *p, size_t len) {
+    size_t i = 0, j = len;
+
+    for (; j - i >= 32; i += 16, j -= 16) {
+        __m128i v[2] = {
+            _mm_loadu_si128((const __m128i *)(p + i)),
+            _mm_loadu_si128((const __m128i *)(p + j - 16))
+        };
+        for (int k = 0; k < 2; k++) {
+            v[k] = _mm_shuffle_epi32(v[k], _MM_SHUFFLE(0, 1, 2, 3));
+            v[k] = _mm_shufflelo_epi16(v[k], _MM_SHUFFLE(2, 3, 0, 1));
+            v[k] = _mm_shufflehi_epi16(v[k], _MM_SHUFFLE(2, 3, 0, 1));
+            v[k] = _mm_or_si128(_mm_slli_epi16(v[k], 8), _mm_srli_epi16(v[k], 8));
+        }
+        _mm_storeu_si128((__m128i *)(p + i), v[1]);
+        _mm_storeu_si128((__m128i *)(p + j - 16), v[0]);
+    }
+    reverse_scalar(p, i, j);
+}
+
+__attribute__((target("avx2")))
+static void reverse_avx2(char *p, size_t len) {
+    const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0, j = len;
+
+    for (; j - i >= 64; i += 32, j -= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + j - 32));
+        // Reverse within each 128 bit lane, then swap the lanes
+        a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, rev), 0x4e);
+        b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, rev), 0x4e);
+        _mm256_storeu_si256((__m256i *)(p + i), b);
+        _mm256_storeu_si256((__m256i *)(p + j - 32), a);
+    }
+    reverse_scalar(p, i, j);
+}
+#endif
+
+/**
+ * reverse_bytes
+ *
+ * Reverses p[0..len) in place with the kernel of simd_level().
+ */
+void reverse_bytes(char *p, size_t len) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+        case SIMD_AVX2:
+            reverse_avx2(p, len);
+            return;
+        case SIMD_SSE2:
+            reverse_sse2(p, len);
+            return;
+    }
+#endif
+    reverse_scalar(p, 0, len);
+}
+
+/**
+ * utf8_fix_run
+ *
+ * Byte reversed UTF-8 has each multibyte character backwards: its
+ * continuation bytes (10xxxxxx) first and the lead byte last. p[s] starts
+ * such a run; puts the character back in order when the run is 1 to 3
+ * bytes followed by a lead byte, and leaves malformed bytes as they are.
+ * Returns where to go on looking.
+ */
+static size_t utf8_fix_run(char *p, size_t len, size_t s) {
+    size_t e = s;
+
+    while (e < len && ((unsigned char)p[e] & 0xc0) == 0x80) {
+        e++;
+    }
+    if (e == len || e - s > 3 || (unsigned char)p[e] < 0xc0) {
+        return e;
+    }
+    reverse_scalar(p, s, e + 1);
+    return e + 1;
+}
+
+static void utf8_fix_scalar(char *p, size_t len, size_t i) {
+    while (i < len) {
+        if (((unsigned char)p[i] & 0xc0) == 0x80) {
+            i = utf8_fix_run(p, len, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * The SIMD fix-ups find the continuation bytes of 64 bytes at a time as
+ * a bitmask; as signed chars they are the ones below -64. ASCII blocks
+ * have no bit set and cost one compare. Otherwise the length of each run
+ * is read off the mask and the character swapped back in place, only a
+ * run that reaches the end of the block goes through utf8_fix_run().
+ */
+static size_t utf8_fix_mask(char *p, size_t len, size_t blk, uint64_t m) {
+    char *b = p + blk;
+
+    while (m) {
+        int k = __builtin_ctzll(m);
+        uint64_t rest = ~(m >> k);
+        int r = rest ? __builtin_ctzll(rest) : 64 - k;
+        if (k + r >= 64) {
+            return utf8_fix_run(p, len, blk + k);
+        }
+        m &= ~0ULL << (k + r);
+        if (r > 3 || (unsigned char)b[k + r] < 0xc0) {
+            continue;
+        }
+        char t = b[k];
+        b[k] = b[k + r];
+        b[k + r] = t;
+        if (r == 3) {
+            t = b[k + 1];
+            b[k + 1] = b[k + 2];
+            b[k + 2] = t;
+        }
+    }
+    return blk + 64;
+}
+
+__attribute__((target("sse2")))
+static void utf8_fix_sse2(char *p, size_t len) {
+    const __m128i lim = _mm_set1_epi8(-64);
+    size_t i = 0;
+
+    while (i + 64 <= len) {
+        uint64_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, lim)) << (16 * k);
+        }
+        i = m ? utf8_fix_mask(p, len, i, m) : i + 64;
+    }
+    utf8_fix_scalar(p, len, i);
+}
+
+__attribute__((target("avx2")))
+static void utf8_fix_avx2(char *p, size_t len) {
+    const __m256i lim = _mm256_set1_epi8(-64);
+    size_t i = 0;
+
+    while (i + 64 <= len) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(lim, a)) |
+                     (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(lim, b)) << 32;
+        i = m ? utf8_fix_mask(p, len, i, m) : i + 64;
+    }
+    utf8_fix_scalar(p, len, i);
+}
+#endif
+
+/**
+ * utf8_fix
+ *
+ * Puts the multibyte characters of byte reversed UTF-8 back in order,
+ * see utf8_fix_run(), with the kernel of simd_level().
+ */
+void utf8_fix(char *p, size_t len) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+        case SIMD_AVX2:
+            utf8_fix_avx2(p, len);
+            return;
+        case SIMD_SSE2:
+            utf8_fix_sse2(p, len);
+            return;
+    }
+#endif
+    utf8_fix_scalar(p, len, 0);
+}
+
+/**
+ * reverse_string
+ *
+ * Reverses the user-supplied string in place (up to str_len).
+ */
+int reverse_string(char *buff, int buff_len, int str_len) {
+    if (!buff || str_len > buff_len) {
+        return -1;
+    }
+
+    reverse_bytes(buff, str_len);
+    return 0;
+}
+
+/**
+ * reverse_utf8
+ *
+ * Reverses the user-supplied string in place (up to str_len) by code
+ * point, so multibyte UTF-8 characters stay readable.
+ */
+int reverse_utf8(char *buff, int buff_len, int str_len) {
+    if (!buff || str_len > buff_len) {
+        return -1;
+    }
+
+    reverse_bytes(buff, str_len);
+    utf8_fix(buff, str_len);
+    return 0;
+}
+
+/**
+ * collapse_scalar
+ *
+ * Copies src[i..n) to dst, each run of whitespace as one ' ', the way
+ * setup_buff() wants. *in_space says whether the byte before src[i] was
+ * whitespace and is updated. Returns the bytes written.
+ */
+static int collapse_scalar(char *dst, const char *src, int i, int n, int *in_space) {
+    int out = 0;
+    int w = *in_space;
+
+    for (; i < n; i++) {
+        int space = space_tab[(unsigned char)src[i]];
+        if (!(space && w)) {
+            dst[out++] = space ? ' ' : src[i];
+        }
+        w = space;
+    }
+
+    *in_space = w;
+    return out;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * The SIMD collapses classify 64 bytes per step like the word counting
+ * kernels, into a mask m of whitespace, and store the block with every
+ * whitespace byte made ' '. A byte is kept unless it is whitespace after
+ * whitespace: keep = ~m | (m & ~(m << 1 | carry)). Blocks of plain text
+ * are kept whole; otherwise each run of kept bytes, a word and the space
+ * before it, is copied out of the stored block with one memcpy.
+ */
+static int collapse_block(char *dst, const char *blk, uint64_t m, uint64_t carry) {
+    uint64_t keep = ~m | (m & ~(m << 1 | carry));
+    int out = 0;
+
+    while (keep) {
+        int k = __builtin_ctzll(keep);
+        uint64_t rest = ~(keep >> k);
+        int r = rest ? __builtin_ctzll(rest) : 64 - k;
+        memcpy(dst + out, blk + k, r);
+        out += r;
+        if (k + r >= 64) {
+            break;
+        }
+        keep &= ~0ULL << (k + r);
+    }
+    return out;
+}
+
+__attribute__((target("sse2")))
+static int collapse_sse2(char *dst, const char *src, int n) {
+    SPACE_CONSTS_SSE2;
+    char blk[64];
+    uint64_t carry = 0;
+    int out = 0;
+    int i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        uint64_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i + 16 * k));
+            __m128i s = SPACE_SSE2(v);
+            v = _mm_or_si128(_mm_and_si128(s, sp), _mm_andnot_si128(s, v));
+            _mm_storeu_si128((__m128i *)(blk + 16 * k), v);
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (16 * k);
+        }
+        if (m == 0) {
+            memcpy(dst + out, blk, 64);
+            out += 64;
+        } else {
+            out += collapse_block(dst + out, blk, m, carry);
+        }
+        carry = m >> 63;
+    }
+
+    int in_space = carry;
+    return out + collapse_scalar(dst + out, src, i, n, &in_space);
+}
+
+__attribute__((target("avx2")))
+static int collapse_avx2(char *dst, const char *src, int n) {
+    SPACE_CONSTS_AVX2;
+    char blk[64];
+    uint64_t carry = 0;
+    int out = 0;
+    int i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        uint64_t m = 0;
+        for (int k = 0; k < 2; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + i + 32 * k));
+            __m256i s = SPACE_AVX2(v);
+            _mm256_storeu_si256((__m256i *)(blk + 32 * k), _mm256_blendv_epi8(v, sp, s));
+            m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (32 * k);
+        }
+        if (m == 0) {
+            memcpy(dst + out, blk, 64);
+            out += 64;
+        } else {
+            out += collapse_block(dst + out, blk, m, carry);
+        }
+        carry = m >> 63;
+    }
+
+    int in_space = carry;
+    return out + collapse_scalar(dst + out, src, i, n, &in_space);
+}
+#endif
+
+/**
+ * collapse_spaces
+ *
+ * Copies src[0..n) to dst, which may be src itself, with every run of
+ * whitespace collapsed into one ' ', using the kernel of simd_level().
+ * Returns the length written, at most n.
+ */
+int collapse_spaces(char *dst, const char *src, int n) {
+    int in_space = 0;
+
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+        case SIMD_AVX2:
+            return collapse_avx2(dst, src, n);
+        case SIMD_SSE2:
+            return collapse_sse2(dst, src, n);
+    }
+#endif
+    return collapse_scalar(dst, src, 0, n, &in_space);
+}
+
+/**
+ * print_words
+ *
+ * Prints individual words and their lengths.
+ */
+int print_words(char *buff, int buff_len, int str_len) {
+    if (!buff || str_len > buff_len) {
+        return -1;
+    }
+
+    int word_idx = 1;
+    int in_word = 0;
+    char *start = NULL;
+
+    out_str("Word Print\n");
+    out_str("----------\n");
+
+    for (int i = 0; i < str_len; i++) {
+        if (buff[i] != ' ') {
+            if (!in_word) {
+                start = &buff[i];
+                in_word = 1;
+            }
+        } else if (in_word) {
+            out_word(word_idx++, start, &buff[i] - start);
+            in_word = 0;
+        }
+    }
+
+    if (in_word) {
+        out_word(word_idx++, start, (buff + str_len) - start);
+    }
+
+    return word_idx - 1;
+}
+
+/**
+ * replace_substring
+ *
+ * Replaces the first occurrence of 'search' with 'replace' in buff.
+ * Returns:
+ *   -2 : if search does not occur
+ *   -1 : if an argument is invalid or the result does not fit in buff_len
+ *   >=0: the length of the string after the replacement
+ */
+int replace_substring(char *buff, int buff_len, int str_len, char *search, char *replace) {
+    if (!buff || !search || !replace) {
+        return -1;
+    }
+
+    int search_len = 0, replace_len = 0;
+
+    while (search[search_len] != '\0') search_len++;
+    while (replace[replace_len] != '\0') replace_len++;
+
+    searcher_t find;
+    search_init(&find, search, search_len);
+    char *found = search_len > 0 ? (char *)search_next(&find, buff, buff + str_len) : buff;
+
+    if (!found) {
+        return -2;
+    }
+
+    int new_len = str_len - search_len + replace_len;
+    if (new_len > buff_len) {
+        return -1;
+    }
+
+    memmove(found + replace_len, found + search_len, str_len - (found - buff) - search_len);
+    memcpy(found, replace, replace_len);
+
+    return new_len;
+}
+
+/**
+ * max_suffix
+ *
+ * Start, less one, of the largest suffix of x[0..m) in byte order, or in
+ * reverse order if rev is set, and its period in *period.
+ */
+static int max_suffix(const unsigned char *x, int m, int rev, int *period) {
+    int ms = -1, j = 0, k = 1, p = 1;
+
+    while (j + k < m) {
+        unsigned char a = x[j + k];
+        unsigned char b = x[ms + k];
+        if (rev ? a > b : a < b) {
+            j += k;
+            k = 1;
+            p = j - ms;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            ms = j;
+            j = ms + 1;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ms;
+}
+
+/**
+ * search_init
+ *
+ * Prepares needle[0..len) for search_next(). len must be at least 1.
+ */
+void search_init(searcher_t *s, const char *needle, int len) {
+    const unsigned char *x = (const unsigned char *)needle;
+    int p, q;
+
+    s->needle = needle;
+    s->len = len;
+    for (int c = 0; c < 256; c++) {
+        s->skip[c] = len;
+    }
+    for (int i = 0; i < len - 1; i++) {
+        s->skip[x[i]] = len - 1 - i;
+    }
+
+    int i = max_suffix(x, len, 0, &p);
+    int j = max_suffix(x, len, 1, &q);
+    s->split = i > j ? i : j;
+    s->period = i > j ? p : q;
+    s->periodic = s->split + 1 + s->period <= len &&
+                  memcmp(x, x + s->period, s->split + 1) == 0;
+    if (!s->periodic) {
+        int left = s->split + 1, right = len - s->split - 1;
+        s->period = (left > right ? left : right) + 1;
+    }
+}
+
+/**
+ * two_way
+ *
+ * Finds the first match in [p, end) with Crochemore and Perrin's Two-Way
+ * algorithm, which compares each text byte a bounded number of times
+ * whatever the needle: the right part is matched first and a mismatch
+ * there shifts past it, a mismatch in the left part shifts by the period.
+ * For a periodic needle the bytes a shift by the period keeps matched
+ * are not compared again. Returns the match, or NULL if there is none.
+ */
+static const char *two_way(const searcher_t *s, const char *p, const char *end) {
+    const unsigned char *x = (const unsigned char *)s->needle;
+    const unsigned char *y = (const unsigned char *)p;
+    long n = end - p;
+    int m = s->len, ell = s->split, per = s->period;
+    int memory = -1;
+    long j = 0;
+
+    while (j <= n - m) {
+        int i = (s->periodic && memory > ell ? memory : ell) + 1;
+        while (i < m && x[i] == y[i + j]) {
+            i++;
+        }
+        if (i < m) {
+            j += i - ell;
+            memory = -1;
+            continue;
+        }
+        int low = s->periodic ? memory : -1;
+        for (i = ell; i > low && x[i] == y[i + j]; i--) {
+        }
+        if (i <= low) {
+            return p + j;
+        }
+        j += per;
+        memory = s->periodic ? m - per - 1 : -1;
+    }
+    return NULL;
+}
+
+/**
+ * search_next
+ *
+ * Finds the first match in [p, end). memchr() jumps to the next place the
+ * first byte of the needle occurs, which skips most of the text when that
+ * byte is rare. A window that does not match moves on by the Horspool
+ * shift of its last byte, so common first bytes do not cost a memchr()
+ * per position. A needle like a^k b a^k in a run of a's passes both
+ * end checks at every byte and shifts by one, so once the compares of
+ * windows that did not match cost more than SEARCH_WORK times the bytes
+ * passed, the rest goes to two_way(). Returns the match, or NULL if
+ * there is none.
+ */
+const char *search_next(const searcher_t *s, const char *p, const char *end) {
+    const char *start = p;
+    int m = s->len;
+    unsigned char first = s->needle[0];
+    unsigned char last = s->needle[m - 1];
+    long work = 0;
+
+    while (end - p >= m) {
+        p = memchr(p, first, (end - p) - m + 1);
+        if (!p) {
+            return NULL;
+        }
+        if ((unsigned char)p[m - 1] == last) {
+            if (memcmp(p + 1, s->needle + 1, m - 1) == 0) {
+                return p;
+            }
+            work += m;
+            if (work > SEARCH_WORK * (p - start + m)) {
+                return two_way(s, p, end);
+            }
+        }
+        p += s->skip[(unsigned char)p[m - 1]];
+    }
+    return NULL;
+}
+
+/**
+ * replace_run
+ *
+ * Writes p[0..n) to stdout with every match replaced. Unless final is
+ * set, the last find.len - 1 bytes after the last match are held back,
+ * they could be the start of a match the next chunk finishes. Returns
+ * the number of bytes written out of p.
+ */
+static int replace_run(stream_t *st, const char *p, int n, int final) {
+    const char *pos = p;
+    const char *end = p + n;
+    const char *hit;
+
+    while ((hit = search_next(&st->find, pos, end)) != NULL) {
+        fwrite(pos, 1, hit - pos, stdout);
+        fwrite(st->replace, 1, st->replace_len, stdout);
+        pos = hit + st->find.len;
+        st->words++;
+    }
+
+    int keep = final ? 0 : st->find.len - 1;
+    if (keep > end - pos) {
+        keep = end - pos;
+    }
+    fwrite(pos, 1, (end - pos) - keep, stdout);
+    return n - keep;
+}
+
+/**
+ * replace_chunk
+ *
+ * -x for one chunk. A match can start in the held back bytes, so those
+ * and the first find.len - 1 bytes of the chunk are searched together
+ * first; there is room for at most one match that crosses the boundary.
+ * The chunk itself is then searched where it lies, so every byte is
+ * copied once, to stdout.
+ */
+static void replace_chunk(stream_t *st, char *chunk, int len) {
+    int off = 0;
+
+    if (st->n_carry > 0) {
+        int c = st->n_carry;
+        int take = len < st->find.len - 1 ? len : st->find.len - 1;
+
+        memcpy(st->carry + c, chunk, take);
+        int used = replace_run(st, st->carry, c + take, 0);
+        if (used < c) {
+            // the chunk was too short to settle the boundary
+            st->n_carry = c + take - used;
+            memmove(st->carry, st->carry + used, st->n_carry);
+            return;
+        }
+        off = used - c;
+    }
+
+    int used = replace_run(st, chunk + off, len - off, 0);
+    st->n_carry = len - off - used;
+    memcpy(st->carry, chunk + off + used, st->n_carry);
+}
+
+/**
+ * ac_add
+ *
+ * Adds pattern pat to the trie, growing the state table as needed. A
+ * pattern given twice keeps the later replacement. Returns 0, or -1 if
+ * there is no memory.
+ */
+static int ac_add(ac_t *ac, const char *pat, int len, int id) {
+    int s = 0;
+
+    for (int i = 0; i < len; i++) {
+        unsigned char c = pat[i];
+        if (ac->next[s][c] > 0) {
+            s = ac->next[s][c];
+            continue;
+        }
+        if (ac->n_states == ac->cap) {
+            int cap = ac->cap * 2;
+            void *next = realloc(ac->next, cap * sizeof(ac->next[0]));
+            if (next) ac->next = next;
+            int *match_len = realloc(ac->match_len, cap * sizeof(int));
+            if (match_len) ac->match_len = match_len;
+            int *match_pat = realloc(ac->match_pat, cap * sizeof(int));
+            if (match_pat) ac->match_pat = match_pat;
+            if (!next || !match_len || !match_pat) {
+                return -1;
+            }
+            ac->cap = cap;
+        }
+        int t = ac->n_states++;
+        memset(ac->next[t], 0, sizeof(ac->next[t]));
+        ac->match_len[t] = 0;
+        ac->match_pat[t] = -1;
+        ac->next[s][c] = t;
+        s = t;
+    }
+    ac->match_len[s] = len;
+    ac->match_pat[s] = id;
+    return 0;
+}
+
+/**
+ * ac_build
+ *
+ * Computes the failure links breadth first and folds them into next[],
+ * so a byte with no trie edge goes where the failure link would take it.
+ * A state without a pattern of its own inherits the longest match of its
+ * failure state. Returns 0, or -1 if there is no memory.
+ */
+static int ac_build(ac_t *ac) {
+    int *fail = calloc(ac->n_states, sizeof(int));
+    int *queue = malloc(ac->n_states * sizeof(int));
+    int head = 0, tail = 0;
+
+    if (!fail || !queue) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    for (int c = 0; c < 256; c++) {
+        if (ac->next[0][c] > 0) {
+            queue[tail++] = ac->next[0][c];
+        }
+    }
+    while (head < tail) {
+        int u = queue[head++];
+        if (ac->match_pat[u] < 0) {
+            ac->match_len[u] = ac->match_len[fail[u]];
+            ac->match_pat[u] = ac->match_pat[fail[u]];
+        }
+        for (int c = 0; c < 256; c++) {
+            int v = ac->next[u][c];
+            if (v > 0) {
+                fail[v] = ac->next[fail[u]][c];
+                queue[tail++] = v;
+            } else {
+                ac->next[u][c] = ac->next[fail[u]][c];
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+/**
+ * ac_load
+ *
+ * Reads a pairs file, one "search<TAB>replace" per line, and builds the
+ * automaton from it. Empty lines are skipped. Returns:
+ *   -1 : if the file cant be read, has a line without a tab or with an
+ *        empty search string, or there is no memory
+ *   -2 : if the file has no pairs at all
+ *    0 : otherwise
+ */
+int ac_load(ac_t *ac, const char *path) {
+    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int line_no = 0;
+    int rc = 0;
+
+    memset(ac, 0, sizeof(*ac));
+    if (!f) {
+        printf("Error opening %s\n", path);
+        return -1;
+    }
+    ac->cap = 64;
+    ac->n_states = 1;
+    ac->next = calloc(ac->cap, sizeof(ac->next[0]));
+    ac->match_len = calloc(ac->cap, sizeof(int));
+    ac->match_pat = malloc(ac->cap * sizeof(int));
+    if (!ac->next || !ac->match_len || !ac->match_pat) {
+        rc = -1;
+    } else {
+        ac->match_pat[0] = -1;
+    }
+
+    while (rc == 0 && (n = getline(&line, &cap, f)) != -1) {
+        line_no++;
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+            line[--n] = '\0';
+        }
+        if (n == 0) {
+            continue;
+        }
+        char *tab = memchr(line, '\t', n);
+        if (!tab || tab == line) {
+            printf("Error: line %d of %s is not search<TAB>replace\n", line_no, path);
+            rc = -1;
+            break;
+        }
+
+        char **repl = realloc(ac->repl, (ac->n_pats + 1) * sizeof(char *));
+        if (repl) ac->repl = repl;
+        int *repl_len = realloc(ac->repl_len, (ac->n_pats + 1) * sizeof(int));
+        if (repl_len) ac->repl_len = repl_len;
+        if (!repl || !repl_len || !(ac->repl[ac->n_pats] = strdup(tab + 1))) {
+            rc = -1;
+            break;
+        }
+        ac->repl_len[ac->n_pats] = line + n - (tab + 1);
+        int len = tab - line;
+        for (int i = 0; i < len / 2; i++) {
+            char c = line[i];
+            line[i] = line[len - 1 - i];
+            line[len - 1 - i] = c;
+        }
+        if (ac_add(ac, line, len, ac->n_pats++) < 0) {
+            rc = -1;
+            break;
+        }
+        if (len > ac->max_len) {
+            ac->max_len = len;
+        }
+    }
+
+    free(line);
+    fclose(f);
+    if (rc == 0 && ac->n_pats == 0) {
+        printf("Error: %s has no search<TAB>replace lines\n", path);
+        rc = -2;
+    }
+    if (rc == 0 && ac_build(ac) < 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * ac_scan
+ *
+ * Writes out data[0..n) with its leftmost-longest matches replaced, up
+ * to the first position a match could still start at and run past n,
+ * which is returned. The automaton runs backwards from data[n-1] and
+ * notes its state at every byte. A forward pass then takes the longest
+ * match at each position it reaches and jumps past it. Only positions
+ * max_len or more bytes before n are settled, all of them when at_end is
+ * set, so each byte is scanned once plus once per chunk it is held back.
+ */
+static int ac_scan(stream_t *st, const char *data, int n, int at_end) {
+    ac_t *ac = st->ac;
+    int *at = st->ac_at;
+    int settle = at_end ? n : n - ac->max_len + 1;
+    if (settle > n) {
+        settle = n;
+    }
+    int s = 0;
+    int i = 0, emitted = 0;
+
+    for (int k = n - 1; k >= 0; k--) {
+        s = ac->next[s][(unsigned char)data[k]];
+        at[k] = s;
+    }
+
+    while (i < settle) {
+        int len = ac->match_len[at[i]];
+        if (len == 0) {
+            i++;
+            continue;
+        }
+        int pat = ac->match_pat[at[i]];
+        fwrite(data + emitted, 1, i - emitted, stdout);
+        fwrite(ac->repl[pat], 1, ac->repl_len[pat], stdout);
+        st->words++;
+        i += len;
+        emitted = i;
+    }
+    if (i > emitted) {
+        fwrite(data + emitted, 1, i - emitted, stdout);
+    }
+    return i;
+}
+
+/**
+ * ac_chunk
+ *
+ * -X for one chunk, after the bytes held back from the last one. What
+ * ac_scan() could not settle, less than the longest pattern, is held
+ * back again.
+ */
+static void ac_chunk(stream_t *st, char *chunk, int len) {
+    int n = st->n_carry + len;
+
+    memcpy(st->carry + st->n_carry, chunk, len);
+    int done = ac_scan(st, st->carry, n, 0);
+    st->n_carry = n - done;
+    memmove(st->carry, st->carry + done, st->n_carry);
+}
+
+/**
+ * ac_finish
+ *
+ * Settles the held back bytes at the end of a file, where no longer
+ * match can come.
+ */
+static void ac_finish(stream_t *st) {
+    ac_scan(st, st->carry, st->n_carry, 1);
+    st->n_carry = 0;
+}
+
+/**
+ * grow
+ *
+ * Makes room for need bytes in a buffer doubled as it fills. Exits like
+ * any other failed allocation.
+ */
+static void grow(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return;
+    }
+    size_t n = *cap ? *cap : 4096;
+    while (n < need) {
+        n *= 2;
+    }
+    char *p = realloc(*buf, n);
+    if (!p) {
+        printf("Memory allocation failed\n");
+        exit(99);
+    }
+    *buf = p;
+    *cap = n;
+}
+
+/**
+ * freq_hash
+ *
+ * Hashes a word 8 bytes at a time with a multiply and a shift per step.
+ */
+static uint64_t freq_hash(const char *w, uint32_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t v;
+    uint32_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&v, w + i, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    v = 0;
+    memcpy(&v, w + i, len - i);
+    h = (h ^ v) * 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 29);
+}
+
+/**
+ * freq_word
+ *
+ * Where the word of an entry is kept.
+ */
+static const char *freq_word(const freq_t *f, const freq_entry_t *e) {
+    return e->len <= FREQ_INLINE ? e->key.word : f->arena + e->key.off;
+}
 
 /**
- * setup_buff
+ * freq_rehash
  *
- * Copies over every non-whitespace character from the user-supplied string
- * to the internal buffer. Consecutive whitespace is replaced by a single
- * space ' '. Tabs and other whitespace are also replaced by a single space.
- * The remainder of the buffer is filled with '.' characters. Returns:
- *   -1 : if user_str is too large to fit into buff (more than BUFFER_SZ chars)
- *   >=0: the length of the user-supplied string after whitespace collapsing.
+ * Doubles the table, or makes the first one. Returns 0, or -1 if there is
+ * no memory.
  */
-int setup_buff(char *buff, char *user_str, int len) {
-    char *dst = buff;
-    char *src = user_str;
-    int count = 0;
-    int in_space = 0;
+static int freq_rehash(freq_t *f) {
+    size_t cap = f->cap ? f->cap * 2 : 1024;
+    freq_entry_t *slots = calloc(cap, sizeof(freq_entry_t));
 
-    if (!buff || !user_str || len <= 0) {
-        return -2;  // Error: Invalid arguments
+    if (!slots) {
+        return -1;
     }
-
-    while (*src != '\0') {
-        if (isspace(*src)) {
-            if (!in_space && count < len) {
-                *dst++ = ' ';
-                count++;
-                in_space = 1;
-            }
-        } else {
-            if (count < len) {
-                *dst++ = *src;
-                count++;
-                in_space = 0;
-            } else {
-                return -1;  // Error: Input string too large
+    for (size_t k = 0; k < f->cap; k++) {
+        if (f->slots[k].len) {
+            size_t j = f->slots[k].hash & (cap - 1);
+            while (slots[j].len) {
+                j = (j + 1) & (cap - 1);
             }
+            slots[j] = f->slots[k];
         }
-        src++;
     }
+    free(f->slots);
+    f->slots = slots;
+    f->cap = cap;
+    return 0;
+}
+
+/**
+ * freq_add_hashed
+ *
+ * Counts one occurrence of w[0..len), whose freq_hash() is h, copying it
+ * into the table the first time it is seen. Returns 0, or -1 if there is
+ * no memory.
+ */
+static int freq_add_hashed(freq_t *f, const char *w, uint32_t len, uint32_t h) {
+    if (2 * (f->used + 1) > f->cap && freq_rehash(f) < 0) {
+        return -1;
+    }
+
+    size_t j = h & (f->cap - 1);
+    freq_entry_t *e;
 
-    while (count < len) {
-        *dst++ = '.';
-        count++;
+    for (;; j = (j + 1) & (f->cap - 1)) {
+        e = &f->slots[j];
+        if (!e->len) {
+            break;
+        }
+        if (e->hash == h && e->len == len && memcmp(freq_word(f, e), w, len) == 0) {
+            e->count++;
+            return 0;
+        }
     }
 
-    return count;  // Return the length of the processed string
+    if (len <= FREQ_INLINE) {
+        memcpy(e->key.word, w, len);
+    } else {
+        grow(&f->arena, &f->arena_cap, f->arena_len + len);
+        memcpy(f->arena + f->arena_len, w, len);
+        e->key.off = f->arena_len;
+        f->arena_len += len;
+    }
+    e->hash = h;
+    e->len = len;
+    e->count = 1;
+    f->used++;
+    return 0;
 }
 
 /**
- * print_buff
+ * freq_add
  *
- * Prints the entire buffer for debugging purposes.
+ * freq_add_hashed() for a word not hashed yet.
  */
-void print_buff(char *buff, int len) {
-    printf("Buffer:  ");
-    for (int i = 0; i < len; i++) {
-        putchar(buff[i]);
+int freq_add(freq_t *f, const char *w, uint32_t len) {
+    return freq_add_hashed(f, w, len, freq_hash(w, len));
+}
+
+/**
+ * freq_chunk
+ *
+ * -f for one chunk: counts each whitespace separated word. A word the
+ * chunk ends in is gathered in f->part and counted once it ends.
+ */
+static void freq_chunk(stream_t *st, const char *chunk, int len) {
+    freq_t *f = st->freq;
+    int i = 0;
+
+    if (st->in_word) {
+        while (i < len && !space_tab[(unsigned char)chunk[i]]) {
+            i++;
+        }
+        grow(&f->part, &f->part_cap, f->part_len + i);
+        memcpy(f->part + f->part_len, chunk, i);
+        f->part_len += i;
+        if (i == len) {
+            return;
+        }
+        if (freq_add(f, f->part, f->part_len) < 0) {
+            printf("Memory allocation failed\n");
+            exit(99);
+        }
+        f->part_len = 0;
+        st->in_word = 0;
+    }
+
+    // Words are found and hashed FREQ_BATCH at a time and their slots
+    // prefetched, so the cache misses of a batch overlap
+    while (i < len) {
+        int start[FREQ_BATCH];
+        uint32_t w_len[FREQ_BATCH], hash[FREQ_BATCH];
+        int n = 0;
+
+        while (n < FREQ_BATCH && i < len) {
+            while (i < len && space_tab[(unsigned char)chunk[i]]) {
+                i++;
+            }
+            int s = i;
+            while (i < len && !space_tab[(unsigned char)chunk[i]]) {
+                i++;
+            }
+            if (i == s) {
+                break;
+            }
+            if (i == len) {
+                grow(&f->part, &f->part_cap, i - s);
+                memcpy(f->part, chunk + s, i - s);
+                f->part_len = i - s;
+                st->in_word = 1;
+                break;
+            }
+            start[n] = s;
+            w_len[n] = i - s;
+            hash[n] = freq_hash(chunk + s, i - s);
+            if (f->cap) {
+                __builtin_prefetch(&f->slots[hash[n] & (f->cap - 1)]);
+            }
+            n++;
+        }
+
+        for (int k = 0; k < n; k++) {
+            if (freq_add_hashed(f, chunk + start[k], w_len[k], hash[k]) < 0) {
+                printf("Memory allocation failed\n");
+                exit(99);
+            }
+        }
     }
-    putchar('\n');
 }
 
 /**
- * usage
+ * freq_before
  *
- * Prints usage instructions for the program.
+ * Order of the -f output: more occurrences first, then by word.
  */
-void usage(char *exename) {
-    printf("usage: %s [-h|c|r|w|x] \"string\" [other args]\n", exename);
+static int freq_before(const freq_t *f, const freq_entry_t *a, const freq_entry_t *b) {
+    if (a->count != b->count) {
+        return a->count > b->count;
+    }
+    uint32_t n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(freq_word(f, a), freq_word(f, b), n);
+    return c < 0 || (c == 0 && a->len < b->len);
 }
 
 /**
- * count_words
+ * freq_sift
  *
- * Counts the number of words in the user string (up to str_len).
+ * Moves heap[k] down the heap of n entries, which keeps the entry that
+ * comes last in freq_before() order at the top.
  */
-int count_words(char *buff, int buff_len, int str_len) {
-    if (!buff || str_len > buff_len) {
-        return -1;
+static void freq_sift(const freq_t *f, freq_entry_t **heap, int n, int k) {
+    for (;;) {
+        int c = 2 * k + 1;
+        if (c >= n) {
+            return;
+        }
+        if (c + 1 < n && freq_before(f, heap[c], heap[c + 1])) {
+            c++;
+        }
+        if (!freq_before(f, heap[k], heap[c])) {
+            return;
+        }
+        freq_entry_t *t = heap[k];
+        heap[k] = heap[c];
+        heap[c] = t;
+        k = c;
     }
+}
 
-    int count = 0;
-    int in_word = 0;
+/**
+ * freq_print
+ *
+ * Prints the top_n most frequent words with their counts. One pass over
+ * the table keeps the best top_n in a heap whose top is the worst of
+ * them, so each other word costs a compare. Returns 0, or -1 if there is
+ * no memory.
+ */
+int freq_print(freq_t *f, int top_n) {
+    int n = 0;
 
-    for (int i = 0; i < str_len; i++) {
-        if (!isspace(buff[i]) && buff[i] != '.') {
-            if (!in_word) {
-                count++;
-                in_word = 1;
+    if ((size_t)top_n > f->used) {
+        top_n = f->used;
+    }
+    freq_entry_t **heap = malloc((top_n + 1) * sizeof(freq_entry_t *));
+    if (!heap) {
+        return -1;
+    }
+
+    for (size_t k = 0; k < f->cap && top_n > 0; k++) {
+        freq_entry_t *e = &f->slots[k];
+        if (!e->len) {
+            continue;
+        }
+        if (n < top_n) {
+            heap[n++] = e;
+            if (n == top_n) {
+                for (int j = n / 2 - 1; j >= 0; j--) {
+                    freq_sift(f, heap, n, j);
+                }
             }
-        } else {
-            in_word = 0;
+        } else if (freq_before(f, e, heap[0])) {
+            heap[0] = e;
+            freq_sift(f, heap, n, 0);
         }
     }
 
-    return count;
+    // Taking the top off repeatedly leaves the heap sorted best first
+    for (int m = n - 1; m > 0; m--) {
+        freq_entry_t *t = heap[0];
+        heap[0] = heap[m];
+        heap[m] = t;
+        freq_sift(f, heap, m, 0);
+    }
+
+    printf("Word Frequency\n");
+    printf("--------------\n");
+    for (int k = 0; k < n; k++) {
+        printf("%d. ", k + 1);
+        fwrite(freq_word(f, heap[k]), 1, heap[k]->len, stdout);
+        printf(" (%lld)\n", heap[k]->count);
+    }
+
+    free(heap);
+    return 0;
 }
 
 /**
- * reverse_string
+ * count_part
  *
- * Reverses the user-supplied string in place (up to str_len).
+ * Thread body of count_mapped(), counts one part STREAM_CHUNK_SZ bytes at
+ * a time so a part larger than an int can hold is fine.
  */
-int reverse_string(char *buff, int buff_len, int str_len) {
-    if (!buff || str_len > buff_len) {
+static void *count_part(void *arg) {
+    count_part_t *part = arg;
+    int in_word = 0;
+
+    part->words = 0;
+    for (size_t off = 0; off < part->len; off += STREAM_CHUNK_SZ) {
+        size_t n = part->len - off < STREAM_CHUNK_SZ ? part->len - off : STREAM_CHUNK_SZ;
+        part->words += count_word_starts(part->p + off, n, &in_word);
+    }
+    part->first_in_word = part->len > 0 && !space_tab[(unsigned char)part->p[0]];
+    part->last_in_word = in_word;
+    return NULL;
+}
+
+/**
+ * count_threads
+ *
+ * Number of threads count_mapped() uses, THREADS_ENV or the online CPUs.
+ */
+static int count_threads(void) {
+    const char *env = getenv(THREADS_ENV);
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1) {
+        n = 1;
+    }
+    return n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+/**
+ * count_mapped
+ *
+ * Counts the words of a mapped file by splitting it into n_threads equal
+ * parts and counting each on its own thread, the first on the calling
+ * one. Where one part ends inside a word and the next starts inside one,
+ * the same word was counted twice. Returns the same count as reading the
+ * file serially, or -1 if a thread could not be started.
+ */
+long long count_mapped(const char *p, size_t len, int n_threads) {
+    count_part_t parts[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    size_t per = len / n_threads;
+    long long total = 0;
+    int started = 1;
+    int rc = 0;
+
+    // Pick the kernel before the threads would race to
+    int in_word = 0;
+    count_word_starts(p, 0, &in_word);
+
+    for (int t = 0; t < n_threads; t++) {
+        parts[t].p = p + t * per;
+        parts[t].len = t == n_threads - 1 ? len - t * per : per;
+    }
+    for (int t = 1; t < n_threads; t++, started++) {
+        if (pthread_create(&threads[t], NULL, count_part, &parts[t]) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+    count_part(&parts[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    if (rc < 0) {
         return -1;
     }
 
-    char *start = buff;
-    char *end = buff + str_len - 1;
-    while (start < end) {
-        char temp = *start;
-        *start = *end;
-        *end = temp;
-        start++;
-        end--;
+    for (int t = 0; t < n_threads; t++) {
+        total += parts[t].words;
+        if (t > 0 && parts[t - 1].last_in_word && parts[t].first_in_word) {
+            total--;
+        }
     }
+    return total;
+}
 
-    return 0;
+/**
+ * list_word_end
+ *
+ * -w: the word that began at chunk[start] ends at chunk[end]. When
+ * st->word_len is set it began in an earlier chunk, whose part and index
+ * are queued already.
+ */
+static void list_word_end(stream_t *st, const char *chunk, int start, int end) {
+    if (st->word_len == 0) {
+        out_word(st->words, chunk + start, end - start);
+    } else {
+        out_bytes(chunk + start, end - start);
+        out_field(" (", st->word_len + end - start, ")\n");
+    }
 }
 
 /**
- * print_words
+ * stream_chunk
  *
- * Prints individual words and their lengths.
+ * Counts or prints the words of one chunk of input, or replaces the
+ * matches in it. A word that runs past the end of the chunk is continued
+ * by the next call.
  */
-int print_words(char *buff, int buff_len, int str_len) {
-    if (!buff || str_len > buff_len) {
-        return -1;
+void stream_chunk(stream_t *st, char *chunk, int len) {
+    int in_word = st->in_word;
+    int start = 0;
+
+    if (st->mode == 'x') {
+        replace_chunk(st, chunk, len);
+        return;
+    }
+    if (st->mode == 'X') {
+        ac_chunk(st, chunk, len);
+        return;
+    }
+    if (st->mode == 'f') {
+        freq_chunk(st, chunk, len);
+        return;
+    }
+    if (st->mode == 'r' || st->mode == 'R') {
+        grow(&st->whole, &st->whole_cap, st->whole_len + len);
+        memcpy(st->whole + st->whole_len, chunk, len);
+        st->whole_len += len;
+        return;
     }
 
-    int word_idx = 1;
-    int in_word = 0;
-    char *start = NULL;
+    if (st->mode == 'c') {
+        st->words += count_word_starts(chunk, len, &st->in_word);
+        return;
+    }
+    if (st->mode == 'l') {
+        wc_lines(chunk, len, &st->wc);
+        return;
+    }
+    if (st->mode == 'm' || st->mode == 'a') {
+        wc_count(chunk, len, &st->wc_state, &st->wc);
+        return;
+    }
 
-    printf("Word Print\n");
-    printf("----------\n");
+    // Words start and end where the whitespace mask changes, found 64
+    // bytes at a time; each edge flips in_word
+    static space_mask_fn space_mask;
+    uint64_t prev = !in_word;
+    int i = 0;
 
-    for (int i = 0; i < str_len; i++) {
-        if (buff[i] != ' ' && buff[i] != '.') {
+    if (!space_mask) {
+        space_mask = pick_space_mask();
+    }
+    for (; i + 64 <= len; i += 64) {
+        uint64_t m = space_mask(chunk + i);
+        uint64_t edges = m ^ (m << 1 | prev);
+        prev = m >> 63;
+        while (edges) {
+            int k = i + __builtin_ctzll(edges);
+            edges &= edges - 1;
             if (!in_word) {
-                start = &buff[i];
+                st->words++;
+                st->word_len = 0;
+                start = k;
+            } else {
+                list_word_end(st, chunk, start, k);
+            }
+            in_word = !in_word;
+        }
+    }
+
+    for (; i < len; i++) {
+        if (!space_tab[(unsigned char)chunk[i]]) {
+            if (!in_word) {
+                st->words++;
+                st->word_len = 0;
+                start = i;
                 in_word = 1;
             }
         } else if (in_word) {
-            printf("%d. ", word_idx++);
-            fwrite(start, 1, &buff[i] - start, stdout);
-            printf(" (%ld)\n", &buff[i] - start);
+            list_word_end(st, chunk, start, i);
             in_word = 0;
         }
     }
-
     if (in_word) {
-        printf("%d. ", word_idx++);
-        printf("%s (%ld)\n", start, (buff + str_len) - start);
+        // The rest of the word comes with the next chunk
+        if (st->word_len == 0) {
+            out_field("", st->words, ". ");
+        }
+        out_bytes(chunk + start, len - start);
+        st->word_len += len - start;
     }
+    st->in_word = in_word;
 
-    return word_idx - 1;
+    // The chunk is about to be reused or unmapped
+    out_flush();
 }
 
 /**
- * replace_substring
+ * wc_print
  *
- * Replaces the first occurrence of 'search' with 'replace' in buff.
+ * Prints one line of -l, -m or -a output like wc: the counts right
+ * aligned in st->wc_width columns, in the order lines, words, characters,
+ * bytes, then the name if there is one.
  */
-int replace_substring(char *buff, int buff_len, int str_len, char *search, char *replace) {
-    if (!buff || !search || !replace) {
-        return -1;
+void wc_print(const stream_t *st, const wc_counts_t *c, const char *name) {
+    long long cols[4];
+    int n = 0;
+
+    if (st->mode == 'l' || st->mode == 'a') {
+        cols[n++] = c->lines;
+    }
+    if (st->mode == 'a') {
+        cols[n++] = c->words;
+    }
+    if (st->mode == 'm' || st->mode == 'a') {
+        cols[n++] = c->chars;
     }
+    if (st->mode == 'a') {
+        cols[n++] = c->bytes;
+    }
+    for (int k = 0; k < n; k++) {
+        printf("%s%*lld", k ? " " : "", st->wc_width, cols[k]);
+    }
+    if (name) {
+        printf(" %s", name);
+    }
+    printf("\n");
+}
 
-    int search_len = 0, replace_len = 0;
+/**
+ * wc_width
+ *
+ * The column width wc would use: enough digits for the total size of the
+ * regular files, at least 7 when one of the inputs is not a regular file,
+ * and no padding for a single count of a single input.
+ */
+int wc_width(char mode, char **names, int n_names) {
+    unsigned long long total = 0;
+    int width = 1;
+    int min_width = 1;
 
-    while (search[search_len] != '\0') search_len++;
-    while (replace[replace_len] != '\0') replace_len++;
+    if (mode != 'a' && n_names <= 1) {
+        return 1;
+    }
+    for (int k = 0; k < (n_names > 0 ? n_names : 1); k++) {
+        struct stat sb;
+        int use_stdin = n_names == 0 || strcmp(names[k], "-") == 0;
+        int rc = use_stdin ? fstat(STDIN_FILENO, &sb) : stat(names[k], &sb);
+        if (rc == 0 && S_ISREG(sb.st_mode)) {
+            total += sb.st_size;
+        } else {
+            min_width = 7;
+        }
+    }
+    for (; total >= 10; total /= 10) {
+        width++;
+    }
+    return width < min_width ? min_width : width;
+}
 
-    char *found = NULL;
-    for (int i = 0; i <= str_len - search_len; i++) {
-        if (strncmp(buff + i, search, search_len) == 0) {
-            found = buff + i;
-            break;
+/**
+ * stream_end
+ *
+ * Ends the word the last chunk of a file stopped in, a word never
+ * continues into the next file. -x writes out what it held back, -r and
+ * -R the whole file reversed.
+ */
+void stream_end(stream_t *st) {
+    if (st->in_word && st->mode == 'w') {
+        out_field(" (", st->word_len, ")\n");
+    }
+    if (st->mode == 'w') {
+        out_flush();
+    }
+    if (st->mode == 'x') {
+        replace_run(st, st->carry, st->n_carry, 1);
+        st->n_carry = 0;
+    }
+    if (st->mode == 'X') {
+        ac_finish(st);
+    }
+    if (st->in_word && st->mode == 'f') {
+        if (freq_add(st->freq, st->freq->part, st->freq->part_len) < 0) {
+            printf("Memory allocation failed\n");
+            exit(99);
         }
+        st->freq->part_len = 0;
     }
+    if (st->mode == 'l' || st->mode == 'm' || st->mode == 'a') {
+        wc_print(st, &st->wc, st->name);
+        st->wc_total.lines += st->wc.lines;
+        st->wc_total.words += st->wc.words;
+        st->wc_total.chars += st->wc.chars;
+        st->wc_total.bytes += st->wc.bytes;
+        memset(&st->wc, 0, sizeof(st->wc));
+        memset(&st->wc_state, 0, sizeof(st->wc_state));
+    }
+    if (st->mode == 'r' || st->mode == 'R') {
+        reverse_bytes(st->whole, st->whole_len);
+        if (st->mode == 'R') {
+            utf8_fix(st->whole, st->whole_len);
+        }
+        fwrite(st->whole, 1, st->whole_len, stdout);
+        st->whole_len = 0;
+    }
+    st->in_word = 0;
+}
 
-    if (!found) {
-        return -2;
+/**
+ * map_rest
+ *
+ * Maps the rest of the regular file fd, from its current offset to the
+ * end, so a redirected stdin that was partly read before starts where
+ * read() would. The mapping starts at the page the offset is in; *base
+ * and *base_len are what to munmap(). Returns the first byte, with *len
+ * bytes after it, or NULL if fd is not a regular file, has fewer than
+ * min_len bytes left, or cannot be mapped.
+ */
+static char *map_rest(int fd, off_t min_len, size_t *len, char **base, size_t *base_len) {
+    struct stat sb;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+
+    if (pos < 0 || fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+        sb.st_size - pos < min_len) {
+        return NULL;
     }
+    off_t start = pos & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    char *map = mmap(NULL, sb.st_size - start, PROT_READ, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, sb.st_size - start, MADV_SEQUENTIAL);
+    *base = map;
+    *base_len = sb.st_size - start;
+    *len = sb.st_size - pos;
+    return map + (pos - start);
+}
 
-    int new_len = str_len - search_len + replace_len;
-    if (new_len > buff_len) {
+/**
+ * stream_files
+ *
+ * Reads every file, or stdin for "-" or when there are none, in chunks of
+ * STREAM_CHUNK_SZ bytes and passes them to stream_chunk(). Memory use does
+ * not depend on the size of the input, except for -r and -R. -c counts large regular files with
+ * count_mapped() instead. Returns:
+ *   -1 : if a file could not be opened or read
+ *    0 : otherwise
+ */
+int stream_files(stream_t *st, char **names, int n_names) {
+    char *chunk = malloc(STREAM_CHUNK_SZ);
+    int rc = 0;
+
+    if (!chunk) {
         return -1;
     }
 
-    memmove(found + replace_len, found + search_len, str_len - (found - buff) - search_len);
-    memcpy(found, replace, replace_len);
+    for (int k = 0; k < (n_names > 0 ? n_names : 1) && rc == 0; k++) {
+        int use_stdin = n_names == 0 || strcmp(names[k], "-") == 0;
+        int fd = use_stdin ? STDIN_FILENO : open(names[k], O_RDONLY);
+        if (fd < 0) {
+            printf("Error opening %s\n", names[k]);
+            rc = -1;
+            break;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        st->name = n_names > 0 ? names[k] : NULL;
 
-    return 0;
+        // Large files are counted in parallel where they lie. Mapped
+        // input is then consumed as if read, up to the end.
+        char *base, *data = NULL;
+        size_t base_len, len;
+        int n_threads = count_threads();
+        if (st->mode == 'c' && n_threads > 1 &&
+            (data = map_rest(fd, PAR_MIN_SZ, &len, &base, &base_len)) != NULL) {
+            long long words = count_mapped(data, len, n_threads);
+            munmap(base, base_len);
+            if (words >= 0) {
+                st->words += words;
+                lseek(fd, 0, SEEK_END);
+                if (!use_stdin) {
+                    close(fd);
+                }
+                continue;
+            }
+        }
+
+        // -w lists the words of a regular file straight from its pages
+        if (st->mode == 'w' && (data = map_rest(fd, 1, &len, &base, &base_len)) != NULL) {
+            for (size_t off = 0; off < len; off += STREAM_CHUNK_SZ) {
+                size_t n = len - off < STREAM_CHUNK_SZ ? len - off : STREAM_CHUNK_SZ;
+                stream_chunk(st, data + off, n);
+            }
+            stream_end(st);
+            munmap(base, base_len);
+            lseek(fd, 0, SEEK_END);
+            if (!use_stdin) {
+                close(fd);
+            }
+            continue;
+        }
+
+        ssize_t n;
+        while ((n = read(fd, chunk, STREAM_CHUNK_SZ)) > 0) {
+            stream_chunk(st, chunk, n);
+        }
+        if (n < 0) {
+            printf("Error reading %s\n", use_stdin ? "stdin" : names[k]);
+            rc = -1;
+        }
+        stream_end(st);
+        if (!use_stdin) {
+            close(fd);
+        }
+    }
+
+    free(chunk);
+    return rc;
 }
 
+#ifndef STRINGFUN_NO_MAIN
 /**
  * main
+ *
+ * Left out when bench.c includes this file to time the kernels.
  */
 int main(int argc, char *argv[]) {
     char *buff;
@@ -219,6 +2666,7 @@ int main(int argc, char *argv[]) {
     char opt;
     int rc;
     int user_str_len;
+    int buff_len;
 
     // TODO #1: Why is this safe?
     // ANSWER: This is safe because we first check if argc < 2. If argc is less than 2, we call usage() and exit. This ensures that argv[1] exists before accessing it.
@@ -234,6 +2682,106 @@ int main(int argc, char *argv[]) {
         exit(0);
     }
 
+    // -X applies every pair of a file in one pass over files or stdin
+    if (opt == 'X') {
+        stream_t st = { .mode = opt };
+        ac_t ac;
+
+        if (argc < 3) {
+            usage(argv[0]);
+            exit(1);
+        }
+        rc = ac_load(&ac, argv[2]);
+        if (rc == -2) {
+            usage(argv[0]);
+            exit(1);
+        }
+        if (rc < 0) {
+            exit(2);
+        }
+        st.ac = &ac;
+        st.carry = malloc(STREAM_CHUNK_SZ + ac.max_len);
+        st.ac_at = malloc((STREAM_CHUNK_SZ + ac.max_len) * sizeof(int));
+        if (!st.carry || !st.ac_at) {
+            printf("Memory allocation failed\n");
+            exit(99);
+        }
+        rc = stream_files(&st, argv + 3, argc - 3);
+        free(st.carry);
+        free(st.ac_at);
+        exit(rc < 0 ? 2 : 0);
+    }
+
+    // -f counts every word of files or stdin and prints the most frequent
+    if (opt == 'f') {
+        stream_t st = { .mode = opt };
+        freq_t freq = { 0 };
+        int top_n = argc >= 3 ? atoi(argv[2]) : 0;
+
+        if (top_n <= 0) {
+            usage(argv[0]);
+            exit(1);
+        }
+        st.freq = &freq;
+        rc = stream_files(&st, argv + 3, argc - 3);
+        if (rc == 0 && freq_print(&freq, top_n) < 0) {
+            printf("Memory allocation failed\n");
+            exit(99);
+        }
+        free(freq.slots);
+        free(freq.arena);
+        free(freq.part);
+        exit(rc < 0 ? 2 : 0);
+    }
+
+    // -i reads the text from files or stdin instead of argv[2]
+    if (argc >= 3 && strcmp(argv[2], "-i") == 0) {
+        stream_t st = { .mode = opt };
+        int first_file = 3;
+
+        int wc_mode = opt == 'l' || opt == 'm' || opt == 'a';
+
+        if (opt != 'c' && opt != 'w' && opt != 'x' && opt != 'r' && opt != 'R' && !wc_mode) {
+            usage(argv[0]);
+            exit(1);
+        }
+        if (opt == 'w') {
+            out_str("Word Print\n");
+            out_str("----------\n");
+        }
+        if (opt == 'x') {
+            if (argc < 5 || argv[3][0] == '\0') {
+                printf("Error: -x requires search and replace strings\n");
+                exit(1);
+            }
+            search_init(&st.find, argv[3], strlen(argv[3]));
+            st.replace = argv[4];
+            st.replace_len = strlen(argv[4]);
+            st.carry = malloc(2 * st.find.len);
+            if (!st.carry) {
+                printf("Memory allocation failed\n");
+                exit(99);
+            }
+            first_file = 5;
+        }
+        if (wc_mode) {
+            st.wc_width = wc_width(opt, argv + first_file, argc - first_file);
+        }
+        rc = stream_files(&st, argv + first_file, argc - first_file);
+        if (rc == 0 && wc_mode && argc - first_file > 1) {
+            wc_print(&st, &st.wc_total, "total");
+        }
+        free(st.carry);
+        free(st.whole);
+        if (rc < 0) {
+            exit(2);
+        }
+        if (opt == 'c') {
+            printf("Word Count: %lld\n", st.words);
+        }
+        exit(0);
+    }
+
     // TODO #2: Why check argc < 3?
     // ANSWER: This ensures that the user has provided the required input string after the option flag. Without this check, accessing argv[2] could cause a segmentation fault.
     if (argc < 3) {
@@ -241,8 +2789,13 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    // The buffer only has to grow past the input for a longer replacement
     input_string = argv[2];
-    buff = (char *)malloc(BUFFER_SZ);
+    buff_len = strlen(input_string);
+    if (opt == 'x' && argc >= 5 && strlen(argv[4]) > strlen(argv[3])) {
+        buff_len += strlen(argv[4]) - strlen(argv[3]);
+    }
+    buff = (char *)malloc(buff_len + 1);
 
     // TODO #3: Handle malloc error
     if (!buff) {
@@ -250,7 +2803,7 @@ int main(int argc, char *argv[]) {
         exit(99);
     }
 
-    user_str_len = setup_buff(buff, input_string, BUFFER_SZ);
+    user_str_len = setup_buff(buff, input_string, buff_len);
     if (user_str_len < 0) {
         printf("Error setting up buffer, error = %d\n", user_str_len);
         free(buff);
@@ -259,19 +2812,24 @@ int main(int argc, char *argv[]) {
 
     switch (opt) {
         case 'c':
-            rc = count_words(buff, BUFFER_SZ, user_str_len);
-            printf("Word Count: %d\n", rc);
+            rc = count_words(buff, buff_len, user_str_len);
+            out_field("Word Count: ", rc, "\n");
             break;
         case 'r':
-            rc = reverse_string(buff, BUFFER_SZ, user_str_len);
+        case 'R':
+            if (opt == 'r') {
+                rc = reverse_string(buff, buff_len, user_str_len);
+            } else {
+                rc = reverse_utf8(buff, buff_len, user_str_len);
+            }
             if (rc == 0) {
-                printf("Reversed String: ");
-                fwrite(buff, 1, user_str_len, stdout);
-                putchar('\n');
+                out_str("Reversed String: ");
+                out_bytes(buff, user_str_len);
+                out_str("\n");
             }
             break;
         case 'w':
-            print_words(buff, BUFFER_SZ, user_str_len);
+            print_words(buff, buff_len, user_str_len);
             break;
         case 'x':
             if (argc < 5) {
@@ -279,13 +2837,14 @@ int main(int argc, char *argv[]) {
                 free(buff);
                 exit(1);
             }
-            rc = replace_substring(buff, BUFFER_SZ, user_str_len, argv[3], argv[4]);
-            if (rc == 0) {
-                printf("Modified String: ");
-                fwrite(buff, 1, user_str_len, stdout);
-                putchar('\n');
+            rc = replace_substring(buff, buff_len, user_str_len, argv[3], argv[4]);
+            if (rc >= 0) {
+                user_str_len = rc;
+                out_str("Modified String: ");
+                out_bytes(buff, user_str_len);
+                out_str("\n");
             } else {
-                printf("Error replacing substring\n");
+                out_str("Error replacing substring\n");
             }
             break;
         default:
@@ -294,10 +2853,12 @@ int main(int argc, char *argv[]) {
             exit(1);
     }
 
-    print_buff(buff, BUFFER_SZ);
+    print_buff(buff, user_str_len);
+    out_flush();
     free(buff);
     exit(0);
 }
+#endif
 
 // TODO #7: Why provide both buffer and length?
 // ANSWER: Providing both buffer and its length ensures that the functions are robust and can avoid buffer overflows by performing bounds checking. It makes the functions reusable with different buffer sizes.
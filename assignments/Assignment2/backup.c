@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "backup.h"
+#include "pager.h"
+
+/*
+ *  copy_range
+ *      src_fd, dest_fd:  files to copy between
+ *      off:              where the range starts, in both files
+ *      len:              number of bytes to copy
+ *
+ *  Copies one data extent with copy_file_range(), which keeps the data in
+ *  the kernel.  Several threads may copy different ranges of the same
+ *  files at once.  Kernels or filesystems that refuse it get a plain
+ *  pread()/pwrite() loop for the same range.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int copy_range(int src_fd, int dest_fd, off_t off, off_t len) {
+    off_t in = off, out = off;
+
+    while (len > 0) {
+        ssize_t n = tr_copy_file_range(src_fd, &in, dest_fd, &out, len, 0);
+        if (n > 0) {
+            len -= n;
+            continue;
+        }
+        if (n == 0)
+            return ERR_DB_FILE;     //source got shorter under us
+        if (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EINVAL)
+            return ERR_DB_FILE;
+
+        char buf[64 * 1024];
+        while (len > 0) {
+            ssize_t r = tr_pread(src_fd, buf, len < (off_t)sizeof(buf) ? len : (off_t)sizeof(buf), in);
+            if (r <= 0 || tr_pwrite(dest_fd, buf, r, out) != r)
+                return ERR_DB_FILE;
+            in += r;
+            out += r;
+            len -= r;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  copy_db_file
+ *      src_fd:  database file to copy, the caller holds a lock on it
+ *      dest:    name of the copy, replaced if it exists
+ *
+ *  Makes a sparse copy of a database file, see backup.h.  The copy is
+ *  flushed to disk before returning.
+ *
+ *  returns:  NO_ERROR       copy written
+ *            ERR_DB_FILE    the copy failed, dest may be incomplete
+ *
+ *  console:  M_ERR_DB_COPY  error copying the file
+ */
+int copy_db_file(int src_fd, const char *dest) {
+    struct stat st;
+    int rc = ERR_DB_FILE;
+    int dest_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+    if (dest_fd == -1 || fstat(src_fd, &st) == -1)
+        goto out;
+
+    if (tr_clone(dest_fd, src_fd) == 0) {
+        rc = NO_ERROR;
+        goto out;
+    }
+
+    off_t data = 0;
+    while (data < st.st_size) {
+        data = tr_lseek(src_fd, data, SEEK_DATA);
+        if (data == -1) {
+            if (errno != ENXIO)
+                goto out;
+            break;                  //only a hole is left
+        }
+        off_t hole = tr_lseek(src_fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > st.st_size)
+            hole = st.st_size;
+        if (copy_range(src_fd, dest_fd, data, hole - data) != NO_ERROR)
+            goto out;
+        data = hole;
+    }
+    if (tr_ftruncate(dest_fd, st.st_size) == -1)
+        goto out;
+    rc = NO_ERROR;
+
+out:
+    if (dest_fd != -1) {
+        if (rc == NO_ERROR && tr_fsync(dest_fd) == -1)
+            rc = ERR_DB_FILE;
+        close(dest_fd);
+    }
+    if (rc != NO_ERROR)
+        printf(M_ERR_DB_COPY);
+    return rc;
+}
+
+/*
+ *  backup_db
+ *      fd:    linux file descriptor, the caller holds at least a shared lock
+ *      dest:  name of the backup file
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, see copy_db_file()
+ */
+int backup_db(int fd, const char *dest) {
+    if (checkpoint_db(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return copy_db_file(fd, dest);
+}
+
+/*
+ *  restore_db
+ *      fd:   linux file descriptor, the caller holds an exclusive lock
+ *      src:  backup file to restore
+ *
+ *  Copies the backup next to the database and renames it over the
+ *  database file, so a failed restore leaves the database untouched.  The
+ *  restored superblock gets a new epoch, the index built for the database
+ *  being replaced must not be reused.  The copy is locked exclusively and
+ *  stamped before the rename, so a writer waiting for the lock never sees
+ *  it unstamped: once it gets the old file it finds the path moved on and
+ *  waits for this lock, see shard_lock().  Like compress_db() the old fd
+ *  is closed and the fd of the restored database is returned, still
+ *  locked.
+ *
+ *  returns:  <number>       the fd of the restored database
+ *            ERR_DB_FILE    src is not a database or could not be copied
+ *
+ *  console:  M_ERR_DB_RESTORE  src is not a database file
+ *            M_ERR_DB_COPY     error copying the file
+ *            M_ERR_DB_LOCK     error locking the copy
+ */
+int restore_db(int fd, const char *src) {
+    char db_file[PATH_MAX];
+    char tmp_file[PATH_MAX];
+    db_super_t sb;
+    int src_fd = open(src, O_RDONLY);
+
+    if (src_fd == -1 || read_super(src_fd, &sb) != NO_ERROR || sb.magic != SUPER_MAGIC) {
+        if (src_fd != -1)
+            close_db(src_fd);
+        printf(M_ERR_DB_RESTORE, src);
+        return ERR_DB_FILE;
+    }
+
+    snprintf(db_file, sizeof(db_file), "%s", db_name(fd));
+    db_sidecar(fd, ".db", true, tmp_file, sizeof(tmp_file));
+    if (copy_db_file(src_fd, tmp_file) != NO_ERROR) {
+        close_db(src_fd);
+        unlink(tmp_file);
+        return ERR_DB_FILE;
+    }
+    close_db(src_fd);
+
+    int new_fd = open_db(tmp_file, false);
+    if (new_fd < 0) {
+        unlink(tmp_file);
+        return ERR_DB_FILE;
+    }
+    if (tr_flock(new_fd, LOCK_EX) == -1) {
+        close_db(new_fd);
+        unlink(tmp_file);
+        printf(M_ERR_DB_LOCK);
+        return ERR_DB_FILE;
+    }
+    if (read_super(new_fd, &sb) != NO_ERROR) {
+        close_db(new_fd);
+        unlink(tmp_file);
+        return ERR_DB_FILE;
+    }
+    sb.epoch = super_epoch();
+    if (write_super(new_fd, &sb) != NO_ERROR || checkpoint_db(new_fd) != NO_ERROR ||
+        tr_fdatasync(new_fd) == -1) {
+        close_db(new_fd);
+        unlink(tmp_file);
+        return ERR_DB_FILE;
+    }
+
+    if (rename(tmp_file, db_file) != 0) {
+        close_db(new_fd);
+        unlink(tmp_file);
+        printf(M_ERR_DB_COPY);
+        return ERR_DB_FILE;
+    }
+    db_set_name(new_fd, db_file);
+    pager_drop(fd);
+    close(fd);
+    return new_fd;
+}
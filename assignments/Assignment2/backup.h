@@ -0,0 +1,18 @@
+#ifndef __BACKUP_H__
+#define __BACKUP_H__
+
+#include <sys/types.h>
+
+//Backups copy the database file without reading it into user space.  A
+//reflink (FICLONE) is tried first, which shares the blocks on
+//filesystems that support it.  Otherwise only the data extents, found
+//with SEEK_DATA/SEEK_HOLE, are copied with copy_file_range() to the same
+//offsets, so holes in the id space stay holes in the copy.  Restores use
+//the same copy into a temporary file that is renamed over the database.
+//compress_db() moves runs of live records with copy_range() as well.
+int copy_range(int src_fd, int dest_fd, off_t off, off_t len);
+int copy_db_file(int src_fd, const char *dest);
+int backup_db(int fd, const char *dest);
+int restore_db(int fd, const char *src);
+
+#endif
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "cdc.h"
+
+#define CDC_MAX_FDS     1024
+#define CDC_READ_RECS   64          //records read per pread() by -W
+
+//the change log of a database fd, see cdc_attach()
+typedef struct cdc_log{
+    cdc_state_t st;
+    long long next_seq;             //sequence number of the next record
+    cdc_rec_t *pending;             //queued by cdc_add(), numbered on write
+    int n_pending;
+    int cap;
+} cdc_log_t;
+
+static cdc_log_t *logs[CDC_MAX_FDS];
+
+//name of the segment whose first record is first
+static char *seg_name(int fd, long long first, char *out, size_t sz) {
+    char ext[32];
+
+    snprintf(ext, sizeof(ext), ".%lld" CDC_EXT, first);
+    return db_sidecar(fd, ext, false, out, sz);
+}
+
+/*
+ *  save_state
+ *      fd:   database the log belongs to
+ *      *st:  segment list and consumers
+ *
+ *  Writes the state to a temporary file and renames it in place, so a
+ *  crash leaves either the old or the new state.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int save_state(int fd, const cdc_state_t *st) {
+    char state_file[PATH_MAX];
+    char tmp_file[PATH_MAX];
+    int rc = ERR_DB_FILE;
+
+    db_sidecar(fd, CDC_EXT, false, state_file, sizeof(state_file));
+    db_sidecar(fd, CDC_EXT, true, tmp_file, sizeof(tmp_file));
+    int tmp_fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (tmp_fd == -1)
+        return ERR_DB_FILE;
+    if (tr_write(tmp_fd, st, sizeof(*st)) == sizeof(*st))
+        rc = NO_ERROR;
+    close(tmp_fd);
+
+    if (rc == NO_ERROR && rename(tmp_file, state_file) != 0)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        unlink(tmp_file);
+    return rc;
+}
+
+/*
+ *  load_log
+ *      fd:    database the log belongs to
+ *      *log:  filled in on success
+ *
+ *  Reads the state and finds the next sequence number from the size of
+ *  the last segment.  A record torn by a crash is cut off.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the log is off or damaged
+ */
+static int load_log(int fd, cdc_log_t *log) {
+    char name[PATH_MAX];
+    struct stat st;
+    cdc_state_t *s = &log->st;
+
+    int state_fd = open(db_sidecar(fd, CDC_EXT, false, name, sizeof(name)), O_RDONLY);
+    if (state_fd == -1)
+        return ERR_DB_FILE;
+    ssize_t n = tr_pread(state_fd, s, sizeof(*s), 0);
+    close(state_fd);
+    if (n != sizeof(*s) || s->magic != CDC_MAGIC || s->version != CDC_VERSION ||
+        s->n_segs < 1 || s->n_segs > CDC_MAX_SEGS ||
+        s->n_consumers < 0 || s->n_consumers > CDC_MAX_CONSUMERS)
+        return ERR_DB_FILE;
+
+    long long first = s->segs[s->n_segs - 1];
+    int seg_fd = open(seg_name(fd, first, name, sizeof(name)), O_RDWR | O_CREAT,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (seg_fd == -1)
+        return ERR_DB_FILE;
+    int rc = fstat(seg_fd, &st) == 0 ? NO_ERROR : ERR_DB_FILE;
+    if (rc == NO_ERROR && st.st_size % sizeof(cdc_rec_t) != 0 &&
+        tr_ftruncate(seg_fd, st.st_size - st.st_size % sizeof(cdc_rec_t)) == -1)
+        rc = ERR_DB_FILE;
+    close(seg_fd);
+
+    log->next_seq = first + st.st_size / sizeof(cdc_rec_t);
+    return rc;
+}
+
+/*
+ *  cdc_attach
+ *      fd:  database opened with open_db(), locked
+ *
+ *  Loads the change log of the database if it is turned on, so
+ *  checkpoint_db() appends to it.  Called after the lock is taken.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void cdc_attach(int fd) {
+    if (fd < 0 || fd >= CDC_MAX_FDS)
+        return;
+    cdc_detach(fd);
+
+    cdc_log_t *log = calloc(1, sizeof(*log));
+    if (log == NULL)
+        return;
+    if (load_log(fd, log) != NO_ERROR) {
+        free(log);
+        return;
+    }
+    logs[fd] = log;
+}
+
+void cdc_detach(int fd) {
+    if (!cdc_attached(fd))
+        return;
+    free(logs[fd]->pending);
+    free(logs[fd]);
+    logs[fd] = NULL;
+}
+
+bool cdc_attached(int fd) {
+    return fd >= 0 && fd < CDC_MAX_FDS && logs[fd] != NULL;
+}
+
+/*
+ *  cdc_add
+ *      fd:     database with an attached log
+ *      off:    file offset of a 64 byte slot that changed
+ *      *slot:  its new contents
+ *
+ *  Queues the change for cdc_write().  The superblock is not a change.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if there is no memory for it
+ */
+int cdc_add(int fd, off_t off, const void *slot) {
+    int id = off / STUDENT_RECORD_SIZE;
+
+    if (!cdc_attached(fd) || id == SUPER_SLOT || id > MAX_STD_ID)
+        return NO_ERROR;
+
+    cdc_log_t *log = logs[fd];
+    if (log->n_pending == log->cap) {
+        int cap = log->cap ? log->cap * 2 : 64;
+        cdc_rec_t *grown = realloc(log->pending, cap * sizeof(*grown));
+        if (grown == NULL)
+            return ERR_DB_FILE;
+        log->pending = grown;
+        log->cap = cap;
+    }
+
+    cdc_rec_t *rec = &log->pending[log->n_pending++];
+    memset(rec, 0, sizeof(*rec));
+    rec->id = id;
+    memcpy(&rec->rec, slot, sizeof(rec->rec));
+    rec->op = rec->rec.id != 0 ? CDC_SET : CDC_DEL;
+    return NO_ERROR;
+}
+
+/*
+ *  append
+ *      fd:     database the log belongs to
+ *      *log:   its change log
+ *      *recs:  records to number and append
+ *      n:      number of records
+ *
+ *  Starts a new segment first if the last one is full, then writes every
+ *  record with one write().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int append(int fd, cdc_log_t *log, cdc_rec_t *recs, int n) {
+    char name[PATH_MAX];
+    cdc_state_t *st = &log->st;
+    long long first = st->segs[st->n_segs - 1];
+
+    if ((log->next_seq - first) * (long long)sizeof(cdc_rec_t) >= CDC_SEG_BYTES &&
+        st->n_segs < CDC_MAX_SEGS) {
+        st->segs[st->n_segs++] = log->next_seq;
+        if (save_state(fd, st) != NO_ERROR) {
+            st->n_segs--;
+            return ERR_DB_FILE;
+        }
+        first = log->next_seq;
+    }
+
+    for (int i = 0; i < n; i++)
+        recs[i].seq = log->next_seq + i;
+
+    int seg_fd = open(seg_name(fd, first, name, sizeof(name)), O_WRONLY | O_CREAT | O_APPEND,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (seg_fd == -1)
+        return ERR_DB_FILE;
+    ssize_t len = (ssize_t)n * sizeof(cdc_rec_t);
+    int rc = tr_write(seg_fd, recs, len) == len ? NO_ERROR : ERR_DB_FILE;
+    close(seg_fd);
+
+    if (rc == NO_ERROR)
+        log->next_seq += n;
+    return rc;
+}
+
+/*
+ *  cdc_write
+ *      fd:  database
+ *
+ *  Appends the changes queued by cdc_add().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cdc_write(int fd) {
+    if (!cdc_attached(fd) || logs[fd]->n_pending == 0)
+        return NO_ERROR;
+
+    cdc_log_t *log = logs[fd];
+    int rc = append(fd, log, log->pending, log->n_pending);
+    log->n_pending = 0;
+    return rc;
+}
+
+/*
+ *  cdc_reset
+ *      fd:  database
+ *
+ *  Appends a CDC_RESET right away, for changes that did not go through the
+ *  pager.  If even that fails the log is turned off so consumers find
+ *  their sequence numbers gone the next time -W turns it back on.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void cdc_reset(int fd) {
+    cdc_rec_t rec = { 0, CDC_RESET, 0, {0} };
+
+    if (!cdc_attached(fd))
+        return;
+    logs[fd]->n_pending = 0;
+    if (append(fd, logs[fd], &rec, 1) != NO_ERROR) {
+        char state_file[PATH_MAX];
+        unlink(db_sidecar(fd, CDC_EXT, false, state_file, sizeof(state_file)));
+        cdc_detach(fd);
+    }
+}
+
+//creates an empty log whose first record will be 1
+static int cdc_create(int fd) {
+    cdc_state_t st = { CDC_MAGIC, CDC_VERSION, 1, 0, {1}, {{{0}, 0}} };
+
+    if (save_state(fd, &st) != NO_ERROR)
+        return ERR_DB_FILE;
+    cdc_attach(fd);
+    return cdc_attached(fd) ? NO_ERROR : ERR_DB_FILE;
+}
+
+static void print_rec(int shard, const cdc_rec_t *rec) {
+    switch (rec->op) {
+        case CDC_SET:
+            printf("%d %lld a %d %s %s %d\n", shard, rec->seq, rec->id,
+                   rec->rec.fname, rec->rec.lname, rec->rec.gpa);
+            break;
+        case CDC_DEL:
+            printf("%d %lld d %d\n", shard, rec->seq, rec->id);
+            break;
+        default:
+            printf("%d %lld z\n", shard, rec->seq);
+            break;
+    }
+}
+
+/*
+ *  print_since
+ *      fd:     database the log belongs to
+ *      *log:   its change log
+ *      shard:  shard number printed in front of every change
+ *      since:  last sequence number the consumer has
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int print_since(int fd, cdc_log_t *log, int shard, long long since) {
+    cdc_rec_t recs[CDC_READ_RECS];
+    char name[PATH_MAX];
+    cdc_state_t *st = &log->st;
+
+    for (int k = 0; k < st->n_segs; k++) {
+        long long first = st->segs[k];
+        long long end = k + 1 < st->n_segs ? st->segs[k + 1] : log->next_seq;
+        if (end - 1 <= since)
+            continue;
+
+        int seg_fd = open(seg_name(fd, first, name, sizeof(name)), O_RDONLY);
+        if (seg_fd == -1)
+            return ERR_DB_FILE;
+        long long seq = since + 1 > first ? since + 1 : first;
+        while (seq < end) {
+            ssize_t n = tr_pread(seg_fd, recs, sizeof(recs),
+                                 (off_t)(seq - first) * sizeof(cdc_rec_t));
+            if (n <= 0)
+                break;
+            for (int i = 0; i < n / (ssize_t)sizeof(cdc_rec_t) && seq < end; i++, seq++)
+                print_rec(shard, &recs[i]);
+        }
+        close(seg_fd);
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  ack
+ *      fd:        database the log belongs to
+ *      *log:      its change log
+ *      consumer:  name of the consumer
+ *      since:     last sequence number it has
+ *
+ *  Records the acknowledgement and deletes every segment, except the one
+ *  being written, that all consumers have acknowledged.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if there are too many consumers, or
+ *            ERR_DB_FILE
+ *
+ *  console:  M_ERR_CDC_CONSUMERS  too many consumers
+ */
+static int ack(int fd, cdc_log_t *log, const char *consumer, long long since) {
+    char name[PATH_MAX];
+    cdc_state_t *st = &log->st;
+    int c;
+
+    for (c = 0; c < st->n_consumers; c++) {
+        if (strncmp(st->consumers[c].name, consumer, CDC_NAME_LEN - 1) == 0)
+            break;
+    }
+    if (c == st->n_consumers) {
+        if (c == CDC_MAX_CONSUMERS) {
+            printf(M_ERR_CDC_CONSUMERS, CDC_MAX_CONSUMERS);
+            return ERR_DB_OP;
+        }
+        memset(&st->consumers[c], 0, sizeof(st->consumers[c]));
+        strncpy(st->consumers[c].name, consumer, CDC_NAME_LEN - 1);
+        st->n_consumers++;
+    }
+    if (since > st->consumers[c].acked)
+        st->consumers[c].acked = since;
+
+    long long min_ack = st->consumers[0].acked;
+    for (c = 1; c < st->n_consumers; c++) {
+        if (st->consumers[c].acked < min_ack)
+            min_ack = st->consumers[c].acked;
+    }
+
+    //the state goes first, a crash leaves unlisted segments behind rather
+    //than listed ones missing
+    int drop = 0;
+    while (drop + 1 < st->n_segs && st->segs[drop + 1] - 1 <= min_ack)
+        drop++;
+    cdc_state_t old = *st;
+    memmove(st->segs, st->segs + drop, (st->n_segs - drop) * sizeof(st->segs[0]));
+    st->n_segs -= drop;
+    if (save_state(fd, st) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int k = 0; k < drop; k++)
+        unlink(seg_name(fd, old.segs[k], name, sizeof(name)));
+    return NO_ERROR;
+}
+
+/*
+ *  cdc_stream
+ *      fd:        database opened with open_db(), locked exclusively
+ *      shard:     shard number printed in front of every change
+ *      since:     last sequence number the consumer has, 0 for all
+ *      consumer:  name to acknowledge since under, or NULL
+ *
+ *  Prints every change after since, one per line:
+ *
+ *      shard seq a id first_name last_name gpa
+ *      shard seq d id
+ *      shard seq z
+ *
+ *  The log is turned on if it was off.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the changes after since were already
+ *            deleted, or ERR_DB_FILE
+ *
+ *  console:  the changes, or M_ERR_CDC_GONE
+ */
+int cdc_stream(int fd, int shard, long long since, const char *consumer) {
+    if (!cdc_attached(fd) && cdc_create(fd) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    cdc_log_t *log = logs[fd];
+    if (since < log->st.segs[0] - 1 || since < 0) {
+        printf(M_ERR_CDC_GONE, since);
+        return ERR_DB_OP;
+    }
+    if (print_since(fd, log, shard, since) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (consumer != NULL)
+        return ack(fd, log, consumer, since);
+    return NO_ERROR;
+}
@@ -0,0 +1,79 @@
+#ifndef __CDC_H__
+#define __CDC_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "db.h"     //get student record type
+
+//A change log lets downstream copies follow the database without dumping
+//it again.  Once it is turned on, every slot that changes is appended to
+//it as a fixed size cdc_rec_t with the next sequence number:
+//
+//  CDC_SET     the student now in the slot, an add or a change
+//  CDC_DEL     the slot was emptied
+//  CDC_RESET   the file changed as a whole (-z, -R, a crash repaired by
+//              recovery or a superblock rebuild), the consumer has to dump
+//              the database again
+//
+//Records are appended by checkpoint_db() before the pages go to the file,
+//in the same write for the whole checkpoint.  The superblock is dirty on
+//disk until the pages are written, so a crash in between is repaired by
+//rebuild_super(), which logs a CDC_RESET.  A change is never lost from the
+//log, at worst a consumer resyncs.
+//
+//The log lives next to the database: CDC_EXT holds the segment list and
+//the consumers, and every segment is a file named after the sequence
+//number of its first record ("student.1.cdc").  A new segment is started
+//once the last one reaches CDC_SEG_BYTES.
+//
+//-W since [consumer] prints the changes after since, turning the log on
+//if it was off; a consumer should dump the database with -p first.  A
+//named consumer also acknowledges everything up to since, and segments
+//every consumer has acknowledged are deleted.  Only writers holding the
+//exclusive lock append, so sequence numbers never repeat.
+#define CDC_EXT             ".cdc"
+#define CDC_MAGIC           0x43444353      //"SCDC"
+#define CDC_VERSION         1
+#define CDC_SEG_BYTES       (1024 * 1024)
+#define CDC_MAX_SEGS        64
+#define CDC_MAX_CONSUMERS   16
+#define CDC_NAME_LEN        24
+
+#define CDC_SET             1
+#define CDC_DEL             2
+#define CDC_RESET           3
+
+typedef struct cdc_rec{
+    long long seq;          //sequence number, the first record is 1
+    int op;                 //CDC_SET, CDC_DEL or CDC_RESET
+    int id;                 //student id, 0 for CDC_RESET
+    student_t rec;          //CDC_SET: the student
+} cdc_rec_t;
+
+typedef struct cdc_consumer{
+    char name[CDC_NAME_LEN];
+    long long acked;        //every record up to this one was received
+} cdc_consumer_t;
+
+typedef struct cdc_state{
+    int magic;              //CDC_MAGIC
+    int version;            //CDC_VERSION
+    int n_segs;             //segments kept, oldest first
+    int n_consumers;
+    long long segs[CDC_MAX_SEGS];   //first sequence number of each segment
+    cdc_consumer_t consumers[CDC_MAX_CONSUMERS];
+} cdc_state_t;
+
+//writers, fd is a database opened with open_db() and locked
+void cdc_attach(int fd);
+void cdc_detach(int fd);
+bool cdc_attached(int fd);
+int cdc_add(int fd, off_t off, const void *slot);
+int cdc_write(int fd);
+void cdc_reset(int fd);
+
+//-W, fd locked exclusively
+int cdc_stream(int fd, int shard, long long since, const char *consumer);
+
+#endif
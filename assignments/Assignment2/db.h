@@ -1,35 +1,78 @@
-#ifndef __DB_H__
-    #define __DB_H__
-
-// Basic student database record.  Note:
-//  1. id must be > 0.  A student id==0 means the record has been deleted
-//  2. gpa is an int, should be between 0<=gpa<=500, real gpa is gpa/100.0 this
-//     simplifies dealing with floating point types
-//  3. Notice that the student struct was engineered to have a size of
-//     64 bytes.  There are reasons for using such a number
-typedef struct student{
-    int id;
-    char fname[24];
-    char lname[32];
-    int gpa; 
-} student_t;
-
-//Define limits for sudent ids and allowable GPA ranges.  Note GPA values will
-//be stored as integers but printed as floats.  For example a GPA of 450 is really
-//that value divided by 100.0 or 4.50.
-#define MIN_STD_ID      1
-#define MAX_STD_ID      100000
-#define MIN_STD_GPA     0
-#define MAX_STD_GPA     500
-
-//some useful constants you should consider using versus hard coding
-//in your program. 
-static const student_t EMPTY_STUDENT_RECORD = {0};
-static const int STUDENT_RECORD_SIZE  = sizeof(struct student);
-static const int DELETED_STUDENT_ID = 0;
-
-
-#define DB_FILE     "student.db"            //name of database file
-#define TMP_DB_FILE ".tmp_student.db"       //for extra credit
-
+#ifndef __DB_H__
+    #define __DB_H__
+
+// Basic student database record.  Note:
+//  1. id must be > 0.  A student id==0 means the record has been deleted
+//  2. gpa is an int, should be between 0<=gpa<=500, real gpa is gpa/100.0 this
+//     simplifies dealing with floating point types
+//  3. Notice that the student struct was engineered to have a size of
+//     64 bytes.  There are reasons for using such a number
+typedef struct student{
+    int id;
+    char fname[24];
+    char lname[32];
+    int gpa; 
+} student_t;
+
+//Define limits for sudent ids and allowable GPA ranges.  Note GPA values will
+//be stored as integers but printed as floats.  For example a GPA of 450 is really
+//that value divided by 100.0 or 4.50.
+#define MIN_STD_ID      1
+#define MAX_STD_ID      100000
+#define MIN_STD_GPA     0
+#define MAX_STD_GPA     500
+
+//records read per read() call when scanning the whole file, one 4 KiB page
+#define SCAN_RECS       64
+
+//scan_db() maps files of at least SCAN_MMAP_MIN bytes instead of reading
+//them, and prefetches the record SCAN_PREFETCH records ahead of the one it
+//is looking at.  SCAN_ENV=read or =mmap forces one way for every file
+#define SCAN_ENV        "SDBSC_SCAN"
+#define SCAN_MMAP_MIN   (1024 * 1024)
+#define SCAN_PREFETCH   16
+
+//compress_db() copies runs of live records of at most COMPRESS_CHUNK bytes
+//with copy_file_range(), on up to COMPRESS_WORKERS threads
+#define COMPRESS_CHUNK      (1024 * 1024)
+#define COMPRESS_WORKERS    4
+
+//some useful constants you should consider using versus hard coding
+//in your program. 
+static const student_t EMPTY_STUDENT_RECORD = {0};
+static const int STUDENT_RECORD_SIZE  = sizeof(struct student);
+static const int DELETED_STUDENT_ID = 0;
+
+
+//Slot 0 of the database file can never hold a student (ids start at 1), so
+//it is used as a superblock that caches the number of live records and the
+//highest id the file has room for.  It is the same size as a student record
+//so every student still lives at id * STUDENT_RECORD_SIZE.  The magic value
+//overlays student.id, a slot 0 without it is treated as a stale superblock
+//and rebuilt by scanning the file.
+typedef struct db_super{
+    int magic;              //SUPER_MAGIC when the superblock is initialized
+    int version;            //SUPER_VERSION
+    int flags;              //SUPER_DIRTY while a mutation is in flight
+    int rec_count;          //number of live student records
+    int max_id;             //highest id stored, file size is (max_id+1)*64
+    unsigned int checksum;  //checksum of the superblock, see super_checksum()
+    int generation;         //bumped by every add or delete
+    unsigned int epoch;     //changes whenever generation restarts or is lost
+    int shard_id;           //which shard of a sharded database this file is
+    int shard_count;        //number of shards, 0 until the layout is stamped
+    int shard_mode;         //SHARD_RANGE or SHARD_HASH, see shard.h
+    char reserved[20];
+} db_super_t;
+
+#define SUPER_MAGIC     0x42445353          //"SSDB"
+#define SUPER_VERSION   1
+#define SUPER_DIRTY     0x1
+#define SUPER_NO_LAYOUT 0x2                 //rebuilt, the shard stamp was lost
+#define SUPER_SLOT      0
+
+#define DB_FILE     "student.db"            //name of database file
+#define TMP_DB_FILE ".tmp_student.db"       //for extra credit
+#define TRI_EXT     ".tri"                  //trigram index, "student.tri"
+
 #endif
\ No newline at end of file
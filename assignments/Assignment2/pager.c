@@ -0,0 +1,683 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "pager.h"
+#include "trace.h"
+
+typedef struct pager_frame{
+    int fd;                 //file the page belongs to, -1 for a free frame
+    off_t page;             //page number in the file
+    bool dirty;             //changed since it was read or written back
+    bool ref;               //used since the clock hand last passed
+    bool busy;              //being read or written without pool_lock
+    uint64_t slots;         //bit per PAGER_SLOT bytes changed while dirty
+    int next;               //next frame in the hash chain, -1 ends it
+    char data[PAGER_PAGE];
+} pager_frame_t;
+
+//what the pool knows about each open file
+typedef struct pager_file{
+    bool known;             //size has been read with fstat()
+    off_t size;             //file size including pages not written back
+    int n_dirty;            //dirty frames of this file
+    bool held;              //dirty frames must stay in the pool
+} pager_file_t;
+
+static pager_frame_t frames[PAGER_FRAMES];
+static int buckets[PAGER_BUCKETS];
+static pager_file_t files[PAGER_MAX_FDS];
+static int hand;
+static bool ready;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_io = PTHREAD_COND_INITIALIZER;  //a frame stopped being busy
+
+static void pool_init(void) {
+    if (ready)
+        return;
+    for (int i = 0; i < PAGER_BUCKETS; i++)
+        buckets[i] = -1;
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        frames[i].fd = -1;
+        frames[i].next = -1;
+    }
+    ready = true;
+}
+
+static int bucket_of(int fd, off_t page) {
+    return ((unsigned)page * 0x9e3779b1u ^ (unsigned)fd * 0x85ebca6bu) & (PAGER_BUCKETS - 1);
+}
+
+//size of fd, read from the file the first time it is needed
+static int file_size(int fd, off_t *size) {
+    pager_file_t *pf = &files[fd];
+
+    if (!pf->known) {
+        struct stat st;
+        if (fstat(fd, &st) == -1)
+            return ERR_DB_FILE;
+        pf->size = st.st_size;
+        pf->known = true;
+    }
+    *size = pf->size;
+    return NO_ERROR;
+}
+
+static void unlink_frame(int i) {
+    int *p = &buckets[bucket_of(frames[i].fd, frames[i].page)];
+
+    while (*p != i)
+        p = &frames[*p].next;
+    *p = frames[i].next;
+    frames[i].fd = -1;
+    frames[i].next = -1;
+}
+
+//bytes of the page in frame i that lie inside the file
+static off_t frame_len(int i) {
+    off_t len = files[frames[i].fd].size - frames[i].page * PAGER_PAGE;
+
+    return len > PAGER_PAGE ? PAGER_PAGE : len;
+}
+
+static void mark_clean(int i) {
+    frames[i].dirty = false;
+    frames[i].slots = 0;
+    files[frames[i].fd].n_dirty--;
+}
+
+//waits until no frame of fd is busy, pool_lock is held
+static void wait_file(int fd) {
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        if (frames[i].fd == fd && frames[i].busy) {
+            pthread_cond_wait(&pool_io, &pool_lock);
+            i = -1;
+        }
+    }
+}
+
+/*
+ *  write_back
+ *      i:  index of a dirty frame that is not busy, pool_lock is held
+ *
+ *  Writes the part of the page that lies inside the file, so the file
+ *  never grows by more than the records written to it.  The lock is
+ *  dropped during the write and the frame is busy meanwhile.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_back(int i) {
+    pager_frame_t *f = &frames[i];
+    off_t len = frame_len(i);
+    bool ok = true;
+
+    if (len > 0) {
+        f->busy = true;
+        pthread_mutex_unlock(&pool_lock);
+        ok = tr_pwrite(f->fd, f->data, len, f->page * PAGER_PAGE) == len;
+        pthread_mutex_lock(&pool_lock);
+        f->busy = false;
+        pthread_cond_broadcast(&pool_io);
+    }
+    if (!ok)
+        return ERR_DB_FILE;
+    mark_clean(i);
+    return NO_ERROR;
+}
+
+/*
+ *  find_victim
+ *
+ *  Runs the clock hand until it finds a free frame or one that was not
+ *  used since the last pass, writing it back if it is dirty.  Dirty page
+ *  0 frames and dirty frames of held files are skipped, see pager.h, and
+ *  so are busy frames.  If only busy frames stood in the way it waits
+ *  for them and goes round again.
+ *
+ *  returns:  index of a free frame, or ERR_DB_FILE
+ */
+static int find_victim(void) {
+    for (;;) {
+        bool saw_busy = false;
+
+        for (int tries = 0; tries < 2 * PAGER_FRAMES + 1; tries++) {
+            int i = hand;
+            pager_frame_t *f = &frames[i];
+
+            hand = (hand + 1) % PAGER_FRAMES;
+            if (f->busy) {
+                saw_busy = true;
+                continue;
+            }
+            if (f->fd == -1)
+                return i;
+            if (f->ref) {
+                f->ref = false;
+                continue;
+            }
+            if (f->dirty && (f->page == 0 || files[f->fd].held))
+                continue;
+            if (f->dirty && write_back(i) != NO_ERROR)
+                return ERR_DB_FILE;
+            unlink_frame(i);
+            return i;
+        }
+        if (!saw_busy)
+            return ERR_DB_FILE;
+        pthread_cond_wait(&pool_io, &pool_lock);
+    }
+}
+
+/*
+ *  get_frame
+ *      fd:    file descriptor
+ *      page:  page number
+ *
+ *  Finds the page in the pool or reads it in.  The part of a page past
+ *  the end of the file reads as zeros, like a hole.  The read happens
+ *  without pool_lock, with the frame already in its hash chain and busy,
+ *  so other threads wait for the page instead of reading it twice.  The
+ *  frame returned is not busy and stays valid until the lock is dropped.
+ *
+ *  returns:  frame index, or ERR_DB_FILE
+ */
+static int get_frame(int fd, off_t page) {
+    int b = bucket_of(fd, page);
+    bool missed = false;
+
+    for (;;) {
+        int i = buckets[b];
+        while (i != -1 && (frames[i].fd != fd || frames[i].page != page))
+            i = frames[i].next;
+        if (i != -1 && frames[i].busy) {
+            pthread_cond_wait(&pool_io, &pool_lock);
+            continue;
+        }
+        if (i != -1) {
+            frames[i].ref = true;
+            if (!missed)
+                tr_cache(true);
+            return i;
+        }
+        if (!missed)
+            tr_cache(false);
+        missed = true;
+
+        //find_victim() may drop the lock to write a page back, and the
+        //page may have been read in meanwhile
+        i = find_victim();
+        if (i < 0)
+            return ERR_DB_FILE;
+        int j = buckets[b];
+        while (j != -1 && (frames[j].fd != fd || frames[j].page != page))
+            j = frames[j].next;
+        if (j != -1)
+            continue;
+
+        pager_frame_t *f = &frames[i];
+        f->fd = fd;
+        f->page = page;
+        f->dirty = false;
+        f->slots = 0;
+        f->ref = true;
+        f->next = buckets[b];
+        buckets[b] = i;
+
+        ssize_t n = 0;
+        if (page * PAGER_PAGE < files[fd].size) {
+            f->busy = true;
+            pthread_mutex_unlock(&pool_lock);
+            n = tr_pread(fd, f->data, PAGER_PAGE, page * PAGER_PAGE);
+            pthread_mutex_lock(&pool_lock);
+            f->busy = false;
+            pthread_cond_broadcast(&pool_io);
+            if (n < 0) {
+                unlink_frame(i);
+                return ERR_DB_FILE;
+            }
+        }
+        memset(f->data + n, 0, PAGER_PAGE - n);
+        return i;
+    }
+}
+
+/*
+ *  pager_read
+ *      fd, buf, n, off:  as for pread()
+ *
+ *  Copies from the cached pages, reading in the ones that are missing.
+ *
+ *  returns:  bytes copied, less than n at the end of the file and 0 past
+ *            it, or -1 on an I/O error
+ */
+ssize_t pager_read(int fd, void *buf, size_t n, off_t off) {
+    off_t size;
+    size_t done = 0;
+
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return tr_pread(fd, buf, n, off);
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    if (file_size(fd, &size) != NO_ERROR)
+        goto fail;
+    if (off >= size)
+        n = 0;
+    else if ((off_t)n > size - off)
+        n = size - off;
+
+    while (done < n) {
+        off_t pos = off + done;
+        int i = get_frame(fd, pos / PAGER_PAGE);
+        if (i < 0)
+            goto fail;
+
+        size_t in_page = pos % PAGER_PAGE;
+        size_t len = PAGER_PAGE - in_page;
+        if (len > n - done)
+            len = n - done;
+        memcpy((char *)buf + done, frames[i].data + in_page, len);
+        done += len;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return done;
+
+fail:
+    pthread_mutex_unlock(&pool_lock);
+    return -1;
+}
+
+/*
+ *  pager_write
+ *      fd, buf, n, off:  as for pwrite()
+ *
+ *  Copies into the cached pages and marks them dirty.  Writing past the
+ *  end of the file grows it, the pages in between read as zeros.
+ *
+ *  returns:  n, or -1 on an I/O error
+ */
+ssize_t pager_write(int fd, const void *buf, size_t n, off_t off) {
+    off_t size;
+    size_t done = 0;
+
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return tr_pwrite(fd, buf, n, off);
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    if (file_size(fd, &size) != NO_ERROR)
+        goto fail;
+
+    while (done < n) {
+        off_t pos = off + done;
+        int i = get_frame(fd, pos / PAGER_PAGE);
+        if (i < 0)
+            goto fail;
+
+        size_t in_page = pos % PAGER_PAGE;
+        size_t len = PAGER_PAGE - in_page;
+        if (len > n - done)
+            len = n - done;
+        memcpy(frames[i].data + in_page, (const char *)buf + done, len);
+        if (!frames[i].dirty) {
+            frames[i].dirty = true;
+            files[fd].n_dirty++;
+        }
+        for (size_t s = in_page / PAGER_SLOT; s <= (in_page + len - 1) / PAGER_SLOT; s++)
+            frames[i].slots |= (uint64_t)1 << s;
+        done += len;
+    }
+    if (off + (off_t)n > files[fd].size)
+        files[fd].size = off + n;
+    pthread_mutex_unlock(&pool_lock);
+    return n;
+
+fail:
+    pthread_mutex_unlock(&pool_lock);
+    return -1;
+}
+
+/*
+ *  pager_write_through
+ *      fd, buf, n, off:  as for pwrite()
+ *
+ *  Like pager_write() but the bytes are also written to the file right
+ *  away.  The page stays dirty if it already was.
+ *
+ *  returns:  n, or -1 on an I/O error
+ */
+ssize_t pager_write_through(int fd, const void *buf, size_t n, off_t off) {
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return tr_pwrite(fd, buf, n, off);
+    if (pager_write(fd, buf, n, off) != (ssize_t)n)
+        return -1;
+    return tr_pwrite(fd, buf, n, off);
+}
+
+/*
+ *  pager_size
+ *      fd:  file descriptor
+ *
+ *  returns:  size of the file including writes not yet written back, or
+ *            -1 on an I/O error
+ */
+off_t pager_size(int fd) {
+    off_t size;
+
+    if (fd < 0 || fd >= PAGER_MAX_FDS) {
+        struct stat st;
+        return fstat(fd, &st) == -1 ? -1 : st.st_size;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (file_size(fd, &size) != NO_ERROR)
+        size = -1;
+    pthread_mutex_unlock(&pool_lock);
+    return size;
+}
+
+/*
+ *  pager_dirty
+ *      fd:  file descriptor
+ *
+ *  returns:  true if fd has pages that were not written back
+ */
+bool pager_dirty(int fd) {
+    bool dirty;
+
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return false;
+
+    pthread_mutex_lock(&pool_lock);
+    dirty = files[fd].n_dirty > 0;
+    pthread_mutex_unlock(&pool_lock);
+    return dirty;
+}
+
+/*
+ *  write_run
+ *      *order:  indexes of busy dirty frames of one file, sorted by page
+ *      n:       number of frames
+ *      size:    size of the file when the frames were marked busy
+ *
+ *  Writes back frames whose pages follow each other in the file with one
+ *  pwritev() per run instead of one pwrite() per page.  Called without
+ *  pool_lock, the frames being busy keeps them as they are.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_run(int *order, int n, off_t size) {
+    struct iovec iov[PAGER_FRAMES];
+
+    for (int k = 0; k < n; ) {
+        pager_frame_t *first = &frames[order[k]];
+        off_t start = first->page * PAGER_PAGE;
+        ssize_t len = 0;
+        int cnt = 0;
+
+        while (k + cnt < n &&
+               frames[order[k + cnt]].page == first->page + cnt) {
+            off_t in_file = size - (start + len);
+            if (in_file <= 0)
+                break;
+            iov[cnt].iov_base = frames[order[k + cnt]].data;
+            iov[cnt].iov_len = in_file > PAGER_PAGE ? PAGER_PAGE : in_file;
+            len += iov[cnt].iov_len;
+            cnt++;
+        }
+        if (cnt > 1 && tr_pwritev(first->fd, iov, cnt, start) != len)
+            return ERR_DB_FILE;
+        if (cnt == 1 && tr_pwrite(first->fd, first->data, len, start) != len)
+            return ERR_DB_FILE;
+        k += cnt ? cnt : 1;
+    }
+    return NO_ERROR;
+}
+
+static int cmp_frame_page(const void *a, const void *b) {
+    off_t pa = frames[*(const int *)a].page;
+    off_t pb = frames[*(const int *)b].page;
+    return (pa > pb) - (pa < pb);
+}
+
+/*
+ *  pager_flush
+ *      fd:  file descriptor
+ *
+ *  Writes back every dirty page of fd in file order, page 0 last.  Runs
+ *  of consecutive pages go out in a single write.  The writes happen
+ *  without pool_lock, the frames are busy until they are done.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int pager_flush(int fd) {
+    int order[PAGER_FRAMES];
+    int n = 0, zero = -1;
+    int rc = NO_ERROR;
+
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return NO_ERROR;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    wait_file(fd);
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        if (frames[i].fd != fd || !frames[i].dirty)
+            continue;
+        if (frames[i].page == 0)
+            zero = i;
+        else
+            order[n++] = i;
+        frames[i].busy = true;
+    }
+    qsort(order, n, sizeof(order[0]), cmp_frame_page);
+    off_t size = files[fd].size;
+    off_t zero_len = zero != -1 ? frame_len(zero) : 0;
+    pthread_mutex_unlock(&pool_lock);
+
+    rc = write_run(order, n, size);
+    if (rc == NO_ERROR && zero_len > 0 &&
+        tr_pwrite(fd, frames[zero].data, zero_len, 0) != zero_len)
+        rc = ERR_DB_FILE;
+
+    //on an error every page stays dirty and is written again later
+    pthread_mutex_lock(&pool_lock);
+    for (int k = 0; k < n; k++) {
+        frames[order[k]].busy = false;
+        if (rc == NO_ERROR)
+            mark_clean(order[k]);
+    }
+    if (zero != -1) {
+        frames[zero].busy = false;
+        if (rc == NO_ERROR)
+            mark_clean(zero);
+    }
+    pthread_cond_broadcast(&pool_io);
+    pthread_mutex_unlock(&pool_lock);
+    return rc;
+}
+
+/*
+ *  pager_drop
+ *      fd:  file descriptor
+ *
+ *  Forgets every page of fd without writing it back, and the file size.
+ *  Used before fd is closed, and when the file may have been changed by
+ *  someone else or truncated.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void pager_drop(int fd) {
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    wait_file(fd);
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        if (frames[i].fd == fd)
+            unlink_frame(i);
+    }
+    files[fd].known = false;
+    files[fd].n_dirty = 0;
+    files[fd].held = false;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ *  pager_punch
+ *      fd:   file descriptor
+ *      off:  page aligned file offset, not page 0
+ *      len:  bytes, a multiple of PAGER_PAGE or up to the end of the file
+ *
+ *  Frees the disk blocks of a range that only holds empty slots, so it
+ *  reads back as zeros without taking up space.  The file size does not
+ *  change.  Cached pages of the range are forgotten, their contents are
+ *  the zeros the file now has.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the file system cannot punch
+ *            holes, the caller then has to write the zeros itself
+ */
+int pager_punch(int fd, off_t off, off_t len) {
+    int rc = NO_ERROR;
+
+    if (off < PAGER_PAGE || off % PAGER_PAGE != 0)
+        return ERR_DB_FILE;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    wait_file(fd);
+    if (tr_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == -1) {
+        rc = ERR_DB_FILE;
+    } else if (fd < PAGER_MAX_FDS) {
+        for (int i = 0; i < PAGER_FRAMES; i++) {
+            pager_frame_t *f = &frames[i];
+            if (f->fd != fd || f->page < off / PAGER_PAGE ||
+                f->page * PAGER_PAGE >= off + len)
+                continue;
+            if (f->dirty)
+                files[fd].n_dirty--;
+            unlink_frame(i);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return rc;
+}
+
+/*
+ *  pager_forget_slots
+ *      fd:   file descriptor
+ *      off:  page aligned file offset
+ *      len:  bytes
+ *
+ *  Forgets which slots of the cached pages in the range changed, for
+ *  changes that were already logged.  The pages stay dirty and are still
+ *  written back, but pager_collect() no longer lists their slots.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void pager_forget_slots(int fd, off_t off, off_t len) {
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    wait_file(fd);
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        pager_frame_t *f = &frames[i];
+        if (f->fd == fd && f->page >= off / PAGER_PAGE &&
+            f->page * PAGER_PAGE < off + len)
+            f->slots = 0;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ *  pager_hold
+ *      fd:    file descriptor
+ *      hold:  true to keep the dirty pages of fd in the pool
+ *
+ *  returns:  nothing, this is a void function
+ */
+void pager_hold(int fd, bool hold) {
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    files[fd].held = hold;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ *  pager_room
+ *
+ *  Counts the frames find_victim() could still hand out: free ones and
+ *  ones that can be written back.  A transaction checks it before each
+ *  change, since held pages cannot leave the pool, see txn.h.
+ *
+ *  returns:  number of frames
+ */
+int pager_room(void) {
+    int n = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        pager_frame_t *f = &frames[i];
+        if (f->busy || (f->fd != -1 && f->dirty && (f->page == 0 || files[f->fd].held)))
+            continue;
+        n++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return n;
+}
+
+/*
+ *  pager_collect
+ *      fd:   file descriptor
+ *      fn:   called for every slot written since its page was last clean
+ *      arg:  passed through to fn
+ *
+ *  Slots are visited in file order.  Slots past the end of the file are
+ *  skipped.
+ *
+ *  returns:  NO_ERROR, or the first non-zero value fn returned
+ */
+int pager_collect(int fd, pager_slot_fn fn, void *arg) {
+    int order[PAGER_FRAMES];
+    int n = 0, rc = NO_ERROR;
+
+    if (fd < 0 || fd >= PAGER_MAX_FDS)
+        return NO_ERROR;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_init();
+    wait_file(fd);
+    for (int i = 0; i < PAGER_FRAMES; i++) {
+        if (frames[i].fd == fd && frames[i].dirty)
+            order[n++] = i;
+    }
+    qsort(order, n, sizeof(order[0]), cmp_frame_page);
+
+    for (int k = 0; k < n && rc == NO_ERROR; k++) {
+        pager_frame_t *f = &frames[order[k]];
+        for (int s = 0; s < PAGER_PAGE / PAGER_SLOT && rc == NO_ERROR; s++) {
+            off_t off = f->page * PAGER_PAGE + s * PAGER_SLOT;
+            if ((f->slots & ((uint64_t)1 << s)) && off < files[fd].size)
+                rc = fn(off, f->data + s * PAGER_SLOT, arg);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return rc;
+}
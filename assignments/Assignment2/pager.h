@@ -0,0 +1,59 @@
+#ifndef __PAGER_H__
+#define __PAGER_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+//Every read and write of a database file goes through a buffer pool of
+//PAGER_FRAMES pages of PAGER_PAGE bytes, 64 student records each.  Pages
+//are found by file descriptor and page number, and evicted with the CLOCK
+//algorithm: a frame that was used since the hand last passed it gets a
+//second chance.  Writes only change the cached page and mark it dirty.
+//Dirty pages are written back when they are evicted or by pager_flush(),
+//which checkpoint_db() and close_db() call and which writes runs of
+//consecutive pages with one pwritev().
+//
+//Page 0 holds the superblock.  A dirty page 0 is never evicted and
+//pager_flush() writes it after every other page, so the clean superblock
+//only reaches the disk once the records it describes are there.
+//super_begin() marks the superblock dirty on disk with
+//pager_write_through() before the first record page of a change can be
+//written back, so a crash in between is still caught by load_super().
+//
+//While a transaction is open the file is held with pager_hold(): its
+//dirty pages are not evicted at all, so nothing reaches the file before
+//the redo log is written, and pager_collect() lists the 64 byte slots
+//that changed so only those go into the log, see txn.h.  A transaction
+//can therefore only change as many pages as the pool can hold, which
+//pager_room() tells it.
+//
+//The cached pages are only valid while the caller holds the lock on the
+//file.  shard_lock() drops them after locking.  close_db() or
+//pager_drop() must be called before an fd is closed, so a reused fd
+//number never finds old pages.  The pool is shared by the shard threads
+//and protected by a mutex, which is not held while a page is read from
+//or written to the file.  The frame is busy meanwhile, and other threads
+//that need it wait while the rest of the pool stays usable.
+#define PAGER_PAGE      4096
+#define PAGER_FRAMES    256                 //1 MiB pool
+#define PAGER_BUCKETS   512                 //hash chains, power of 2
+#define PAGER_MAX_FDS   1024                //higher fds bypass the pool
+#define PAGER_SLOT      64                  //dirty tracking granularity
+
+//called by pager_collect() with the file offset and contents of a slot
+typedef int (*pager_slot_fn)(off_t off, const void *slot, void *arg);
+
+ssize_t pager_read(int fd, void *buf, size_t n, off_t off);
+ssize_t pager_write(int fd, const void *buf, size_t n, off_t off);
+ssize_t pager_write_through(int fd, const void *buf, size_t n, off_t off);
+off_t pager_size(int fd);
+bool pager_dirty(int fd);
+int pager_flush(int fd);
+void pager_drop(int fd);
+int pager_punch(int fd, off_t off, off_t len);
+void pager_forget_slots(int fd, off_t off, off_t len);
+void pager_hold(int fd, bool hold);
+int pager_room(void);
+int pager_collect(int fd, pager_slot_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "pager.h"
+#include "shm.h"
+#include "cdc.h"
+#include "purge.h"
+
+static const struct {
+    const char *name;
+    int field;
+} purge_fields[] = {
+    { "id", PURGE_ID }, { "gpa", PURGE_GPA },
+    { "fname", PURGE_FNAME }, { "lname", PURGE_LNAME },
+};
+
+//longest operators first so "<=" is not read as "<"
+static const struct {
+    const char *text;
+    int op;
+} purge_ops[] = {
+    { "==", PURGE_EQ }, { "!=", PURGE_NE }, { "<=", PURGE_LE },
+    { ">=", PURGE_GE }, { "<", PURGE_LT }, { ">", PURGE_GT },
+};
+
+#define N_FIELDS    (int)(sizeof(purge_fields) / sizeof(purge_fields[0]))
+#define N_OPS       (int)(sizeof(purge_ops) / sizeof(purge_ops[0]))
+
+/*
+ *  parse_term
+ *      *p:     start of the term, moved past it
+ *      *term:  filled in on success
+ *
+ *  returns:  true if a valid term was read
+ */
+static bool parse_term(const char **p, purge_term_t *term) {
+    const char *s = *p;
+    size_t len;
+    int k;
+
+    memset(term, 0, sizeof(*term));
+    while (isspace((unsigned char)*s))
+        s++;
+    for (len = 0; isalpha((unsigned char)s[len]); len++)
+        ;
+    for (k = 0; k < N_FIELDS; k++) {
+        if (strlen(purge_fields[k].name) == len && strncmp(s, purge_fields[k].name, len) == 0)
+            break;
+    }
+    if (k == N_FIELDS)
+        return false;
+    term->field = purge_fields[k].field;
+    s += len;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    for (k = 0; k < N_OPS; k++) {
+        if (strncmp(s, purge_ops[k].text, strlen(purge_ops[k].text)) == 0)
+            break;
+    }
+    if (k == N_OPS)
+        return false;
+    term->op = purge_ops[k].op;
+    s += strlen(purge_ops[k].text);
+
+    while (isspace((unsigned char)*s))
+        s++;
+    for (len = 0; s[len] && s[len] != ','; len++)
+        ;
+    while (len > 0 && isspace((unsigned char)s[len - 1]))
+        len--;
+    if (len == 0)
+        return false;
+
+    if (term->field == PURGE_FNAME || term->field == PURGE_LNAME) {
+        if ((term->op != PURGE_EQ && term->op != PURGE_NE) || len >= sizeof(term->name))
+            return false;
+        memcpy(term->name, s, len);
+    } else {
+        char num[16];
+        char *end;
+
+        if (len >= sizeof(num))
+            return false;
+        memcpy(num, s, len);
+        num[len] = '\0';
+        term->value = strtol(num, &end, 10);
+        if (*end != '\0')
+            return false;
+    }
+
+    s += len;
+    while (isspace((unsigned char)*s))
+        s++;
+    *p = s;
+    return true;
+}
+
+/*
+ *  purge_parse
+ *      text:   predicate from the command line, see purge.h
+ *      *pred:  filled in on success
+ *
+ *  returns:  NO_ERROR or EXIT_FAIL_ARGS
+ *
+ *  console:  M_ERR_PURGE_PRED  the predicate cant be parsed
+ */
+int purge_parse(const char *text, purge_pred_t *pred) {
+    const char *p = text;
+
+    pred->n = 0;
+    while (true) {
+        if (pred->n == PURGE_MAX_TERMS || !parse_term(&p, &pred->terms[pred->n])) {
+            printf(M_ERR_PURGE_PRED, text);
+            return EXIT_FAIL_ARGS;
+        }
+        pred->n++;
+        if (*p == '\0')
+            return NO_ERROR;
+        p++;    //the comma
+    }
+}
+
+static bool term_match(const purge_term_t *term, const student_t *s) {
+    int cmp;
+
+    switch (term->field) {
+        case PURGE_ID:
+            cmp = (s->id > term->value) - (s->id < term->value);
+            break;
+        case PURGE_GPA:
+            cmp = (s->gpa > term->value) - (s->gpa < term->value);
+            break;
+        case PURGE_FNAME:
+            cmp = strncmp(s->fname, term->name, sizeof(s->fname));
+            break;
+        default:
+            cmp = strncmp(s->lname, term->name, sizeof(s->lname));
+            break;
+    }
+
+    switch (term->op) {
+        case PURGE_EQ:  return cmp == 0;
+        case PURGE_NE:  return cmp != 0;
+        case PURGE_LT:  return cmp < 0;
+        case PURGE_LE:  return cmp <= 0;
+        case PURGE_GT:  return cmp > 0;
+        default:        return cmp >= 0;
+    }
+}
+
+/*
+ *  purge_match
+ *      *pred:  parsed predicate
+ *      *s:     live student
+ *
+ *  returns:  true if every term holds for s
+ */
+bool purge_match(const purge_pred_t *pred, const student_t *s) {
+    for (int i = 0; i < pred->n; i++) {
+        if (!term_match(&pred->terms[i], s))
+            return false;
+    }
+    return true;
+}
+
+/*
+ *  punch_run
+ *      fd:       database file
+ *      *start:   first page of the run of empty pages, -1 if there is none
+ *      end:      file offset the run ends at
+ *      *zeroed:  true if the run has slots this purge zeroed
+ *
+ *  Punches the run and starts a new one.  If the change log cant be
+ *  written the zeroed pages are still dirty in the pager and are written
+ *  and logged like any other page.  If only the punch fails they are
+ *  still written, but their slots are forgotten so the deletes are not
+ *  logged a second time.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void punch_run(int fd, off_t *start, off_t end, bool *zeroed) {
+    //the deletes go to the change log before the pages leave the pager
+    if (*start >= 0 && end > *start && (!*zeroed || cdc_write(fd) == NO_ERROR)) {
+        if (pager_punch(fd, *start, end - *start) != NO_ERROR && *zeroed) {
+            pager_forget_slots(fd, *start, end - *start);
+        }
+        if (*zeroed) {
+            shm_invalidate(fd);
+        }
+    }
+    *start = -1;
+    *zeroed = false;
+}
+
+/*
+ *  purge_db
+ *      fd:     linux file descriptor, locked exclusively
+ *      *pred:  parsed predicate
+ *
+ *  Deletes every student that matches pred in one pass, see purge.h.
+ *
+ *  returns:  <number>       students deleted
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_READ   error reading the database file
+ *            M_ERR_DB_WRITE  error writing the database file
+ */
+int purge_db(int fd, const purge_pred_t *pred) {
+    student_t recs[SCAN_RECS];
+    db_super_t sb;
+    off_t size = pager_size(fd);
+    off_t hole = -1;            //first page of the empty run not punched yet
+    bool hole_zeroed = false;   //the run has slots zeroed by this purge
+    bool begun = false;
+    int deleted = 0;
+    int window = 0;
+
+    if (size == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (off_t off = 0; off < size; off += PAGER_PAGE) {
+        ssize_t bytes_read = pager_read(fd, recs, sizeof(recs), off);
+        if (bytes_read < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+
+        // Slot 0 of the first page is the superblock
+        int first = off == 0 ? 1 : 0;
+        int n = bytes_read / STUDENT_RECORD_SIZE;
+        bool hit[SCAN_RECS] = {false};
+        int hits = 0, live = 0;
+        for (int i = first; i < n; i++) {
+            if (recs[i].id == 0) {
+                continue;
+            }
+            if (purge_match(pred, &recs[i])) {
+                recs[i] = EMPTY_STUDENT_RECORD;
+                hit[i] = true;
+                hits++;
+            } else {
+                live++;
+            }
+        }
+
+        if (hits > 0) {
+            if (!begun && super_begin(fd, &sb) != NO_ERROR) {
+                return ERR_DB_FILE;
+            }
+            begun = true;
+
+            // Only the zeroed slots are written, so only they are logged
+            for (int i = first; i < n; i++) {
+                off_t slot = off + i * STUDENT_RECORD_SIZE;
+                if (!hit[i]) {
+                    continue;
+                }
+                if (pager_write(fd, &recs[i], STUDENT_RECORD_SIZE, slot) != STUDENT_RECORD_SIZE ||
+                    (off > 0 && live == 0 && cdc_add(fd, slot, &recs[i]) != NO_ERROR)) {
+                    printf(M_ERR_DB_WRITE);
+                    return ERR_DB_FILE;
+                }
+            }
+            deleted += hits;
+        }
+
+        if (off > 0 && live == 0) {
+            if (hole < 0) {
+                hole = off;
+            }
+            hole_zeroed |= hits > 0;
+        } else {
+            punch_run(fd, &hole, off, &hole_zeroed);
+        }
+
+        if (++window == PURGE_WINDOW) {
+            punch_run(fd, &hole, off + PAGER_PAGE, &hole_zeroed);
+            if (checkpoint_db(fd) != NO_ERROR) {
+                return ERR_DB_FILE;
+            }
+            window = 0;
+        }
+    }
+    punch_run(fd, &hole, size, &hole_zeroed);
+
+    if (begun) {
+        sb.rec_count -= deleted;
+        if (super_commit(fd, &sb) != NO_ERROR) {
+            return ERR_DB_FILE;
+        }
+    }
+    return deleted;
+}
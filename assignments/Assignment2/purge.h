@@ -0,0 +1,66 @@
+#ifndef __PURGE_H__
+#define __PURGE_H__
+
+#include <stdbool.h>
+
+#include "db.h"     //get student record type
+#include "pager.h"  //get PAGER_FRAMES
+
+//-D deletes every student that matches a predicate in a single pass over
+//the file, instead of one process per id:
+//
+//  predicate:  term[,term...]      every term must hold
+//  term:       field op value
+//  field:      id | gpa | fname | lname
+//  op:         == != < <= > >=     names only take == and !=
+//
+//for example "id<5000", "gpa==0" or "id>=90000,lname==Smith".  The gpa is
+//the 3 digit int -a takes.
+//
+//The file is read a page at a time through the pager and the matching
+//slots are zeroed in the cached page, so every page is written at most
+//once.  Every PURGE_WINDOW pages the window is checkpointed, which writes
+//consecutive dirty pages with one pwritev().  A page that is left without
+//any student is not written at all: runs of them are handed to
+//pager_punch(), which frees their blocks.  That also reclaims pages
+//emptied by earlier -d's.
+//
+//The superblock is marked dirty before the first slot changes and the
+//count is fixed once at the end, so a crash halfway is repaired by
+//load_super() like any other interrupted change.  The whole purge is a
+//single generation, so the trigram index is rebuilt by the next search
+//rather than logging every id.  Punched pages never go through
+//checkpoint_db(), so a shared memory copy is invalidated, see shm.h, and
+//their deletes are appended to the change log before the punch, see cdc.h.
+#define PURGE_MAX_TERMS 8
+#define PURGE_WINDOW    (PAGER_FRAMES / 2)
+
+#define PURGE_ID        1
+#define PURGE_GPA       2
+#define PURGE_FNAME     3
+#define PURGE_LNAME     4
+
+#define PURGE_EQ        1
+#define PURGE_NE        2
+#define PURGE_LT        3
+#define PURGE_LE        4
+#define PURGE_GT        5
+#define PURGE_GE        6
+
+typedef struct purge_term{
+    int field;              //PURGE_ID ... PURGE_LNAME
+    int op;                 //PURGE_EQ ... PURGE_GE
+    int value;              //id and gpa
+    char name[32];          //fname and lname
+} purge_term_t;
+
+typedef struct purge_pred{
+    int n;                  //number of terms, all must hold
+    purge_term_t terms[PURGE_MAX_TERMS];
+} purge_pred_t;
+
+int purge_parse(const char *text, purge_pred_t *pred);
+bool purge_match(const purge_pred_t *pred, const student_t *s);
+int purge_db(int fd, const purge_pred_t *pred);
+
+#endif
@@ -1,714 +1,2129 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <fcntl.h>      //c library for system call file routines
-#include <string.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <stdbool.h>
-
-//database include files
-#include "db.h"
-#include "sdbsc.h"
-
-/*
- *  open_db
- *      dbFile:  name of the database file
- *      should_truncate:  indicates if opening the file also empties it
- * 
- *  returns:  File descriptor on success, or ERR_DB_FILE on failure
- * 
- *  console:  Does not produce any console I/O on success
- *            M_ERR_DB_OPEN on error
- *             
- */
-int open_db(char *dbFile, bool should_truncate) {
-    // Set permissions: rw-rw----
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-
-    // Open the file for read/write and create it if it does not exist
-    int flags = O_RDWR | O_CREAT;
-
-    // If truncation is requested, add the O_TRUNC flag
-    if (should_truncate) {
-        flags |= O_TRUNC;
-    }
-
-    // Attempt to open the file
-    int fd = open(dbFile, flags, mode);
-
-    // If the file cannot be opened, print an error and return failure
-    if (fd == -1) {
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
-    }
-
-    // Return the file descriptor on success
-    return fd;
-}
-
-/*
- *  get_student
- *      fd:  linux file descriptor
- *      id:  the student id we are looking forname of the
- *      *s:  a pointer where the located (if found) student data will be
- *           copied
- * 
- *  returns:  NO_ERROR       student located and copied into *s
- *            ERR_DB_FILE    database file I/O issue
- *            SRCH_NOT_FOUND student was not located in the database
- * 
- *  console:  Does not produce any console I/O used by other functions
- */
-int get_student(int fd, int id, student_t *s) {
-    int offset = id * STUDENT_RECORD_SIZE;
-
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);  // "Error reading DB file, exiting!"
-        return ERR_DB_FILE;
-    }
-
-    // Attempt to read one student record
-    int bytes_read = read(fd, s, STUDENT_RECORD_SIZE);
-
-    if (bytes_read < 0) {
-        // Actual I/O error
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    } else if (bytes_read == 0) {
-        // We are beyond EOF => record not found
-        return SRCH_NOT_FOUND;
-    } else if (bytes_read != STUDENT_RECORD_SIZE) {
-        // A partial read is a real error
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    // If we read the full record, check whether the ID is zero => "empty slot"
-    if (s->id == 0) {
-        return SRCH_NOT_FOUND;
-    }
-
-    return NO_ERROR;
-}
-
-
-/*
- *  add_student
- *      fd:     linux file descriptor
- *      id:     student id (range is defined in db.h )
- *      fname:  student first name
- *      lname:  student last name
- *      gpa:    GPA as an integer (range defined in db.h)
- * 
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty. 
- * 
- *  returns:  NO_ERROR       student added to database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           already exists)  
- * 
- * 
- *  console:  M_STD_ADDED       on success
- *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
- *            M_ERR_DB_WRITE    error writing to db file (adding student)
- *            
- */
-int add_student(int fd, int id, char *fname, char *lname, int gpa) {
-    student_t s;
-    int offset = id * STUDENT_RECORD_SIZE;
-
-    // Position file offset at the correct record
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    // Try reading the existing record (if any)
-    int bytes_read = read(fd, &s, STUDENT_RECORD_SIZE);
-    if (bytes_read < 0) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    } else if (bytes_read == 0) {
-        // This record hasn't been written yet, so treat as empty
-        memset(&s, 0, sizeof(s));
-    } else if (bytes_read != STUDENT_RECORD_SIZE) {
-        // Partial read is an error
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    // Now check if that record is already in use
-    if (s.id != 0) {
-        // The slot is occupied => duplicate student
-        printf(M_ERR_DB_ADD_DUP, id);  // e.g. "Duplicate student ID 99999..."
-        return ERR_DB_OP;
-    }
-
-    // Fill out the new student record
-    memset(&s, 0, sizeof(s));
-    s.id = id;
-    strncpy(s.fname, fname, sizeof(s.fname) - 1);
-    strncpy(s.lname, lname, sizeof(s.lname) - 1);
-    s.gpa = gpa;
-
-    // Write it back to file
-    if (lseek(fd, offset, SEEK_SET) == -1 ||
-        write(fd, &s, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
-        printf(M_ERR_DB_WRITE);  // "Error writing to DB file"
-        return ERR_DB_FILE;
-    }
-
-    printf(M_STD_ADDED, id);  // e.g. "Student 99999 added!"
-    return NO_ERROR;
-}
-
-
-/*
- *  del_student
- *      fd:     linux file descriptor
- *      id:     student id to be deleted
- * 
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at 
- *  that location. 
- * 
- *  returns:  NO_ERROR       student deleted from database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)  
- * 
- * 
- *  console:  M_STD_DEL_MSG      on success
- *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
- *            
- */
-int del_student(int fd, int id) {
-    // We rely on get_student() to do the reading logic
-    student_t s;
-    int rc = get_student(fd, id, &s);
-
-    if (rc == SRCH_NOT_FOUND) {
-        printf(M_STD_NOT_FND_MSG, id);  // "Student ID %d not found..."
-        return ERR_DB_OP;
-    } else if (rc != NO_ERROR) {
-        // Something else went wrong (I/O error, etc.)
-        return rc;
-    }
-
-    // If here, student s is valid; let's overwrite it with empty record
-    int offset = id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1 ||
-        write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
-        printf(M_ERR_DB_WRITE);
-        return ERR_DB_FILE;
-    }
-
-    printf(M_STD_DEL_MSG, id);  // "Student ID %d deleted"
-    return NO_ERROR;
-}
-
-
-/*
- *  count_db_records
- *      fd:     linux file descriptor
- * 
- *  Counts the number of records in the database.  Start by reading the 
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of 
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.  
- * 
- *  returns:  <number>       returns the number of records in db on success
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)  
- * 
- * 
- *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
- *            M_DB_EMPTY       on success if the record count in db is zero
- *            M_ERR_DB_READ    error reading or seeking the database file
- *            M_ERR_DB_WRITE   error writing to db file (adding student)
- *            
- */
-int count_db_records(int fd) {
-    student_t s;
-    int count = 0;
-
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    while (true) {
-        int bytes_read = read(fd, &s, STUDENT_RECORD_SIZE);
-        if (bytes_read < 0) {
-            // Hard I/O error
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-        if (bytes_read == 0) {
-            // End of file
-            break;
-        }
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            // Partial read => error
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-
-        // Now we have a full record in s
-        if (s.id != 0) {
-            count++;
-        }
-    }
-
-    // Print appropriate message
-    if (count == 0) {
-        printf(M_DB_EMPTY);     // "Database contains no student records."
-    } else {
-        printf(M_DB_RECORD_CNT, count);  // e.g. "Database has %d student records."
-    }
-
-    return count;
-}
-
-
-/*
- *  print_db
- *      fd:     linux file descriptor
- * 
- *  Prints all records in the database.  Start by reading the 
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of 
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
- * 
- *     printf(STUDENT_PRINT_HDR_STRING, "ID", 
- *                  "FIRST NAME", "LAST_NAME", "GPA");
- * 
- *  then for each valid record encountered print the required output: 
- * 
- *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, 
- *                    student.lname, calculated_gpa_from_student);
- * 
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
- * 
- *  returns:  NO_ERROR       on success
- *            ERR_DB_FILE    database file I/O issue
- * 
- * 
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_DB_READ    error reading or seeking the database file
- *            
- */
-int print_db(int fd) {
-    student_t s;
-    bool header_printed = false;
-
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    while (true) {
-        int bytes_read = read(fd, &s, STUDENT_RECORD_SIZE);
-        if (bytes_read < 0) {
-            // Hard I/O error
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-        if (bytes_read == 0) {
-            // End of file
-            break;
-        }
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            // Partial read => error
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-
-        // If the record is valid, print it
-        if (s.id != 0) {
-            if (!header_printed) {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
-                header_printed = true;
-            }
-            float gpa = s.gpa / 100.0;
-            printf(STUDENT_PRINT_FMT_STRING, s.id, s.fname, s.lname, gpa);
-        }
-    }
-
-    if (!header_printed) {
-        // No valid records
-        printf(M_DB_EMPTY);
-    }
-
-    return NO_ERROR;
-}
-
-
-/*
- *  print_student
- *      *s:   a pointer to a student_t structure that should
- *            contain a valid student to be printed
- * 
- *  Start by ensuring that provided student pointer is valid.  To do this
- *  make sure it is not NULL and that s->id is not zero.  After ensuring 
- *  that the student is valid, print it the exact way that is described
- *  in the print_db() function by first printing the header then the
- *  student data:
- * 
- *     printf(STUDENT_PRINT_HDR_STRING, "ID", 
- *                  "FIRST NAME", "LAST_NAME", "GPA");
- * 
- *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, 
- *                    student.lname, calculated_gpa_from_s);
- * 
- *  Dont forget that  the GPA in the student structure is an int, to convert 
- *  it into a real gpa divide by 100.0 and store in a float variable. 
- * 
- *  returns:  nothing, this is a void function
- * 
- * 
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_STD_PRINT  if the function argument s is NULL or if
- *                             s->id is zero
- *            
- */
-void print_student(student_t *s) {
-    if (!s || s->id == 0) {
-        printf(M_ERR_STD_PRINT);
-        return;
-    }
-
-    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
-    float gpa = s->gpa / 100.0;
-    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
-}
-
-/*
- *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
- *
- *  compress_db
- *      fd:     linux file descriptor
- * 
- *  This assignment takes advantage of the way Linux handles sparse files
- *  on disk. Thus if there is a large hole between student records, Linux
- *  will not use any physical storage.  However, when a database record is
- *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
- *  db.h - record.  
- * 
- *  Since Linux provides no way to delete data in the middle of a file, and
- *  deleted records take up physical storage, this function will compress the
- *  database by rewriting a new database file that only includes valid student
- *  records. There are a number of ways to do this, but since this is extra credit
- *  you need to figure this out on your own. 
- * 
- *  At a high level create a temporary database file then copy all valid students from
- *  the active database (passed in via fd) to the temporary file. When this is done
- *  rename the temporary database file to the name of the real database file. See
- *  the constants in db.h for required file names:
- *
- *         #define DB_FILE     "student.db"        //name of database file
- *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit 
- * 
- *  Note that you are passed in the fd of the database file to be compressed, 
- *  it is very likely you will need to close it to overwrite it with the
- *  compressed version of the file.  To ensure the caller can work with the
- *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
- * 
- *  returns:  <number>       returns the fd of the compressed database file
- *            ERR_DB_FILE    database file I/O issue
- * 
- * 
- *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
- *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
- *                             this error should also be returned after you
- *                             compressed the database file and if you are unable
- *                             to open it to pass the fd back to the caller
- *            M_ERR_DB_CREATE  error creating the db file. For instance the
- *                             inability to copy the temporary file back as
- *                             the primary database file. 
- *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
- *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
- *            
- */
-int compress_db(int fd) {
-    int new_fd = open_db(TMP_DB_FILE, true);
-
-    if (new_fd == ERR_DB_FILE) {
-        printf(M_ERR_DB_CREATE);
-        return ERR_DB_FILE;
-    }
-
-    student_t s;
-
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    while (read(fd, &s, STUDENT_RECORD_SIZE) == STUDENT_RECORD_SIZE) {
-        if (s.id != 0) {
-            if (write(new_fd, &s, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
-                printf(M_ERR_DB_WRITE);
-                close(new_fd);
-                return ERR_DB_FILE;
-            }
-        }
-    }
-
-    close(fd);
-    if (rename(TMP_DB_FILE, DB_FILE) != 0) {
-        printf(M_ERR_DB_CREATE);
-        return ERR_DB_FILE;
-    }
-
-    printf(M_DB_COMPRESSED_OK);
-    return open_db(DB_FILE, false);
-}
-
-
-/*
- *  validate_range
- *      id:  proposed student id
- *      gpa: proposed gpa
- * 
- *  This function validates that the id and gpa are in the allowable ranges
- *  as per the specifications.  It checks if the values are within the
- *  inclusive range using constents in db.h
- * 
- *  returns:    NO_ERROR       on success, both ID and GPA are in range
- *              EXIT_FAIL_ARGS if either ID or GPA is out of range
- * 
- *  console:  This function does not produce any output
- *            
- */
-int validate_range(int id, int gpa){
-
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
-        return EXIT_FAIL_ARGS;
-
-    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
-        return EXIT_FAIL_ARGS;
-
-    return NO_ERROR;
-}
-
-/*
- *  usage
- *      exename:  the name of the executable from argv[0]
- * 
- *  Prints this programs expected usage
- * 
- *  returns:    nothing, this is a void function
- * 
- *  console:  This function prints the usage information
- *            
- */
-void usage(char *exename){
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
-    printf("\t-h:  prints help\n");
-    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
-    printf("\t-c:  counts the records in the database\n");
-    printf("\t-d id:  deletes a student\n");
-    printf("\t-f id:  finds and prints a student in the database\n");
-    printf("\t-p:  prints all records in the student database\n");
-    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
-    printf("\t-z:  zero db file (remove all records)\n");
-}
-
-
-//Welcome to main()
-int main(int argc, char *argv[]){
-    char opt;           //user selected option
-    int fd;             //file descriptor of database files
-    int rc;             //return code from various operations
-    int exit_code;      //exit code to shell
-    int id;             //userid from argv[2]
-    int gpa;            //gpa from argv[5]
-
-    //space for a student structure which we will get back from
-    //some of the functions we will be writing such as get_student(),
-    //and print_student(). 
-    student_t student = {0};
-
-    //This function must have at least one arg, and the arg must start
-    //with a dash
-    if ((argc < 2) || (*argv[1] != '-')){
-        usage(argv[0]);
-        exit(1);
-    }
-
-    //The option is the first character after the dash for example
-    //-h -a -c -d -f -p -x -z
-    opt = (char)*(argv[1]+1);   //get the option flag
-
-    //handle the help flag and then exit normally
-    if (opt == 'h'){
-        usage(argv[0]);
-        exit(EXIT_OK);
-    }
-
-    //now lets open the file and continue if there is no error
-    //note we are not truncating the file using the second
-    //parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0){
-        exit(EXIT_FAIL_DB);
-    }
-
-    //set rc to the return code of the operation to ensure the program
-    //use that to determine the proper exit_code.  Look at the header
-    //sdbsc.h for expected values. 
-
-    exit_code = EXIT_OK;
-    switch(opt){
-        case 'a':
-            //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]         
-            //prog_name     -a      id  first_name last_name     gpa
-            //-------------------------------------------------------
-            //example:  prog_name -a 1 John Doe 341
-            if (argc != 6){
-                usage(argv[0]);
-                exit_code = EXIT_FAIL_ARGS;
-                break;
-            }
-
-            //convert id and gpa to ints from argv.  For this assignment assume
-            //they are valid numbers
-            id = atoi(argv[2]);
-            gpa = atoi(argv[5]);
-
-            exit_code = validate_range(id,gpa);
-            if (exit_code == EXIT_FAIL_ARGS){
-                printf(M_ERR_STD_RNG);
-                break;
-            }
-
-            rc = add_student(fd, id, argv[3], argv[4], gpa);
-            if (rc < 0)
-                exit_code = EXIT_FAIL_DB;
-
-            break;
-
-        case 'c':
-            //    arv[0] arv[1]    
-            //prog_name     -c 
-            //-----------------
-            //example:  prog_name -c  
-            rc = count_db_records(fd);
-            if (rc < 0)
-                exit_code = EXIT_FAIL_DB;
-            break;
-
-        case 'd':
-            //   arv[0]  arv[1]  arv[2]    
-            //prog_name     -d      id 
-            //-------------------------
-            //example:  prog_name -d 100    
-            if (argc != 3){
-                usage(argv[0]);
-                exit_code = EXIT_FAIL_ARGS;
-                break;
-            }
-            id = atoi(argv[2]);
-            rc = del_student(fd, id);
-            if (rc < 0)
-                exit_code = EXIT_FAIL_DB;
-
-            break;
-
-        case 'f':
-            //    arv[0] arv[1]  arv[2]    
-            //prog_name     -f      id
-            //-------------------------
-            //example:  prog_name -f 100       
-            if (argc != 3){
-                usage(argv[0]);
-                exit_code = EXIT_FAIL_ARGS;
-                break;
-            }
-            id = atoi(argv[2]);
-            rc = get_student(fd, id, &student);
-
-           
-            switch (rc){
-                case NO_ERROR:
-                    print_student(&student);
-                    break;
-                case SRCH_NOT_FOUND:
-                    printf(M_STD_NOT_FND_MSG, id);
-                    exit_code = EXIT_FAIL_DB;
-                    break;
-                default:
-                    printf(M_ERR_DB_READ);
-                    exit_code = EXIT_FAIL_DB;
-                    break;
-            }
-            break;
-
-        case 'p':
-            //    arv[0] arv[1]    
-            //prog_name     -p 
-            //-----------------
-            //example:  prog_name -p  
-            rc = print_db(fd);
-            if (rc < 0)
-                exit_code = EXIT_FAIL_DB;
-            break;
-
-        case 'x':
-            //    arv[0] arv[1]    
-            //prog_name     -x 
-            //-----------------
-            //example:  prog_name -x 
-
-            //remember compress_db returns a fd of the compressed database.
-            //we close it after this switch statement 
-            fd = compress_db(fd);
-            if (fd < 0)
-                exit_code = EXIT_FAIL_DB;
-            break;
-
-        case 'z':
-            //    arv[0] arv[1]    
-            //prog_name     -x 
-            //-----------------
-            //example:  prog_name -x 
-            //HINT:  close the db file, we already have fd 
-            //       and reopen db indicating truncate=true
-            close(fd);
-            fd = open_db(DB_FILE, true);
-            if (fd < 0){
-                exit_code = EXIT_FAIL_DB;
-                break;
-            }
-            printf(M_DB_ZERO_OK);
-            exit_code = EXIT_OK;
-            break;
-        default:
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-    }
-
-    //dont forget to close the file before exiting, and setting the 
-    //proper exit code - see the header file for expected values
-    close(fd);
-    exit(exit_code);
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>      //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "pager.h"
+#include "txn.h"
+#include "shm.h"
+#include "cdc.h"
+#include "purge.h"
+#include "sst.h"
+#include "sort.h"
+#include "trigram.h"
+#include "shard.h"
+#include "backup.h"
+
+//file each descriptor returned by open_db() was opened from, see db_name()
+#define DB_MAX_FDS  1024
+static char *db_names[DB_MAX_FDS];
+
+//set by super_begin() once the superblock on disk is marked dirty, until
+//checkpoint_db() writes the clean one
+static bool super_on_disk_dirty[DB_MAX_FDS];
+
+/*
+ *  open_db
+ *      dbFile:  name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ * 
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ * 
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *             
+ */
+int open_db(char *dbFile, bool should_truncate) {
+    // Set permissions: rw-rw----
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    // Open the file for read/write and create it if it does not exist
+    int flags = O_RDWR | O_CREAT;
+
+    // If truncation is requested, add the O_TRUNC flag
+    if (should_truncate) {
+        flags |= O_TRUNC;
+    }
+
+    // Attempt to open the file
+    int fd = open(dbFile, flags, mode);
+
+    // If the file cannot be opened, print an error and return failure
+    if (fd == -1) {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    // Make sure the superblock in slot 0 is valid before anyone uses it
+    db_super_t sb;
+    pager_drop(fd);
+    if (fd < DB_MAX_FDS) {
+        super_on_disk_dirty[fd] = false;
+    }
+    if (load_super(fd, &sb) != NO_ERROR) {
+        pager_drop(fd);
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    // Remember the file name so files kept next to the database can be found
+    db_set_name(fd, dbFile);
+
+    // Return the file descriptor on success
+    return fd;
+}
+
+/*
+ *  db_set_name
+ *      fd:      linux file descriptor returned by open_db()
+ *      dbFile:  name the file now has
+ *
+ *  Remembers the name of the database file fd is open on, for a file that
+ *  was renamed after it was opened.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void db_set_name(int fd, const char *dbFile) {
+    if (fd >= 0 && fd < DB_MAX_FDS) {
+        free(db_names[fd]);
+        db_names[fd] = strdup(dbFile);
+    }
+}
+
+/*
+ *  db_name
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  returns:  the name of the database file fd was opened from, DB_FILE if
+ *            fd did not come from open_db()
+ */
+const char *db_name(int fd) {
+    if (fd >= 0 && fd < DB_MAX_FDS && db_names[fd])
+        return db_names[fd];
+    return DB_FILE;
+}
+
+/*
+ *  db_sidecar
+ *      fd:    linux file descriptor returned by open_db()
+ *      ext:   extension of the sidecar file, for example ".tri"
+ *      tmp:   true for the temporary name used while rewriting it
+ *      *out:  where the file name is written
+ *      sz:    size of out
+ *
+ *  Names a file that lives next to the database: the database name with
+ *  its ".db" extension replaced by ext, and with ".tmp_" in front of the
+ *  base name when tmp is set.  For the default database this gives
+ *  "student.tri" and ".tmp_student.db" (TMP_DB_FILE).
+ *
+ *  returns:  out
+ */
+char *db_sidecar(int fd, const char *ext, bool tmp, char *out, size_t sz) {
+    return db_path_sidecar(db_name(fd), ext, tmp, out, sz);
+}
+
+/*
+ *  db_path_sidecar
+ *      name:  name of the database file
+ *      ext, tmp, *out, sz:  as for db_sidecar()
+ *
+ *  db_sidecar() for a database that is not open.
+ *
+ *  returns:  out
+ */
+char *db_path_sidecar(const char *name, const char *ext, bool tmp, char *out, size_t sz) {
+    const char *base = strrchr(name, '/');
+    int dir_len = base ? base - name + 1 : 0;
+    int base_len = strlen(name + dir_len);
+
+    if (base_len > 3 && strcmp(name + dir_len + base_len - 3, ".db") == 0)
+        base_len -= 3;
+    snprintf(out, sz, "%.*s%s%.*s%s", dir_len, name, tmp ? ".tmp_" : "",
+             base_len, name + dir_len, ext);
+    return out;
+}
+
+//slots changed since the last checkpoint, see checkpoint_db()
+typedef struct changed_slot{
+    off_t off;
+    char data[PAGER_SLOT];
+} changed_slot_t;
+
+typedef struct changed{
+    changed_slot_t *slots;
+    int n;
+    int cap;
+} changed_t;
+
+//pager_collect() callback for checkpoint_db()
+static int collect_changed(off_t off, const void *slot, void *arg) {
+    changed_t *c = arg;
+
+    if (c->n == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 64;
+        changed_slot_t *grown = realloc(c->slots, cap * sizeof(*grown));
+        if (grown == NULL) {
+            return ERR_DB_FILE;
+        }
+        c->slots = grown;
+        c->cap = cap;
+    }
+    c->slots[c->n].off = off;
+    memcpy(c->slots[c->n].data, slot, PAGER_SLOT);
+    c->n++;
+    return NO_ERROR;
+}
+
+/*
+ *  checkpoint_db
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  Writes every page changed since the last checkpoint back to the file,
+ *  the superblock last, see pager.h.  If the database has a change log the
+ *  changed slots are appended to it first, see cdc.h, and if it has a
+ *  shared memory copy they are published to it afterwards, see shm.h.
+ *
+ *  returns:  NO_ERROR       file is up to date
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_WRITE  error writing the database file
+ */
+int checkpoint_db(int fd) {
+    changed_t changed = {0};
+
+    if (!pager_dirty(fd)) {
+        return NO_ERROR;
+    }
+    if ((shm_attached(fd) || cdc_attached(fd)) &&
+        pager_collect(fd, collect_changed, &changed) != NO_ERROR) {
+        //cant tell what changed, readers go back to the file
+        shm_invalidate(fd);
+        cdc_reset(fd);
+        changed.n = 0;
+    }
+
+    //the change log goes first, see cdc.h
+    for (int i = 0; i < changed.n; i++) {
+        if (cdc_add(fd, changed.slots[i].off, changed.slots[i].data) != NO_ERROR) {
+            cdc_reset(fd);
+            break;
+        }
+    }
+    if (cdc_write(fd) != NO_ERROR) {
+        free(changed.slots);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    if (pager_flush(fd) != NO_ERROR) {
+        free(changed.slots);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    if (fd < DB_MAX_FDS) {
+        super_on_disk_dirty[fd] = false;
+    }
+
+    //records first, then the count in slot 0
+    for (int i = changed.n - 1; i >= 0; i--) {
+        shm_publish(fd, changed.slots[i].off, changed.slots[i].data);
+    }
+    free(changed.slots);
+    return NO_ERROR;
+}
+
+/*
+ *  close_db
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  Checkpoints and closes the database, and drops its cached pages.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, see checkpoint_db()
+ */
+int close_db(int fd) {
+    int rc = checkpoint_db(fd);
+
+    shm_detach(fd);
+    cdc_detach(fd);
+    pager_drop(fd);
+    close(fd);
+    return rc;
+}
+
+/*
+ *  super_checksum
+ *      *sb:  superblock to checksum
+ *
+ *  FNV-1a over the superblock with the checksum field treated as zero.
+ *
+ *  returns:  the checksum
+ */
+static unsigned int super_checksum(const db_super_t *sb) {
+    db_super_t tmp = *sb;
+    const unsigned char *p = (const unsigned char *)&tmp;
+    unsigned int h = 2166136261u;
+
+    tmp.checksum = 0;
+    for (size_t i = 0; i < sizeof(tmp); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ *  super_check
+ *      *sb:  superblock read from slot 0
+ *
+ *  returns:  true if the magic, version and checksum are right, the dirty
+ *            flag and the counts are not checked
+ */
+bool super_check(const db_super_t *sb) {
+    return sb->magic == SUPER_MAGIC && sb->version == SUPER_VERSION &&
+           sb->checksum == super_checksum(sb);
+}
+
+/*
+ *  super_epoch
+ *
+ *  Picks a new epoch for a superblock whose generation count starts over
+ *  or can no longer be trusted, so anything that remembered the old
+ *  generation (like the trigram index) sees a mismatch.
+ *
+ *  returns:  a new, non zero epoch
+ */
+unsigned int super_epoch(void) {
+    struct timespec ts;
+    unsigned int epoch;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    epoch = (unsigned int)ts.tv_sec * 2654435761u ^ (unsigned int)ts.tv_nsec ^
+            ((unsigned int)getpid() << 16);
+    return epoch ? epoch : 1;
+}
+
+/*
+ *  read_super
+ *      fd:   linux file descriptor
+ *      *sb:  where the superblock read from slot 0 is copied
+ *
+ *  Reads the raw superblock, it does not validate it.  A file that is
+ *  shorter than one slot reads back as an all zero superblock.
+ *
+ *  returns:  NO_ERROR       superblock copied into *sb
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ */
+int read_super(int fd, db_super_t *sb) {
+    ssize_t bytes_read = pager_read(fd, sb, sizeof(*sb), SUPER_SLOT);
+
+    if (bytes_read < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (bytes_read != (ssize_t)sizeof(*sb)) {
+        memset(sb, 0, sizeof(*sb));
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  write_super
+ *      fd:   linux file descriptor
+ *      *sb:  superblock to store in slot 0
+ *
+ *  Stamps the magic, version and checksum and writes the superblock.  A
+ *  64 byte write to the start of the file never straddles a page, so the
+ *  superblock is either the old or the new version after a crash.
+ *
+ *  returns:  NO_ERROR       superblock written
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_WRITE  error writing the database file
+ */
+int write_super(int fd, db_super_t *sb) {
+    sb->magic = SUPER_MAGIC;
+    sb->version = SUPER_VERSION;
+    sb->checksum = super_checksum(sb);
+
+    if (pager_write(fd, sb, sizeof(*sb), SUPER_SLOT) != (ssize_t)sizeof(*sb)) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  rebuild_super
+ *      fd:   linux file descriptor
+ *      *sb:  where the rebuilt superblock is copied
+ *
+ *  Recomputes the superblock the slow way by scanning every slot after
+ *  slot 0, then writes it back clean.  Used when the stored superblock is
+ *  missing, corrupt, left dirty by a crash or disagrees with the file size.
+ *  The shard stamp is kept from the old superblock if its magic and
+ *  version are still there.  Otherwise a file that holds students gets
+ *  SUPER_NO_LAYOUT, so shard_stamp() does not take it for a new shard.
+ *
+ *  returns:  NO_ERROR       superblock rebuilt and written
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_READ   error reading the database file
+ *            M_ERR_DB_WRITE  error writing the database file
+ */
+int rebuild_super(int fd, db_super_t *sb) {
+    student_t recs[64];
+    off_t offset = STUDENT_RECORD_SIZE;
+    off_t size = pager_size(fd);
+
+    if (size == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // Whatever went wrong may also have left the shared copy and the
+    // change log behind
+    shm_invalidate(fd);
+    cdc_reset(fd);
+
+    db_super_t old;
+    if (read_super(fd, &old) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    bool has_layout = old.magic == SUPER_MAGIC && old.version == SUPER_VERSION;
+
+    memset(sb, 0, sizeof(*sb));
+    sb->epoch = super_epoch();
+    if (has_layout) {
+        sb->flags = old.flags & SUPER_NO_LAYOUT;
+        sb->shard_id = old.shard_id;
+        sb->shard_count = old.shard_count;
+        sb->shard_mode = old.shard_mode;
+    }
+    while (true) {
+        ssize_t bytes_read = pager_read(fd, recs, sizeof(recs), offset);
+        if (bytes_read < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+
+        int n = bytes_read / STUDENT_RECORD_SIZE;
+        for (int i = 0; i < n; i++) {
+            if (recs[i].id != 0) {
+                sb->rec_count++;
+            }
+        }
+        offset += bytes_read;
+    }
+
+    if (size > STUDENT_RECORD_SIZE) {
+        sb->max_id = (size - 1) / STUDENT_RECORD_SIZE;
+    }
+    if (!has_layout && sb->rec_count > 0) {
+        sb->flags |= SUPER_NO_LAYOUT;
+    }
+    return write_super(fd, sb);
+}
+
+/*
+ *  load_super
+ *      fd:   linux file descriptor
+ *      *sb:  where the validated superblock is copied
+ *
+ *  Reads the superblock and checks it against the file.  A new, empty file
+ *  gets a fresh superblock.  If the magic, version or checksum are wrong,
+ *  the dirty flag is still set, or the file size does not match max_id the
+ *  superblock is rebuilt with rebuild_super().
+ *
+ *  returns:  NO_ERROR       valid superblock copied into *sb
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O on success
+ */
+int load_super(int fd, db_super_t *sb) {
+    off_t size = pager_size(fd);
+
+    if (size == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (size == 0) {
+        memset(sb, 0, sizeof(*sb));
+        sb->epoch = super_epoch();
+        return write_super(fd, sb);
+    }
+
+    if (read_super(fd, sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    if (!super_check(sb) || (sb->flags & SUPER_DIRTY) ||
+        size != (off_t)(sb->max_id + 1) * STUDENT_RECORD_SIZE) {
+        return rebuild_super(fd, sb);
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  super_begin
+ *      fd:   linux file descriptor
+ *      *sb:  receives the current superblock
+ *
+ *  First half of a superblock update.  The superblock is written back with
+ *  SUPER_DIRTY set before the caller touches any student slot, so a crash
+ *  before super_commit() is detected by load_super() and repaired.  The
+ *  pager may write the changed record pages back at any time, so the dirty
+ *  superblock goes straight to the file, once per checkpoint.  Inside a
+ *  transaction nothing is written back before the redo log, which already
+ *  covers a crash, so the extra write is skipped.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int super_begin(int fd, db_super_t *sb) {
+    if (read_super(fd, sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    sb->flags |= SUPER_DIRTY;
+    if (write_super(fd, sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    if (!txn_active(fd) && (fd >= DB_MAX_FDS || !super_on_disk_dirty[fd])) {
+        if (pager_write_through(fd, sb, sizeof(*sb), SUPER_SLOT) != (ssize_t)sizeof(*sb)) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+        if (fd < DB_MAX_FDS) {
+            super_on_disk_dirty[fd] = true;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  super_commit
+ *      fd:   linux file descriptor
+ *      *sb:  superblock with the updated count and max_id
+ *
+ *  Second half of a superblock update, clears SUPER_DIRTY and bumps the
+ *  generation.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int super_commit(int fd, db_super_t *sb) {
+    sb->flags &= ~SUPER_DIRTY;
+    sb->generation++;
+    return write_super(fd, sb);
+}
+
+/*
+ *  note_change
+ *      fd, sb, id, op:  the arguments for tri_note()
+ *
+ *  Logs a change for the trigram index, or keeps it back until the open
+ *  transaction is applied.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void note_change(int fd, db_super_t *sb, int id, int op) {
+    if (txn_active(fd)) {
+        txn_defer_note(fd, sb, id, op);
+    } else {
+        tri_note(fd, sb, id, op);
+    }
+}
+
+/*
+ *  get_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking forname of the
+ *      *s:  a pointer where the located (if found) student data will be
+ *           copied
+ * 
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ * 
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student(int fd, int id, student_t *s) {
+    int offset = id * STUDENT_RECORD_SIZE;
+
+    // Slot 0 holds the superblock, not a student
+    if (id < MIN_STD_ID) {
+        return SRCH_NOT_FOUND;
+    }
+
+    // Attempt to read one student record, from the page cache if the page
+    // was used before
+    int bytes_read = pager_read(fd, s, STUDENT_RECORD_SIZE, offset);
+
+    if (bytes_read < 0) {
+        // Actual I/O error
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    } else if (bytes_read == 0) {
+        // We are beyond EOF => record not found
+        return SRCH_NOT_FOUND;
+    } else if (bytes_read != STUDENT_RECORD_SIZE) {
+        // A partial read is a real error
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // If we read the full record, check whether the ID is zero => "empty slot"
+    if (s->id == 0) {
+        return SRCH_NOT_FOUND;
+    }
+
+    return NO_ERROR;
+}
+
+
+/*
+ *  add_student
+ *      fd:     linux file descriptor
+ *      id:     student id (range is defined in db.h )
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ * 
+ *  Adds a new student to the database.  After calculating the index for the
+ *  student, check if there is another student already at that location.  A good
+ *  way is to use something like memcmp() to ensure that the location for this
+ *  student contains all zero byes indicating the space is empty. 
+ * 
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           already exists)  
+ * 
+ * 
+ *  console:  M_STD_ADDED       on success
+ *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_DB_READ     error reading or seeking the database file
+ *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *            
+ */
+int add_student(int fd, int id, char *fname, char *lname, int gpa) {
+    student_t s;
+    int offset = id * STUDENT_RECORD_SIZE;
+
+    // Try reading the existing record (if any)
+    int bytes_read = pager_read(fd, &s, STUDENT_RECORD_SIZE, offset);
+    if (bytes_read < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    } else if (bytes_read == 0) {
+        // This record hasn't been written yet, so treat as empty
+        memset(&s, 0, sizeof(s));
+    } else if (bytes_read != STUDENT_RECORD_SIZE) {
+        // Partial read is an error
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // Now check if that record is already in use
+    if (s.id != 0) {
+        // The slot is occupied => duplicate student
+        printf(M_ERR_DB_ADD_DUP, id);  // e.g. "Duplicate student ID 99999..."
+        return ERR_DB_OP;
+    }
+
+    // Fill out the new student record
+    memset(&s, 0, sizeof(s));
+    s.id = id;
+    strncpy(s.fname, fname, sizeof(s.fname) - 1);
+    strncpy(s.lname, lname, sizeof(s.lname) - 1);
+    s.gpa = gpa;
+
+    db_super_t sb;
+    if (super_begin(fd, &sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    // Write it to the cached page, checkpoint_db() writes it to the file
+    if (pager_write(fd, &s, STUDENT_RECORD_SIZE, offset) != STUDENT_RECORD_SIZE) {
+        printf(M_ERR_DB_WRITE);  // "Error writing to DB file"
+        return ERR_DB_FILE;
+    }
+
+    sb.rec_count++;
+    if (id > sb.max_id) {
+        sb.max_id = id;
+    }
+    if (super_commit(fd, &sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    note_change(fd, &sb, id, TRI_OP_ADD);
+
+    printf(M_STD_ADDED, id);  // e.g. "Student 99999 added!"
+    return NO_ERROR;
+}
+
+
+/*
+ *  del_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ * 
+ *  Removes a student to the database.  Use the get_student() function to
+ *  locate the student to be deleted. If there is a student at that location
+ *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at 
+ *  that location. 
+ * 
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)  
+ * 
+ * 
+ *  console:  M_STD_DEL_MSG      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
+ *            M_ERR_DB_READ      error reading or seeking the database file
+ *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *            
+ */
+int del_student(int fd, int id) {
+    // We rely on get_student() to do the reading logic
+    student_t s;
+    int rc = get_student(fd, id, &s);
+
+    if (rc == SRCH_NOT_FOUND) {
+        printf(M_STD_NOT_FND_MSG, id);  // "Student ID %d not found..."
+        return ERR_DB_OP;
+    } else if (rc != NO_ERROR) {
+        // Something else went wrong (I/O error, etc.)
+        return rc;
+    }
+
+    db_super_t sb;
+    if (super_begin(fd, &sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    // If here, student s is valid; let's overwrite it with empty record
+    int offset = id * STUDENT_RECORD_SIZE;
+    if (pager_write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE, offset) != STUDENT_RECORD_SIZE) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    sb.rec_count--;
+    if (super_commit(fd, &sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+    note_change(fd, &sb, id, TRI_OP_DEL);
+
+    printf(M_STD_DEL_MSG, id);  // "Student ID %d deleted"
+    return NO_ERROR;
+}
+
+
+/*
+ *  count_db_records
+ *      fd:     linux file descriptor
+ * 
+ *  Counts the number of records in the database.  The count is not found
+ *  by scanning the file, it is kept up to date in the superblock (slot 0)
+ *  by add_student(), del_student() and compress_db(), and open_db() has
+ *  already validated it against the file.  So this is a single 64 byte
+ *  read no matter how large the database is.
+ * 
+ *  returns:  <number>       returns the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ * 
+ * 
+ *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
+ *            M_DB_EMPTY       on success if the record count in db is zero
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *            
+ */
+int count_db_records(int fd) {
+    db_super_t sb;
+
+    if (read_super(fd, &sb) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    int count = sb.rec_count;
+
+    // Print appropriate message
+    if (count == 0) {
+        printf(M_DB_EMPTY);     // "Database contains no student records."
+    } else {
+        printf(M_DB_RECORD_CNT, count);  // e.g. "Database has %d student records."
+    }
+
+    return count;
+}
+
+
+//scan_db() callback for print_db(), *arg is set once the header is out
+static int print_one(student_t *s, void *arg) {
+    bool *header_printed = arg;
+
+    if (!*header_printed) {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        *header_printed = true;
+    }
+    float gpa = s->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
+    return NO_ERROR;
+}
+
+/*
+ *  print_db
+ *      fd:     linux file descriptor
+ * 
+ *  Prints all records in the database.  Start by reading the 
+ *  database at the beginning, and continue reading individual records
+ *  until you it EOF.  EOF is when the read() syscall returns 0. Check
+ *  if a slot is empty or previously deleted by investigating if all of 
+ *  the bytes in the record read are zeros - I would suggest using memory
+ *  compare memcmp() for this. Be careful as the database might be empty.
+ *  on the first real row encountered print the header for the required output:
+ * 
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID", 
+ *                  "FIRST NAME", "LAST_NAME", "GPA");
+ * 
+ *  then for each valid record encountered print the required output: 
+ * 
+ *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, 
+ *                    student.lname, calculated_gpa_from_student);
+ * 
+ *  The code above assumes you are reading student records into a local
+ *  variable named student that is of type student_t. Also dont forget that
+ *  the GPA in the student structure is an int, to convert it into a real
+ *  gpa divide by 100.0 and store in a float variable.
+ * 
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ * 
+ * 
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *            
+ */
+int print_db(int fd) {
+    bool header_printed = false;
+
+    // Skip the superblock in slot 0, scan_db() starts at slot 1
+    if (scan_db(fd, print_one, &header_printed) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    if (!header_printed) {
+        // No valid records
+        printf(M_DB_EMPTY);
+    }
+
+    return NO_ERROR;
+}
+
+
+/*
+ *  scan_mapped
+ *      fd:  linux file descriptor
+ *
+ *  Picks how scan_db() reads fd, see SCAN_ENV in db.h.  A file with pages
+ *  the pager has not written back is always read through the pager.
+ *
+ *  returns:  true to map the file
+ */
+static bool scan_mapped(int fd) {
+    const char *mode = getenv(SCAN_ENV);
+
+    if (pager_dirty(fd) || (mode && strcmp(mode, "read") == 0)) {
+        return false;
+    }
+    if (mode && strcmp(mode, "mmap") == 0) {
+        return true;
+    }
+    return pager_size(fd) >= SCAN_MMAP_MIN;
+}
+
+/*
+ *  scan_map
+ *      fd, fn, arg:  as for scan_db()
+ *      *mapped:      set to false if the file could not be mapped, fn was
+ *                    not called and the caller should read it instead
+ *
+ *  Maps the whole file read only and walks the slots in place.  The kernel
+ *  is told the mapping is read front to back, and asked for huge pages so
+ *  a large table needs fewer TLB entries.  Either hint may be refused,
+ *  which only costs speed.  Empty slots are skipped by looking at the id
+ *  alone, so the loop prefetches the cache line SCAN_PREFETCH records
+ *  ahead.
+ *
+ *  returns:  the same as scan_db()
+ */
+static int scan_map(int fd, scan_fn fn, void *arg, bool *mapped) {
+    off_t size = pager_size(fd);
+    int rc = NO_ERROR;
+
+    *mapped = size >= 0;
+    if (size <= STUDENT_RECORD_SIZE) {
+        return NO_ERROR;
+    }
+    student_t *map = tr_mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        *mapped = false;
+        return NO_ERROR;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+    int n = size / STUDENT_RECORD_SIZE;
+    for (int i = 1; i < n && rc == NO_ERROR; i++) {
+        if (i + SCAN_PREFETCH < n) {
+            __builtin_prefetch(&map[i + SCAN_PREFETCH], 0, 0);
+        }
+        if (map[i].id != 0) {
+            rc = fn(&map[i], arg);
+        }
+    }
+    tr_munmap(map, size);
+    return rc;
+}
+
+/*
+ *  scan_db
+ *      fd:    linux file descriptor
+ *      fn:    function called with every live student
+ *      arg:   passed through to fn
+ *
+ *  Reads every slot after the superblock, SCAN_RECS records per read()
+ *  instead of one, and calls fn for each live student in id order.  Large
+ *  files are mapped instead, see scan_map().  The student passed to fn is
+ *  only valid during the call.
+ *
+ *  returns:  NO_ERROR       every student was visited
+ *            ERR_DB_FILE    database file I/O issue
+ *            <number>       the non-zero value fn returned to stop the scan
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ */
+int scan_db(int fd, scan_fn fn, void *arg) {
+    student_t recs[SCAN_RECS];
+    off_t offset = STUDENT_RECORD_SIZE;
+    uint64_t t = tr_start();
+    bool mapped = false;
+    int rc = NO_ERROR;
+
+    if (scan_mapped(fd)) {
+        rc = scan_map(fd, fn, arg, &mapped);
+        if (mapped) {
+            tr_stop(TR_SCAN, t);
+            return rc;
+        }
+    }
+
+    // Pages the pager misses come in one at a time, ask for bigger
+    // readahead
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (rc == NO_ERROR) {
+        ssize_t bytes_read = pager_read(fd, recs, sizeof(recs), offset);
+        if (bytes_read < 0) {
+            printf(M_ERR_DB_READ);
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        offset += bytes_read;
+
+        int n = bytes_read / STUDENT_RECORD_SIZE;
+        for (int i = 0; i < n && rc == NO_ERROR; i++) {
+            if (recs[i].id != 0) {
+                rc = fn(&recs[i], arg);
+            }
+        }
+    }
+
+    tr_stop(TR_SCAN, t);
+    return rc;
+}
+
+/*
+ *  print_students
+ *      *recs:  students to print
+ *      n:      number of students, must be at least 1
+ *
+ *  Prints the header and then each student in the same format as
+ *  print_db().
+ *
+ *  returns:  nothing, this is a void function
+ */
+void print_students(student_t *recs, int n) {
+    uint64_t t = tr_start();
+
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    for (int i = 0; i < n; i++) {
+        float gpa = recs[i].gpa / 100.0;
+        printf(STUDENT_PRINT_FMT_STRING, recs[i].id, recs[i].fname, recs[i].lname, gpa);
+    }
+    tr_stop(TR_FORMAT, t);
+}
+
+/*
+ *  print_student
+ *      *s:   a pointer to a student_t structure that should
+ *            contain a valid student to be printed
+ * 
+ *  Start by ensuring that provided student pointer is valid.  To do this
+ *  make sure it is not NULL and that s->id is not zero.  After ensuring 
+ *  that the student is valid, print it the exact way that is described
+ *  in the print_db() function by first printing the header then the
+ *  student data:
+ * 
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID", 
+ *                  "FIRST NAME", "LAST_NAME", "GPA");
+ * 
+ *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, 
+ *                    student.lname, calculated_gpa_from_s);
+ * 
+ *  Dont forget that  the GPA in the student structure is an int, to convert 
+ *  it into a real gpa divide by 100.0 and store in a float variable. 
+ * 
+ *  returns:  nothing, this is a void function
+ * 
+ * 
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_STD_PRINT  if the function argument s is NULL or if
+ *                             s->id is zero
+ *            
+ */
+void print_student(student_t *s) {
+    if (!s || s->id == 0) {
+        printf(M_ERR_STD_PRINT);
+        return;
+    }
+
+    uint64_t t = tr_start();
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    float gpa = s->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
+    tr_stop(TR_FORMAT, t);
+}
+
+/*
+ *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *
+ *  compress_db
+ *      fd:     linux file descriptor
+ * 
+ *  This assignment takes advantage of the way Linux handles sparse files
+ *  on disk. Thus if there is a large hole between student records, Linux
+ *  will not use any physical storage.  However, when a database record is
+ *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
+ *  db.h - record.  
+ * 
+ *  Since Linux provides no way to delete data in the middle of a file, and
+ *  deleted records take up physical storage, this function will compress the
+ *  database by rewriting a new database file that only includes valid student
+ *  records. There are a number of ways to do this, but since this is extra credit
+ *  you need to figure this out on your own. 
+ * 
+ *  At a high level create a temporary database file then copy all valid students from
+ *  the active database (passed in via fd) to the temporary file. When this is done
+ *  rename the temporary database file to the name of the real database file. See
+ *  the constants in db.h for required file names:
+ *
+ *         #define DB_FILE     "student.db"        //name of database file
+ *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit 
+ * 
+ *  Note that you are passed in the fd of the database file to be compressed, 
+ *  it is very likely you will need to close it to overwrite it with the
+ *  compressed version of the file.  To ensure the caller can work with the
+ *  compressed file after you create it, it is a good design to return the fd
+ *  of the new compressed file from this function
+ * 
+ *  Each student is written back at its own slot (id * STUDENT_RECORD_SIZE)
+ *  so lookups by id keep working; the deleted slots simply become holes in
+ *  the new file.  The new file ends at the highest live id, and its
+ *  superblock is written from the count gathered while copying.
+ * 
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ * 
+ * 
+ *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
+ *                             this error should also be returned after you
+ *                             compressed the database file and if you are unable
+ *                             to open it to pass the fd back to the caller
+ *            M_ERR_DB_CREATE  error creating the db file. For instance the
+ *                             inability to copy the temporary file back as
+ *                             the primary database file. 
+ *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
+ *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *            
+ */
+int compress_db(int fd) {
+    fd = compress_file(fd);
+    if (fd < 0) {
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_COMPRESSED_OK);
+    return fd;
+}
+
+//a range of slots compress_file() copies in one piece
+typedef struct copy_run{
+    off_t off;
+    off_t len;
+} copy_run_t;
+
+typedef struct copy_runs{
+    copy_run_t *runs;
+    int n;
+    int cap;
+} copy_runs_t;
+
+//work shared by the copy_worker() threads of one compress_file()
+typedef struct copy_work{
+    int src_fd;
+    int dest_fd;
+    copy_runs_t *runs;
+    int next;               //next run to take, taken with an atomic add
+    int rc;                 //first error, ERR_DB_FILE
+} copy_work_t;
+
+static int add_run(copy_runs_t *r, off_t off, off_t len) {
+    // A gap shorter than a page cant be a hole in the new file anyway,
+    // copying its zeros saves a system call
+    if (r->n > 0) {
+        copy_run_t *last = &r->runs[r->n - 1];
+        if (off - (last->off + last->len) < PAGER_PAGE &&
+            off + len - last->off <= COMPRESS_CHUNK) {
+            last->len = off + len - last->off;
+            return NO_ERROR;
+        }
+    }
+    if (r->n == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 64;
+        copy_run_t *grown = realloc(r->runs, cap * sizeof(*grown));
+        if (grown == NULL) {
+            return ERR_DB_FILE;
+        }
+        r->runs = grown;
+        r->cap = cap;
+    }
+    r->runs[r->n++] = (copy_run_t){ off, len };
+    return NO_ERROR;
+}
+
+/*
+ *  find_runs
+ *      fd:     linux file descriptor
+ *      *runs:  receives the runs of live slots
+ *      *sb:    rec_count and max_id are set from what was found
+ *
+ *  Scans the file a page at a time for runs of consecutive live records.
+ *  Runs closer than a page are joined and none is longer than
+ *  COMPRESS_CHUNK, so the copy work can be shared evenly.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ */
+static int find_runs(int fd, copy_runs_t *runs, db_super_t *sb) {
+    student_t recs[SCAN_RECS];
+    off_t offset = STUDENT_RECORD_SIZE;
+    off_t start = -1;           //first slot of the run being built
+
+    sb->rec_count = 0;
+    sb->max_id = 0;
+    while (true) {
+        ssize_t bytes_read = pager_read(fd, recs, sizeof(recs), offset);
+        if (bytes_read < 0) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+
+        int n = bytes_read / STUDENT_RECORD_SIZE;
+        for (int i = 0; i < n; i++) {
+            off_t slot = offset + (off_t)i * STUDENT_RECORD_SIZE;
+            if (recs[i].id != 0) {
+                if (start < 0) {
+                    start = slot;
+                }
+                sb->rec_count++;
+                sb->max_id = slot / STUDENT_RECORD_SIZE;
+                if (slot + STUDENT_RECORD_SIZE - start < COMPRESS_CHUNK) {
+                    continue;
+                }
+                slot += STUDENT_RECORD_SIZE;
+            }
+            if (start >= 0 && add_run(runs, start, slot - start) != NO_ERROR) {
+                printf(M_ERR_DB_READ);
+                return ERR_DB_FILE;
+            }
+            start = -1;
+        }
+        offset += bytes_read;
+    }
+    if (start >= 0 && add_run(runs, start, offset - start) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+static void *copy_worker(void *arg) {
+    copy_work_t *w = arg;
+
+    while (__atomic_load_n(&w->rc, __ATOMIC_RELAXED) == NO_ERROR) {
+        int i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+        if (i >= w->runs->n) {
+            break;
+        }
+        copy_run_t *run = &w->runs->runs[i];
+        if (copy_range(w->src_fd, w->dest_fd, run->off, run->len) != NO_ERROR) {
+            __atomic_store_n(&w->rc, ERR_DB_FILE, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/*
+ *  copy_runs
+ *      src_fd, dest_fd:  database and the file it is compressed into
+ *      *runs:            runs found by find_runs()
+ *
+ *  Copies the runs to the same offsets with up to COMPRESS_WORKERS
+ *  threads, each taking the next run that is left.  The calling thread is
+ *  one of them.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int copy_runs(int src_fd, int dest_fd, copy_runs_t *runs) {
+    copy_work_t work = { src_fd, dest_fd, runs, 0, NO_ERROR };
+    pthread_t tids[COMPRESS_WORKERS];
+    bool started[COMPRESS_WORKERS] = {false};
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = COMPRESS_WORKERS;
+
+    if (cpus > 0 && cpus < n) {
+        n = cpus;
+    }
+    if (runs->n < n) {
+        n = runs->n;
+    }
+    for (int k = 1; k < n; k++) {
+        started[k] = pthread_create(&tids[k], NULL, copy_worker, &work) == 0;
+    }
+    copy_worker(&work);
+    for (int k = 1; k < n; k++) {
+        if (started[k]) {
+            pthread_join(tids[k], NULL);
+        }
+    }
+    return work.rc;
+}
+
+/*
+ *  compress_file
+ *      fd:     linux file descriptor
+ *
+ *  Does the work of compress_db() for whatever file fd was opened from,
+ *  without printing M_DB_COMPRESSED_OK, so a sharded database can compress
+ *  all of its files and report once.  The records never pass through user
+ *  space: find_runs() locates the runs of live slots and copy_runs() moves
+ *  them into the new file in parallel.
+ *
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the error messages of compress_db()
+ */
+int compress_file(int fd) {
+    char db_file[PATH_MAX];
+    char tmp_file[PATH_MAX];
+
+    snprintf(db_file, sizeof(db_file), "%s", db_name(fd));
+    db_sidecar(fd, ".db", true, tmp_file, sizeof(tmp_file));
+
+    int new_fd = open_db(tmp_file, true);
+
+    if (new_fd == ERR_DB_FILE) {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+
+    db_super_t sb;
+    copy_runs_t runs = {0};
+
+    // Carry the epoch and generation over, compressing changes no names so
+    // the trigram index stays valid
+    if (read_super(fd, &sb) != NO_ERROR || checkpoint_db(fd) != NO_ERROR ||
+        find_runs(fd, &runs, &sb) != NO_ERROR) {
+        free(runs.runs);
+        close_db(new_fd);
+        return ERR_DB_FILE;
+    }
+    sb.flags &= SUPER_NO_LAYOUT;
+
+    // Size the new file first so the workers never race to extend it,
+    // then forget the superblock page open_db() cached, the copies go
+    // around the pager
+    int rc = tr_ftruncate(new_fd, (off_t)(sb.max_id + 1) * STUDENT_RECORD_SIZE) == 0 ?
+             copy_runs(fd, new_fd, &runs) : ERR_DB_FILE;
+    free(runs.runs);
+    pager_drop(new_fd);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        close_db(new_fd);
+        return ERR_DB_FILE;
+    }
+
+    // The new file must be complete on disk before it replaces the old one
+    if (write_super(new_fd, &sb) != NO_ERROR || close_db(new_fd) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    close_db(fd);
+    if (rename(tmp_file, db_file) != 0) {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+
+    return open_db(db_file, false);
+}
+
+
+/*
+ *  validate_range
+ *      id:  proposed student id
+ *      gpa: proposed gpa
+ * 
+ *  This function validates that the id and gpa are in the allowable ranges
+ *  as per the specifications.  It checks if the values are within the
+ *  inclusive range using constents in db.h
+ * 
+ *  returns:    NO_ERROR       on success, both ID and GPA are in range
+ *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ * 
+ *  console:  This function does not produce any output
+ *            
+ */
+int validate_range(int id, int gpa){
+
+    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+        return EXIT_FAIL_ARGS;
+
+    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
+        return EXIT_FAIL_ARGS;
+
+    return NO_ERROR;
+}
+
+/*
+ *  read_batch
+ *      path:   batch file, "-" for stdin
+ *      **ops:  receives a malloc'ed array of the operations
+ *      *n:     receives the number of operations
+ *
+ *  A batch file has one operation per line, blank lines and lines
+ *  starting with # are skipped:
+ *
+ *      a id first_name last_name gpa
+ *      d id
+ *      m old_id new_id
+ *
+ *  The whole file is read and checked before anything is changed.  A
+ *  line longer than BATCH_LINE_MAX is invalid, it is not split in two.
+ *
+ *  returns:  NO_ERROR        *ops and *n are set
+ *            EXIT_FAIL_ARGS  the file cant be read or a line is invalid
+ *
+ *  console:  M_ERR_BATCH_LINE  a line that cant be parsed
+ *            M_ERR_STD_RNG     an id or gpa out of range
+ */
+int read_batch(char *path, batch_op_t **ops, int *n) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char line[BATCH_LINE_MAX + 2];
+    int cap = 0, line_no = 0, rc = NO_ERROR;
+
+    *ops = NULL;
+    *n = 0;
+    if (in == NULL) {
+        printf(M_ERR_BATCH_LINE, 0, path);
+        return EXIT_FAIL_ARGS;
+    }
+
+    while (rc == NO_ERROR && fgets(line, sizeof(line), in)) {
+        batch_op_t op = {0};
+        char extra;
+
+        line_no++;
+        //fgets() fills the buffer and stops short of the newline of a
+        //longer line, a shorter one without a newline ends the file
+        if (strchr(line, '\n') == NULL && strlen(line) > BATCH_LINE_MAX) {
+            printf(M_ERR_BATCH_LINE, line_no, path);
+            rc = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (sscanf(line, " %c", &op.op) != 1 || op.op == '#') {
+            continue;
+        }
+
+        bool ok = false;
+        switch (op.op) {
+            case 'a':
+                ok = sscanf(line, " a %d %63s %63s %d %c", &op.id, op.fname,
+                            op.lname, &op.gpa, &extra) == 4;
+                break;
+            case 'd':
+                ok = sscanf(line, " d %d %c", &op.id, &extra) == 1;
+                op.gpa = MIN_STD_GPA;
+                break;
+            case 'm':
+                ok = sscanf(line, " m %d %d %c", &op.id, &op.new_id, &extra) == 2;
+                op.gpa = MIN_STD_GPA;
+                break;
+        }
+        if (!ok) {
+            printf(M_ERR_BATCH_LINE, line_no, path);
+            rc = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (validate_range(op.id, op.gpa) != NO_ERROR ||
+            (op.op == 'm' && validate_range(op.new_id, op.gpa) != NO_ERROR)) {
+            printf(M_ERR_STD_RNG);
+            rc = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        if (*n == cap) {
+            cap = cap ? cap * 2 : 64;
+            batch_op_t *grown = realloc(*ops, cap * sizeof(batch_op_t));
+            if (grown == NULL) {
+                rc = EXIT_FAIL_ARGS;
+                break;
+            }
+            *ops = grown;
+        }
+        (*ops)[(*n)++] = op;
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (rc != NO_ERROR) {
+        free(*ops);
+        *ops = NULL;
+        *n = 0;
+    }
+    return rc;
+}
+
+/*
+ *  run_batch
+ *      fd:    linux file descriptor, locked exclusively
+ *      *ops:  operations read by read_batch()
+ *      n:     number of operations
+ *
+ *  Applies every operation inside one transaction, see txn.h.  The first
+ *  operation that fails aborts the transaction and nothing is changed.
+ *  A move copies the student to the new id and deletes the old one.
+ *  Before each operation the pool must have room for the pages it may
+ *  change, since none of them can be written back until the commit.
+ *
+ *  returns:  NO_ERROR       every operation was applied
+ *            ERR_DB_OP      an operation failed, nothing was applied
+ *            ERR_TXN_SIZE   the batch changes more than TXN_MAX_PAGES pages
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the messages of add_student() and del_student() as each
+ *            operation runs, then M_TXN_COMMITTED or M_TXN_ABORTED
+ *            M_ERR_TXN_SIZE  the operation that did not fit
+ */
+int run_batch(int fd, batch_op_t *ops, int n) {
+    int rc = txn_begin(fd);
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++) {
+        batch_op_t *op = &ops[i];
+        student_t s;
+
+        if (pager_room() < (op->op == 'm' ? 2 : 1)) {
+            printf(M_ERR_TXN_SIZE, i + 1);
+            rc = ERR_TXN_SIZE;
+            break;
+        }
+        switch (op->op) {
+            case 'a':
+                rc = add_student(fd, op->id, op->fname, op->lname, op->gpa);
+                break;
+            case 'd':
+                rc = del_student(fd, op->id);
+                break;
+            case 'm':
+                rc = get_student(fd, op->id, &s);
+                if (rc == SRCH_NOT_FOUND) {
+                    printf(M_STD_NOT_FND_MSG, op->id);
+                    rc = ERR_DB_OP;
+                    break;
+                }
+                if (rc == NO_ERROR) {
+                    rc = add_student(fd, op->new_id, s.fname, s.lname, s.gpa);
+                }
+                if (rc == NO_ERROR) {
+                    rc = del_student(fd, op->id);
+                }
+                break;
+        }
+    }
+
+    if (rc == NO_ERROR) {
+        rc = txn_commit(fd);
+    }
+    if (rc != NO_ERROR) {
+        txn_abort(fd);
+        printf(M_TXN_ABORTED);
+        return rc;
+    }
+
+    printf(M_TXN_COMMITTED, n);
+    return NO_ERROR;
+}
+
+/*
+ *  shm_query
+ *      opt:         option letter
+ *      argc, argv:  command line
+ *      *exit_code:  exit code when the query was answered
+ *
+ *  Answers -f and -c from the shared memory copy of the database.
+ *
+ *  returns:  true if the query was answered, false if it has to go to the
+ *            database
+ *
+ *  console:  the output of -f or -c when the query was answered
+ */
+bool shm_query(char opt, int argc, char *argv[], int *exit_code) {
+    student_t student;
+    uint64_t t = tr_start();
+    int rc;
+
+    if (opt == 'f' && argc == 3) {
+        int id = atoi(argv[2]);
+        rc = shard_shm_find(id, &student);
+        if (rc == ERR_DB_FILE) {
+            return false;
+        }
+        if (rc == NO_ERROR) {
+            print_student(&student);
+            *exit_code = EXIT_OK;
+        } else {
+            printf(M_STD_NOT_FND_MSG, id);
+            *exit_code = EXIT_FAIL_DB;
+        }
+        tr_stop(TR_FIND, t);
+        return true;
+    }
+
+    if (opt == 'c' && argc == 2) {
+        rc = shard_shm_count();
+        if (rc < 0) {
+            return false;
+        }
+        if (rc == 0) {
+            printf(M_DB_EMPTY);
+        } else {
+            printf(M_DB_RECORD_CNT, rc);
+        }
+        *exit_code = EXIT_OK;
+        tr_stop(TR_COUNT, t);
+        return true;
+    }
+    return false;
+}
+
+//students found by -G, in id order
+typedef struct found{
+    student_t *recs;
+    int n;
+    int cap;
+} found_t;
+
+//sst_scan_gpa() callback for sst_query()
+static int add_found(const student_t *s, void *arg) {
+    found_t *f = arg;
+
+    if (f->n == f->cap) {
+        int cap = f->cap ? f->cap * 2 : 64;
+        student_t *grown = realloc(f->recs, cap * sizeof(*grown));
+        if (grown == NULL) {
+            return ERR_DB_FILE;
+        }
+        f->recs = grown;
+        f->cap = cap;
+    }
+    f->recs[f->n++] = *s;
+    return NO_ERROR;
+}
+
+/*
+ *  sst_query
+ *      opt:         option letter
+ *      argc, argv:  command line
+ *      *exit_code:  exit code when the query was answered
+ *
+ *  Answers -Q (find ids) and -G (gpa range) from a snapshot written by
+ *  -E, see sst.h.  The database is not opened.  The ids of one -Q share
+ *  the snapshot's block cache.
+ *
+ *  returns:  true if opt is a snapshot query
+ *
+ *  console:  the students found, M_STD_NOT_FND_MSG or M_SST_NO_MATCH, or
+ *            M_ERR_SST_OPEN if the snapshot cant be read
+ */
+bool sst_query(char opt, int argc, char *argv[], int *exit_code) {
+    sst_t sst;
+    uint64_t t;
+
+    if (opt != 'Q' && opt != 'G') {
+        return false;
+    }
+    if ((opt == 'Q' && argc < 4) || (opt == 'G' && argc != 5)) {
+        usage(argv[0]);
+        *exit_code = EXIT_FAIL_ARGS;
+        return true;
+    }
+
+    t = tr_start();
+    if (sst_open(argv[2], &sst) != NO_ERROR) {
+        printf(M_ERR_SST_OPEN, argv[2]);
+        *exit_code = EXIT_FAIL_DB;
+        return true;
+    }
+
+    *exit_code = EXIT_OK;
+    if (opt == 'Q') {
+        for (int i = 3; i < argc; i++) {
+            student_t s;
+            int id = atoi(argv[i]);
+
+            switch (sst_find(&sst, id, &s)) {
+                case NO_ERROR:
+                    print_student(&s);
+                    break;
+                case SRCH_NOT_FOUND:
+                    printf(M_STD_NOT_FND_MSG, id);
+                    *exit_code = EXIT_FAIL_DB;
+                    break;
+                default:
+                    printf(M_ERR_SST_OPEN, argv[2]);
+                    *exit_code = EXIT_FAIL_DB;
+                    break;
+            }
+        }
+    } else {
+        found_t found = {0};
+        int min_gpa = atoi(argv[3]);
+        int max_gpa = atoi(argv[4]);
+
+        if (sst_scan_gpa(&sst, min_gpa, max_gpa, add_found, &found) != NO_ERROR) {
+            printf(M_ERR_SST_OPEN, argv[2]);
+            *exit_code = EXIT_FAIL_DB;
+        } else if (found.n == 0) {
+            printf(M_SST_NO_MATCH, min_gpa, max_gpa);
+        } else {
+            print_students(found.recs, found.n);
+        }
+        free(found.recs);
+    }
+
+    sst_close(&sst);
+    tr_stop(TR_SNAPSHOT, t);
+    return true;
+}
+
+/*
+ *  usage
+ *      exename:  the name of the executable from argv[0]
+ * 
+ *  Prints this programs expected usage
+ * 
+ *  returns:    nothing, this is a void function
+ * 
+ *  console:  This function prints the usage information
+ *            
+ */
+void usage(char *exename){
+    printf("usage: %s [-T] -[h|a|c|d|D|f|p|S|x|z|B|R|t|M|E|Q|G|W] options.  Where:\n", exename);
+    printf("\t-T:  writes operation counts and timings as JSON to stderr at exit\n");
+    printf("\t-h:  prints help\n");
+    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-c:  counts the records in the database\n");
+    printf("\t-d id:  deletes a student\n");
+    printf("\t-D predicate:  deletes every student matching field op value terms,\n"
+           "\t    comma separated, e.g. \"id<5000\" or \"gpa==0,lname==Smith\"\n");
+    printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-p [--order-by id|lname|gpa]:  prints all records in the student\n"
+           "\t    database, by id unless another order is given\n");
+    printf("\t-S pattern [edits]:  finds students by part of a name, allowing up to\n"
+           "\t    %d edits (default 0) for a fuzzy match\n", TRI_MAX_EDITS);
+    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-B dest:  backs up the database to dest (a directory if sharded)\n");
+    printf("\t-R src:  restores the database from a backup made with -B\n");
+    printf("\t-t file:  applies a batch of adds (a id first last gpa), deletes\n"
+           "\t    (d id) and moves (m old_id new_id) all or nothing, - for stdin;\n"
+           "\t    one batch can change at most %d pages of 64 ids\n", TXN_MAX_PAGES);
+    printf("\t-M:  publishes the database to shared memory for lock free readers\n");
+    printf("\t-E dest.sst:  exports a compact, sorted, read only snapshot\n");
+    printf("\t-Q snap.sst id [id ...]:  finds students in a snapshot\n");
+    printf("\t-G snap.sst min_gpa max_gpa:  prints the students of a snapshot in a\n"
+           "\t    gpa range (3 digit ints)\n");
+    printf("\t-W since [consumer]:  prints the changes after sequence number since\n"
+           "\t    (one per shard, comma separated), turning the change log on;\n"
+           "\t    consumer acknowledges them so older log segments can be deleted\n");
+    printf("environment:\n");
+    printf("\t" SHARD_ENV "=file,file,...:  split the database over these files\n");
+    printf("\t" SHARD_MODE_ENV "=range|hash:  how ids are spread over the shards\n");
+    printf("\t" TRACE_ENV "=1|file:  like -T, writing to stderr or appending to file\n");
+    printf("\t" SHM_ENV "=1:  -f and -c read the copy published by -M, without locks\n");
+    printf("\t" SCAN_ENV "=read|mmap:  how full scans read the file, mmap above 1 MiB\n"
+           "\t    by default\n");
+    printf("\t" SORT_MEM_ENV "=bytes:  memory -p --order-by sorts in before it spills\n"
+           "\t    sorted runs to a temporary file, 64 MiB by default\n");
+}
+
+
+//Welcome to main()
+int main(int argc, char *argv[]){
+    char opt;           //user selected option
+    shard_set_t db;     //the database files, one unless sharded
+    int fd;             //file descriptor of the shard for id
+    int rc;             //return code from various operations
+    int exit_code;      //exit code to shell
+    int id;             //userid from argv[2]
+    int gpa;            //gpa from argv[5]
+    int edits;          //allowed edit distance for -S from argv[3]
+    batch_op_t *ops;    //operations read from the -t batch file
+    int n_ops;          //number of operations in ops
+    purge_pred_t pred;  //students to delete from argv[2] for -D
+    long long since[SHARD_MAX]; //last change a -W consumer has, per shard
+    int order;          //-p --order-by from argv[3]
+    uint64_t t;         //start time of the traced step
+    trace_op_t op;      //what the command is traced as
+
+    //space for a student structure which we will get back from
+    //some of the functions we will be writing such as get_student(),
+    //and print_student(). 
+    student_t student = {0};
+
+    //-T in front of the option turns on tracing to stderr, see trace.h.
+    //Drop it so the option is argv[1] again
+    bool trace_flag = argc >= 2 && strcmp(argv[1], "-T") == 0;
+    if (trace_flag){
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    //This function must have at least one arg, and the arg must start
+    //with a dash
+    if ((argc < 2) || (*argv[1] != '-')){
+        usage(argv[0]);
+        exit(1);
+    }
+
+    //The option is the first character after the dash for example
+    //-h -a -c -d -f -p -x -z
+    opt = (char)*(argv[1]+1);   //get the option flag
+
+    //handle the help flag and then exit normally
+    if (opt == 'h'){
+        usage(argv[0]);
+        exit(EXIT_OK);
+    }
+
+    trace_init(opt, trace_flag);
+
+    //readers in shared memory mode never open or lock the database, see
+    //shm.h.  If there is no valid copy they carry on below
+    if (getenv(SHM_ENV) && strcmp(getenv(SHM_ENV), "1") == 0 &&
+        shm_query(opt, argc, argv, &exit_code)){
+        exit(exit_code);
+    }
+
+    //snapshot queries only read the snapshot file, see sst.h
+    if (sst_query(opt, argc, argv, &exit_code)){
+        exit(exit_code);
+    }
+
+    //now lets open the file(s) and continue if there is no error
+    //note we are not truncating the file using the second
+    //parameter
+    t = tr_start();
+    if (shard_open(&db, false) < 0){
+        exit(EXIT_FAIL_DB);
+    }
+    tr_stop(TR_OPEN, t);
+
+    //writers lock the shards they change exclusively and readers take a
+    //shared lock, so -B never copies a half written record and -R never
+    //swaps a file out from under a running command.  Single student
+    //operations only lock the shard the student lives on
+    id = (argc >= 3 && (opt == 'a' || opt == 'd' || opt == 'f')) ?
+         atoi(argv[2]) : SHARD_ALL;
+    //a batch only changes its shard in a transaction and can append to a
+    //log the last one left, see txn.h
+    db.logged = opt == 't';
+    t = tr_start();
+    if (shard_lock(&db, id, opt == 'a' || opt == 'd' || opt == 'x' ||
+                            opt == 'z' || opt == 'R' || opt == 't' ||
+                            opt == 'M' || opt == 'D' || opt == 'W') < 0){
+        shard_close(&db);
+        exit(EXIT_FAIL_DB);
+    }
+    tr_stop(TR_LOCK, t);
+
+    //set rc to the return code of the operation to ensure the program
+    //use that to determine the proper exit_code.  Look at the header
+    //sdbsc.h for expected values. 
+
+    exit_code = EXIT_OK;
+    op = TR_OPS;
+    t = tr_start();
+    switch(opt){
+        case 'a':
+            op = TR_ADD;
+            //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]         
+            //prog_name     -a      id  first_name last_name     gpa
+            //-------------------------------------------------------
+            //example:  prog_name -a 1 John Doe 341
+            if (argc != 6){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+
+            //convert id and gpa to ints from argv.  For this assignment assume
+            //they are valid numbers
+            id = atoi(argv[2]);
+            gpa = atoi(argv[5]);
+
+            exit_code = validate_range(id,gpa);
+            if (exit_code == EXIT_FAIL_ARGS){
+                printf(M_ERR_STD_RNG);
+                break;
+            }
+
+            fd = shard_fd(&db, id);
+            rc = add_student(fd, id, argv[3], argv[4], gpa);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+
+            break;
+
+        case 'c':
+            op = TR_COUNT;
+            //    arv[0] arv[1]    
+            //prog_name     -c 
+            //-----------------
+            //example:  prog_name -c  
+            rc = shard_count_records(&db);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'd':
+            op = TR_DEL;
+            //   arv[0]  arv[1]  arv[2]    
+            //prog_name     -d      id 
+            //-------------------------
+            //example:  prog_name -d 100    
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            id = atoi(argv[2]);
+            fd = shard_fd(&db, id);
+            rc = del_student(fd, id);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+
+            break;
+
+        case 'D':
+            op = TR_PURGE;
+            //    arv[0] arv[1]     arv[2]
+            //prog_name     -D  predicate
+            //---------------------------
+            //example:  prog_name -D "id<5000"
+            //          prog_name -D "gpa==0,lname==Smith"
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            exit_code = purge_parse(argv[2], &pred);
+            if (exit_code != NO_ERROR)
+                break;
+            rc = shard_purge(&db, &pred);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'f':
+            op = TR_FIND;
+            //    arv[0] arv[1]  arv[2]    
+            //prog_name     -f      id
+            //-------------------------
+            //example:  prog_name -f 100       
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            id = atoi(argv[2]);
+            fd = shard_fd(&db, id);
+            rc = get_student(fd, id, &student);
+
+           
+            switch (rc){
+                case NO_ERROR:
+                    print_student(&student);
+                    break;
+                case SRCH_NOT_FOUND:
+                    printf(M_STD_NOT_FND_MSG, id);
+                    exit_code = EXIT_FAIL_DB;
+                    break;
+                default:
+                    printf(M_ERR_DB_READ);
+                    exit_code = EXIT_FAIL_DB;
+                    break;
+            }
+            break;
+
+        case 'p':
+            op = TR_PRINT;
+            //    arv[0] arv[1]      arv[2]          arv[3]
+            //prog_name     -p  [--order-by  id|lname|gpa]
+            //--------------------------------------------
+            //example:  prog_name -p
+            //          prog_name -p --order-by gpa
+            order = SORT_ID;
+            if (argc >= 3 && strcmp(argv[2], "--order-by") == 0){
+                if (argc != 4){
+                    usage(argv[0]);
+                    exit_code = EXIT_FAIL_ARGS;
+                    break;
+                }
+                order = sort_parse(argv[3]);
+                if (order < 0){
+                    printf(M_ERR_SORT_FIELD, argv[3]);
+                    exit_code = EXIT_FAIL_ARGS;
+                    break;
+                }
+            }
+            rc = shard_print_db(&db, order);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'S':
+            op = TR_SEARCH;
+            //    arv[0] arv[1]   arv[2]   arv[3]
+            //prog_name     -S  pattern  [edits]
+            //-----------------------------------
+            //example:  prog_name -S smi
+            //          prog_name -S jhon 1
+            if (argc != 3 && argc != 4){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            edits = (argc == 4) ? atoi(argv[3]) : 0;
+            if (edits < 0 || edits > TRI_MAX_EDITS){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = shard_search(&db, argv[2], edits);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'x':
+            op = TR_COMPRESS;
+            //    arv[0] arv[1]    
+            //prog_name     -x 
+            //-----------------
+            //example:  prog_name -x 
+
+            //remember compress_db returns a fd of the compressed database.
+            //shard_compress() keeps it in db, we close it after this switch
+            //statement
+            rc = shard_compress(&db);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'z':
+            op = TR_ZERO;
+            //    arv[0] arv[1]    
+            //prog_name     -x 
+            //-----------------
+            //example:  prog_name -x 
+            //truncate in place so the exclusive lock is kept, closing
+            //and reopening with truncate=true would drop it
+            if (shard_zero(&db) < 0){
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            printf(M_DB_ZERO_OK);
+            exit_code = EXIT_OK;
+            break;
+
+        case 'B':
+            op = TR_BACKUP;
+            //    arv[0] arv[1]  arv[2]
+            //prog_name     -B    dest
+            //-------------------------
+            //example:  prog_name -B student.bak
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = shard_backup(&db, argv[2]);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'R':
+            op = TR_RESTORE;
+            //    arv[0] arv[1]  arv[2]
+            //prog_name     -R     src
+            //-------------------------
+            //example:  prog_name -R student.bak
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = shard_restore(&db, argv[2]);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'M':
+            op = TR_PUBLISH;
+            //    arv[0] arv[1]
+            //prog_name     -M
+            //-----------------
+            //example:  prog_name -M
+            rc = shard_shm_build(&db);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'E':
+            op = TR_EXPORT;
+            //    arv[0] arv[1]        arv[2]
+            //prog_name     -E  snapshot.sst
+            //------------------------------
+            //example:  prog_name -E replica.sst
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = shard_export(&db, argv[2]);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 'W':
+            op = TR_CHANGES;
+            //    arv[0] arv[1]  arv[2]      arv[3]
+            //prog_name     -W   since  [consumer]
+            //------------------------------------
+            //example:  prog_name -W 0
+            //          prog_name -W 1042 replica1
+            //          prog_name -W 17,9 replica1    (one per shard)
+            if (argc != 3 && argc != 4){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            exit_code = shard_parse_since(&db, argv[2], since);
+            if (exit_code != NO_ERROR)
+                break;
+            rc = shard_changes(&db, since, argc == 4 ? argv[3] : NULL);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+
+        case 't':
+            op = TR_BATCH;
+            //    arv[0] arv[1]  arv[2]
+            //prog_name     -t    file
+            //-------------------------
+            //example:  prog_name -t grades.txt
+            if (argc != 3){
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            exit_code = read_batch(argv[2], &ops, &n_ops);
+            if (exit_code != NO_ERROR || n_ops == 0)
+                break;
+
+            //a transaction covers one file, every id must be on its shard
+            fd = shard_fd(&db, ops[0].id);
+            for (int i = 0; i < n_ops; i++){
+                if (shard_fd(&db, ops[i].id) != fd ||
+                    (ops[i].op == 'm' && shard_fd(&db, ops[i].new_id) != fd)){
+                    printf(M_ERR_BATCH_SHARD);
+                    exit_code = EXIT_FAIL_ARGS;
+                    break;
+                }
+            }
+            if (exit_code == NO_ERROR && run_batch(fd, ops, n_ops) < 0)
+                exit_code = EXIT_FAIL_DB;
+            free(ops);
+            break;
+
+        default:
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+    }
+
+    if (op != TR_OPS)
+        tr_stop(op, t);
+
+    //dont forget to close the file before exiting, and setting the 
+    //proper exit code - see the header file for expected values
+    shard_close(&db);
+    exit(exit_code);
+}
@@ -1,64 +1,127 @@
-#ifndef __SDB_H__
-
-#include "db.h" //get student record type
-
-//prototypes for functions go below for this assignment
-int open_db(char *dbFile, bool should_truncate);
-int add_student(int fd, int id, char *fname, char *lname, int gpa);
-int get_student(int fd, int id, student_t *s);
-int del_student(int fd, int id);
-int compress_db(int fd);
-void print_student(student_t *s);
-int validate_range(int id, int gpa);
-int count_db_records(int fd);
-int print_db(int fd);
-void usage(char *);
-
-//error codes to be returned from individual functions
-// NO_ERROR is returned if there are no errors
-// ERR_DB_FILE is returned if there is are any issues with the database file itself
-// ERR_DB_OP is returned if an operation did not work aka add or delete a student
-// SRCH_NOT_FOUND is returned if the student is not found (get_student, and del_student)
-#define NO_ERROR        0
-#define ERR_DB_FILE     -1
-#define ERR_DB_OP       -2
-#define SRCH_NOT_FOUND  -3
-#define NOT_IMPLEMENTED_YET 0
-
-
-//error codes to be returned to the shell
-// EXIT_OK          program executed without error
-// EXIT_FAIL_DB     a database operation failed
-// EXIT_FAIL_ARGS   one or more arguments to program were not valid
-// EXIT_NOT_IMPL    the operation has not been implemented yet
-#define EXIT_OK         0
-#define EXIT_FAIL_DB    1
-#define EXIT_FAIL_ARGS  2
-#define EXIT_NOT_IMPL   3
-
-//Output messages
-#define M_ERR_STD_RNG     "Cant add student, either ID or GPA out of allowable range!\n"
-#define M_ERR_DB_CREATE   "Error creating DB file, exiting!\n"
-#define M_ERR_DB_OPEN     "Error opening DB file, exiting!\n"
-#define M_ERR_DB_READ     "Error reading DB file, exiting!\n"
-#define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
-#define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
-#define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
-
-#define M_STD_ADDED       "Student %d added to database.\n"
-#define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
-#define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
-#define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
-#define M_DB_ZERO_OK      "All database records removed!\n"
-#define M_DB_EMPTY        "Database contains no student records.\n"
-#define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
-#define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
-
-//useful format strings for print students
-//For example to print the header in the required output:
-//  printf(STUDENT_PRINT_HDR_STRING, "ID","FIRST NAME", 
-//                                   "LAST_NAME", "GPA");
-#define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
-#define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
-
+#ifndef __SDB_H__
+
+#include "db.h" //get student record type
+
+//prototypes for functions go below for this assignment
+int open_db(char *dbFile, bool should_truncate);
+int add_student(int fd, int id, char *fname, char *lname, int gpa);
+int get_student(int fd, int id, student_t *s);
+int del_student(int fd, int id);
+int compress_db(int fd);
+void print_student(student_t *s);
+int validate_range(int id, int gpa);
+int count_db_records(int fd);
+int read_super(int fd, db_super_t *sb);
+int write_super(int fd, db_super_t *sb);
+int rebuild_super(int fd, db_super_t *sb);
+int load_super(int fd, db_super_t *sb);
+int compress_file(int fd);
+bool super_check(const db_super_t *sb);
+unsigned int super_epoch(void);
+int super_begin(int fd, db_super_t *sb);
+int super_commit(int fd, db_super_t *sb);
+int checkpoint_db(int fd);
+int close_db(int fd);
+void db_set_name(int fd, const char *dbFile);
+const char *db_name(int fd);
+char *db_sidecar(int fd, const char *ext, bool tmp, char *out, size_t sz);
+char *db_path_sidecar(const char *name, const char *ext, bool tmp, char *out, size_t sz);
+void print_students(student_t *recs, int n);
+
+//scan_db() calls a scan_fn for every live student in id order, a non-zero
+//return value stops the scan and is returned by scan_db().  The student may
+//be in a read only mapping of the file, copy it to change it
+typedef int (*scan_fn)(student_t *s, void *arg);
+int scan_db(int fd, scan_fn fn, void *arg);
+int print_db(int fd);
+void usage(char *);
+
+//one line of a -t batch file, BATCH_LINE_MAX chars at most without the newline
+#define BATCH_LINE_MAX 254
+typedef struct batch_op{
+    char op;                //'a' add, 'd' delete or 'm' move
+    int id;                 //student id, the old id for a move
+    int new_id;             //'m': id the student moves to
+    int gpa;                //'a'
+    char fname[64];         //'a', add_student() truncates them
+    char lname[64];
+} batch_op_t;
+
+int read_batch(char *path, batch_op_t **ops, int *n);
+int run_batch(int fd, batch_op_t *ops, int n);
+bool shm_query(char opt, int argc, char *argv[], int *exit_code);
+bool sst_query(char opt, int argc, char *argv[], int *exit_code);
+
+//error codes to be returned from individual functions
+// NO_ERROR is returned if there are no errors
+// ERR_DB_FILE is returned if there is are any issues with the database file itself
+// ERR_DB_OP is returned if an operation did not work aka add or delete a student
+// SRCH_NOT_FOUND is returned if the student is not found (get_student, and del_student)
+// ERR_TXN_SIZE is returned if a batch changes more pages than a transaction can hold
+#define NO_ERROR        0
+#define ERR_DB_FILE     -1
+#define ERR_DB_OP       -2
+#define SRCH_NOT_FOUND  -3
+#define ERR_TXN_SIZE    -4
+#define NOT_IMPLEMENTED_YET 0
+
+
+//error codes to be returned to the shell
+// EXIT_OK          program executed without error
+// EXIT_FAIL_DB     a database operation failed
+// EXIT_FAIL_ARGS   one or more arguments to program were not valid
+// EXIT_NOT_IMPL    the operation has not been implemented yet
+#define EXIT_OK         0
+#define EXIT_FAIL_DB    1
+#define EXIT_FAIL_ARGS  2
+#define EXIT_NOT_IMPL   3
+
+//Output messages
+#define M_ERR_STD_RNG     "Cant add student, either ID or GPA out of allowable range!\n"
+#define M_ERR_DB_CREATE   "Error creating DB file, exiting!\n"
+#define M_ERR_DB_OPEN     "Error opening DB file, exiting!\n"
+#define M_ERR_DB_READ     "Error reading DB file, exiting!\n"
+#define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
+#define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
+#define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+
+#define M_STD_ADDED       "Student %d added to database.\n"
+#define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
+#define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
+#define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
+#define M_DB_ZERO_OK      "All database records removed!\n"
+#define M_DB_EMPTY        "Database contains no student records.\n"
+#define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
+#define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_SRCH_NO_MATCH   "No students matched \"%s\".\n"
+#define M_ERR_SHARD_CFG   "Shard layout does not match SDBSC_SHARDS, exiting!\n"
+#define M_ERR_DB_LOCK     "Error locking DB file, exiting!\n"
+#define M_ERR_DB_COPY     "Error copying DB file, exiting!\n"
+#define M_ERR_DB_RESTORE  "Cant restore from %s, it is not a student database.\n"
+#define M_DB_BACKUP_OK    "Database backed up to %s.\n"
+#define M_DB_RESTORE_OK   "Database restored from %s.\n"
+#define M_ERR_BATCH_LINE  "Cant parse line %d of %s.\n"
+#define M_ERR_BATCH_SHARD "Cant run a batch that spans more than one shard.\n"
+#define M_TXN_COMMITTED   "Transaction committed, %d operation(s) applied.\n"
+#define M_TXN_ABORTED     "Transaction aborted, no changes were made.\n"
+#define M_ERR_TXN_SIZE    "Transaction too large at operation %d, split the batch.\n"
+#define M_SHM_PUBLISHED   "Database published to shared memory for readers.\n"
+#define M_ERR_PURGE_PRED  "Cant parse predicate \"%s\".\n"
+#define M_STD_PURGED      "%d student(s) deleted from database.\n"
+#define M_SST_EXPORTED    "Database exported to %s, %d student(s) in %d block(s).\n"
+#define M_ERR_SST_OPEN    "Cant read snapshot %s.\n"
+#define M_SST_NO_MATCH    "No students with a gpa between %d and %d.\n"
+#define M_ERR_CDC_GONE    "Changes after %lld are no longer logged, dump the database again.\n"
+#define M_ERR_CDC_SINCE   "Cant parse sequence numbers \"%s\".\n"
+#define M_ERR_CDC_CONSUMERS "Cant track more than %d consumers.\n"
+#define M_ERR_SORT_FIELD  "Cant order by \"%s\", use id, lname or gpa.\n"
+#define M_ERR_SORT        "Error sorting students, exiting!\n"
+
+//useful format strings for print students
+//For example to print the header in the required output:
+//  printf(STUDENT_PRINT_HDR_STRING, "ID","FIRST NAME", 
+//                                   "LAST_NAME", "GPA");
+#define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
+#define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
+
 #endif
\ No newline at end of file
@@ -0,0 +1,906 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "trigram.h"
+#include "shard.h"
+#include "backup.h"
+#include "pager.h"
+#include "txn.h"
+#include "shm.h"
+#include "cdc.h"
+#include "purge.h"
+#include "sst.h"
+#include "sort.h"
+
+//one unit of work for one shard, run on its own thread by shard_fanout()
+typedef struct shard_job{
+    shard_set_t *ss;
+    int k;                          //shard index
+    int (*fn)(struct shard_job *);
+    int rc;                         //return code of fn
+    pthread_t tid;
+
+    int count;                      //count_job: live records, purge_job: deleted
+    student_t *recs;                //collect_job/search_job: students found
+    int n_recs;
+    int cap;
+    char *pattern;                  //search_job: arguments to tri_match()
+    int max_edits;
+    char *dir;                      //backup_job/restore_job: backup name
+    const purge_pred_t *pred;       //purge_job: students to delete
+} shard_job_t;
+
+/*
+ *  shard_of
+ *      *ss:  open shard set
+ *      id:   student id
+ *
+ *  Picks the shard that stores id.  Ids outside the valid range still map
+ *  to some shard, the functions called on it reject them.
+ *
+ *  returns:  index of the shard
+ */
+static int shard_of(shard_set_t *ss, int id) {
+    if (ss->n == 1)
+        return 0;
+
+    if (ss->mode == SHARD_HASH) {
+        //murmur3 finalizer, sequential ids land on different shards
+        unsigned int h = id;
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h % ss->n;
+    }
+
+    int span = (MAX_STD_ID - MIN_STD_ID + ss->n) / ss->n;
+    int k = (id - MIN_STD_ID) / span;
+    if (k < 0)
+        return 0;
+    if (k >= ss->n)
+        return ss->n - 1;
+    return k;
+}
+
+/*
+ *  shard_stamp
+ *      *ss:  shard set being opened
+ *      k:    shard to check
+ *
+ *  Checks the layout recorded in the superblock of shard k against the
+ *  current configuration.  A file that has no layout yet is stamped with
+ *  it, unless the database is a single plain file.  A file whose stamp was
+ *  lost by rebuild_super() could belong to any layout and is rejected.
+ *
+ *  returns:  NO_ERROR       layout matches or was stamped
+ *            ERR_DB_FILE    layout mismatch or database file I/O issue
+ *
+ *  console:  M_ERR_SHARD_CFG  the file belongs to a different layout
+ */
+static int shard_stamp(shard_set_t *ss, int k) {
+    db_super_t sb;
+
+    if (read_super(ss->fds[k], &sb) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (sb.shard_count == 0) {
+        if (ss->n == 1)
+            return NO_ERROR;
+        if (sb.flags & SUPER_NO_LAYOUT) {
+            printf(M_ERR_SHARD_CFG);
+            return ERR_DB_FILE;
+        }
+        sb.shard_id = k;
+        sb.shard_count = ss->n;
+        sb.shard_mode = ss->mode;
+        return write_super(ss->fds[k], &sb);
+    }
+
+    if (sb.shard_count != ss->n || sb.shard_id != k ||
+        (ss->n > 1 && sb.shard_mode != ss->mode)) {
+        printf(M_ERR_SHARD_CFG);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_layout
+ *      *ss:  shard set to fill in
+ *
+ *  Reads the shard layout from SHARD_ENV and SHARD_MODE_ENV without opening
+ *  anything.  Without SHARD_ENV the only shard is DB_FILE.
+ *
+ *  returns:  NO_ERROR       paths, n and mode are set
+ *            ERR_DB_FILE    the layout is not valid
+ *
+ *  console:  M_ERR_SHARD_CFG  bad shard configuration
+ */
+static int shard_layout(shard_set_t *ss) {
+    const char *list = getenv(SHARD_ENV);
+    const char *mode = getenv(SHARD_MODE_ENV);
+
+    memset(ss, 0, sizeof(*ss));
+    for (int k = 0; k < SHARD_MAX; k++)
+        ss->fds[k] = -1;
+    ss->mode = SHARD_RANGE;
+    if (mode && strcmp(mode, "hash") == 0) {
+        ss->mode = SHARD_HASH;
+    } else if (mode && strcmp(mode, "range") != 0) {
+        printf(M_ERR_SHARD_CFG);
+        return ERR_DB_FILE;
+    }
+
+    if (!list || !*list) {
+        ss->paths[ss->n++] = strdup(DB_FILE);
+    } else {
+        char *copy = strdup(list);
+        char *save = NULL;
+        for (char *p = strtok_r(copy, ",", &save); p; p = strtok_r(NULL, ",", &save)) {
+            if (ss->n == SHARD_MAX) {
+                free(copy);
+                printf(M_ERR_SHARD_CFG);
+                shard_close(ss);
+                return ERR_DB_FILE;
+            }
+            ss->paths[ss->n++] = strdup(p);
+        }
+        free(copy);
+        if (ss->n == 0) {
+            printf(M_ERR_SHARD_CFG);
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_open
+ *      *ss:              shard set to fill in
+ *      should_truncate:  indicates if opening the shards also empties them
+ *
+ *  Reads the shard layout with shard_layout() and opens every shard with
+ *  open_db().
+ *
+ *  returns:  NO_ERROR       all shards open
+ *            ERR_DB_FILE    a shard could not be opened or the layout is
+ *                           not valid, nothing is left open
+ *
+ *  console:  M_ERR_DB_OPEN    error opening a shard
+ *            M_ERR_SHARD_CFG  bad shard configuration
+ */
+int shard_open(shard_set_t *ss, bool should_truncate) {
+    if (shard_layout(ss) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int k = 0; k < ss->n; k++) {
+        ss->fds[k] = open_db(ss->paths[k], should_truncate);
+        if (ss->fds[k] < 0 || shard_stamp(ss, k) != NO_ERROR) {
+            shard_close(ss);
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_close
+ *      *ss:  shard set
+ *
+ *  Closes every open shard and frees the shard names.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void shard_close(shard_set_t *ss) {
+    for (int k = 0; k < ss->n; k++) {
+        if (ss->fds[k] >= 0)
+            close_db(ss->fds[k]);
+        ss->fds[k] = -1;
+        free(ss->paths[k]);
+        ss->paths[k] = NULL;
+    }
+    ss->n = 0;
+}
+
+/*
+ *  shard_fd
+ *      *ss:  open shard set
+ *      id:   student id
+ *
+ *  returns:  the descriptor of the shard that stores id, for get_student(),
+ *            add_student() and del_student()
+ */
+int shard_fd(shard_set_t *ss, int id) {
+    return ss->fds[shard_of(ss, id)];
+}
+
+static void *shard_thread(void *arg) {
+    shard_job_t *job = arg;
+    job->rc = job->fn(job);
+    return NULL;
+}
+
+/*
+ *  shard_fanout
+ *      *ss:    open shard set
+ *      *jobs:  one job per shard, fn and any inputs already filled in
+ *
+ *  Runs every job on its own thread and waits for all of them.  A job
+ *  that cannot get a thread runs on the calling thread instead.
+ *
+ *  returns:  NO_ERROR if every job returned NO_ERROR, otherwise the first
+ *            negative return code
+ */
+static int shard_fanout(shard_set_t *ss, shard_job_t *jobs) {
+    bool started[SHARD_MAX] = {false};
+    int rc = NO_ERROR;
+
+    for (int k = 0; k < ss->n; k++) {
+        jobs[k].ss = ss;
+        jobs[k].k = k;
+        started[k] = pthread_create(&jobs[k].tid, NULL, shard_thread, &jobs[k]) == 0;
+        if (!started[k])
+            shard_thread(&jobs[k]);
+    }
+    for (int k = 0; k < ss->n; k++) {
+        if (started[k])
+            pthread_join(jobs[k].tid, NULL);
+        if (jobs[k].rc < 0 && rc == NO_ERROR)
+            rc = jobs[k].rc;
+    }
+    return rc;
+}
+
+/*
+ *  shard_merge
+ *      *ss:    shard set the jobs ran on
+ *      *jobs:  jobs whose recs are each sorted by id
+ *      *n:     set to the total number of students
+ *
+ *  Merges the students every shard found into one array sorted by id.  For
+ *  range shards this ends up concatenating the lists in shard order.
+ *
+ *  returns:  the merged array, the caller frees it, NULL if there are no
+ *            students or on error, when *n is set to ERR_DB_FILE
+ */
+static student_t *shard_merge(shard_set_t *ss, shard_job_t *jobs, int *n) {
+    int pos[SHARD_MAX] = {0};
+    int total = 0;
+    student_t *out;
+
+    for (int k = 0; k < ss->n; k++)
+        total += jobs[k].n_recs;
+    *n = 0;
+    if (total == 0)
+        return NULL;
+    out = malloc(total * sizeof(student_t));
+    if (!out) {
+        printf(M_ERR_DB_READ);
+        *n = ERR_DB_FILE;
+        return NULL;
+    }
+
+    while (*n < total) {
+        int best = -1;
+        for (int k = 0; k < ss->n; k++) {
+            if (pos[k] < jobs[k].n_recs &&
+                (best < 0 || jobs[k].recs[pos[k]].id < jobs[best].recs[pos[best]].id))
+                best = k;
+        }
+        out[(*n)++] = jobs[best].recs[pos[best]++];
+    }
+    return out;
+}
+
+static void shard_free_jobs(shard_set_t *ss, shard_job_t *jobs) {
+    for (int k = 0; k < ss->n; k++)
+        free(jobs[k].recs);
+}
+
+static int count_job(shard_job_t *job) {
+    db_super_t sb;
+
+    if (read_super(job->ss->fds[job->k], &sb) != NO_ERROR)
+        return ERR_DB_FILE;
+    job->count = sb.rec_count;
+    return NO_ERROR;
+}
+
+static int collect_one(student_t *s, void *arg) {
+    shard_job_t *job = arg;
+
+    if (job->n_recs == job->cap) {
+        job->cap = job->cap ? job->cap * 2 : 1024;
+        student_t *recs = realloc(job->recs, job->cap * sizeof(student_t));
+        if (!recs) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        job->recs = recs;
+    }
+    job->recs[job->n_recs++] = *s;
+    return NO_ERROR;
+}
+
+static int collect_job(shard_job_t *job) {
+    return scan_db(job->ss->fds[job->k], collect_one, job);
+}
+
+static int search_job(shard_job_t *job) {
+    return tri_match(job->ss->fds[job->k], job->pattern, job->max_edits,
+                     &job->recs, &job->n_recs);
+}
+
+static int compress_job(shard_job_t *job) {
+    int fd = compress_file(job->ss->fds[job->k]);
+
+    job->ss->fds[job->k] = fd;
+    return fd < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  shard_count_records
+ *      *ss:  open shard set
+ *
+ *  Sums the record counts kept in the superblock of every shard.
+ *
+ *  returns:  and console:  the same as count_db_records()
+ */
+int shard_count_records(shard_set_t *ss) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+    int count = 0;
+
+    if (ss->n == 1)
+        return count_db_records(ss->fds[0]);
+
+    for (int k = 0; k < ss->n; k++)
+        jobs[k].fn = count_job;
+    if (shard_fanout(ss, jobs) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int k = 0; k < ss->n; k++)
+        count += jobs[k].count;
+
+    if (count == 0) {
+        printf(M_DB_EMPTY);
+    } else {
+        printf(M_DB_RECORD_CNT, count);
+    }
+    return count;
+}
+
+/*
+ *  shard_print_db
+ *      *ss:    open shard set
+ *      order:  SORT_ID, SORT_LNAME or SORT_GPA
+ *
+ *  Scans every shard in parallel, then merges the students by id and
+ *  prints them.  Any other order is sorted by sort_print(), see sort.h.
+ *
+ *  returns:  and console:  the same as print_db()
+ */
+int shard_print_db(shard_set_t *ss, int order) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+    student_t *all;
+    int n;
+
+    if (order != SORT_ID)
+        return sort_print(ss->fds, ss->n, order);
+    if (ss->n == 1)
+        return print_db(ss->fds[0]);
+
+    for (int k = 0; k < ss->n; k++)
+        jobs[k].fn = collect_job;
+    if (shard_fanout(ss, jobs) != NO_ERROR) {
+        shard_free_jobs(ss, jobs);
+        return ERR_DB_FILE;
+    }
+
+    all = shard_merge(ss, jobs, &n);
+    shard_free_jobs(ss, jobs);
+    if (n < 0)
+        return ERR_DB_FILE;
+    if (n == 0) {
+        printf(M_DB_EMPTY);
+        return NO_ERROR;
+    }
+    print_students(all, n);
+    free(all);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_search
+ *      *ss:        open shard set
+ *      pattern:    part of a first or last name to look for
+ *      max_edits:  allowed edit distance
+ *
+ *  Runs tri_match() on every shard in parallel, each with its own index,
+ *  and prints the merged result.
+ *
+ *  returns:  and console:  the same as tri_search()
+ */
+int shard_search(shard_set_t *ss, char *pattern, int max_edits) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+    student_t *all;
+    int n;
+
+    if (ss->n == 1)
+        return tri_search(ss->fds[0], pattern, max_edits);
+
+    for (int k = 0; k < ss->n; k++) {
+        jobs[k].fn = search_job;
+        jobs[k].pattern = pattern;
+        jobs[k].max_edits = max_edits;
+    }
+    if (shard_fanout(ss, jobs) != NO_ERROR) {
+        shard_free_jobs(ss, jobs);
+        return ERR_DB_FILE;
+    }
+
+    all = shard_merge(ss, jobs, &n);
+    shard_free_jobs(ss, jobs);
+    if (n < 0)
+        return ERR_DB_FILE;
+    if (n == 0) {
+        printf(M_SRCH_NO_MATCH, pattern);
+        return SRCH_NOT_FOUND;
+    }
+    print_students(all, n);
+    free(all);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_compress
+ *      *ss:  open shard set
+ *
+ *  Compresses every shard in parallel.  The shards stay open, their
+ *  descriptors are replaced by those of the compressed files.
+ *
+ *  returns:  NO_ERROR       every shard was compressed
+ *            ERR_DB_FILE    a shard could not be compressed
+ *
+ *  console:  the same as compress_db()
+ */
+int shard_compress(shard_set_t *ss) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+
+    if (ss->n == 1) {
+        ss->fds[0] = compress_db(ss->fds[0]);
+        return ss->fds[0] < 0 ? ERR_DB_FILE : NO_ERROR;
+    }
+
+    for (int k = 0; k < ss->n; k++)
+        jobs[k].fn = compress_job;
+    if (shard_fanout(ss, jobs) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    printf(M_DB_COMPRESSED_OK);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_lock
+ *      *ss:        open shard set
+ *      id:         lock only the shard that stores id, or SHARD_ALL
+ *      exclusive:  true for an exclusive (writer) lock, false for a shared
+ *                  (reader) lock
+ *
+ *  Takes a flock() on the shards an operation uses, held until the shards
+ *  are closed.  Shards are always locked in the same order.  compress and
+ *  restore replace the database file by renaming a new one over it, so
+ *  after the lock is granted the descriptor is checked against the file
+ *  that is now at the path, and reopened and locked again if they differ.
+ *
+ *  Pages cached by open_db() before the lock was held may be stale, so
+ *  they are dropped and the superblock is checked again under the lock.
+ *  Shards that are not locked are not used, their pages are dropped so
+ *  nothing is written to them.  A transaction log is settled first if
+ *  the file lacks some of its changes, or if the command is a writer that
+ *  is not ss->logged, since the log must not outlive changes it does not
+ *  have, see txn.h.  Locked shards attach their shared memory
+ *  copy and change log, if they have them, so changes are published to
+ *  them, see shm.h and cdc.h.
+ *
+ *  returns:  NO_ERROR       lock held
+ *            ERR_DB_FILE    lock could not be taken
+ *
+ *  console:  M_ERR_DB_LOCK  error locking a shard
+ */
+int shard_lock(shard_set_t *ss, int id, bool exclusive) {
+    for (int k = 0; k < ss->n; k++) {
+        db_super_t sb;
+
+        pager_drop(ss->fds[k]);
+        if (id != SHARD_ALL && k != shard_of(ss, id))
+            continue;
+
+        while (true) {
+            struct stat fst, pst;
+
+            if (tr_flock(ss->fds[k], exclusive ? LOCK_EX : LOCK_SH) == -1 ||
+                fstat(ss->fds[k], &fst) == -1) {
+                printf(M_ERR_DB_LOCK);
+                return ERR_DB_FILE;
+            }
+            if (stat(ss->paths[k], &pst) == 0 &&
+                pst.st_dev == fst.st_dev && pst.st_ino == fst.st_ino)
+                break;
+
+            pager_drop(ss->fds[k]);
+            close(ss->fds[k]);
+            ss->fds[k] = open_db(ss->paths[k], false);
+            if (ss->fds[k] < 0)
+                return ERR_DB_FILE;
+        }
+
+        shm_attach(ss->fds[k]);
+        cdc_attach(ss->fds[k]);
+
+        //committed transactions whose writes are not durable yet, settling
+        //the log needs the exclusive lock
+        if (txn_pending(ss->fds[k]) &&
+            ((exclusive && !ss->logged) || !txn_applied(ss->fds[k]))) {
+            int rc = NO_ERROR;
+            if (!exclusive && tr_flock(ss->fds[k], LOCK_EX) == -1)
+                rc = ERR_DB_FILE;
+            if (rc == NO_ERROR)
+                rc = txn_recover(ss->fds[k]);
+            if (!exclusive && tr_flock(ss->fds[k], LOCK_SH) == -1)
+                rc = ERR_DB_FILE;
+            if (rc != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+
+        pager_drop(ss->fds[k]);
+        if (load_super(ss->fds[k], &sb) != NO_ERROR || shard_stamp(ss, k) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_zero
+ *      *ss:  open shard set, locked exclusively
+ *
+ *  Removes every record by truncating each shard in place, while the lock
+ *  is held, and writing a fresh superblock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_WRITE  error truncating a shard
+ */
+int shard_zero(shard_set_t *ss) {
+    for (int k = 0; k < ss->n; k++) {
+        db_super_t sb;
+
+        shm_invalidate(ss->fds[k]);
+        pager_drop(ss->fds[k]);
+        if (tr_ftruncate(ss->fds[k], 0) == -1) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+        cdc_reset(ss->fds[k]);
+        if (load_super(ss->fds[k], &sb) != NO_ERROR || shard_stamp(ss, k) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+//name of the copy of shard k in a backup: a single shard is copied to the
+//backup file itself, shards of a split database into a directory
+static char *shard_backup_name(shard_set_t *ss, int k, const char *dest,
+                               char *out, size_t sz) {
+    const char *base = strrchr(ss->paths[k], '/');
+
+    if (ss->n == 1)
+        snprintf(out, sz, "%s", dest);
+    else
+        snprintf(out, sz, "%s/%s", dest, base ? base + 1 : ss->paths[k]);
+    return out;
+}
+
+static int backup_job(shard_job_t *job) {
+    char dest[PATH_MAX];
+
+    shard_backup_name(job->ss, job->k, job->dir, dest, sizeof(dest));
+    return backup_db(job->ss->fds[job->k], dest);
+}
+
+//restore_db() swaps in a new file that it already locked
+static int restore_job(shard_job_t *job) {
+    char src[PATH_MAX];
+    int fd;
+
+    shard_backup_name(job->ss, job->k, job->dir, src, sizeof(src));
+    shm_invalidate(job->ss->fds[job->k]);
+    cdc_detach(job->ss->fds[job->k]);
+    fd = restore_db(job->ss->fds[job->k], src);
+    job->ss->fds[job->k] = fd;
+    if (fd < 0)
+        return ERR_DB_FILE;
+    cdc_attach(fd);
+    cdc_reset(fd);
+    return shard_stamp(job->ss, job->k);
+}
+
+/*
+ *  shard_backup
+ *      *ss:   open shard set, locked shared
+ *      dest:  backup file, or for a sharded database a directory that gets
+ *             a copy of each shard under the shard's own file name
+ *
+ *  Copies every shard with backup_db(), in parallel.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_DB_BACKUP_OK  on success
+ *            M_ERR_DB_COPY   error making a copy
+ */
+int shard_backup(shard_set_t *ss, char *dest) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+
+    if (ss->n > 1 && mkdir(dest, S_IRWXU | S_IRWXG) == -1 && errno != EEXIST) {
+        printf(M_ERR_DB_COPY);
+        return ERR_DB_FILE;
+    }
+    for (int k = 0; k < ss->n; k++) {
+        jobs[k].fn = backup_job;
+        jobs[k].dir = dest;
+    }
+    if (shard_fanout(ss, jobs) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    printf(M_DB_BACKUP_OK, dest);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_restore
+ *      *ss:  open shard set, locked exclusively
+ *      src:  backup made by shard_backup() with the same shard layout
+ *
+ *  Replaces every shard with its copy from the backup using restore_db(),
+ *  in parallel, and checks the restored files belong to this layout.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_DB_RESTORE_OK   on success
+ *            the error messages of restore_db() and shard_stamp()
+ */
+int shard_restore(shard_set_t *ss, char *src) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+
+    for (int k = 0; k < ss->n; k++) {
+        jobs[k].fn = restore_job;
+        jobs[k].dir = src;
+    }
+    if (shard_fanout(ss, jobs) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    printf(M_DB_RESTORE_OK, src);
+    return NO_ERROR;
+}
+
+static int purge_job(shard_job_t *job) {
+    job->count = purge_db(job->ss->fds[job->k], job->pred);
+    return job->count < 0 ? job->count : NO_ERROR;
+}
+
+/*
+ *  shard_purge
+ *      *ss:    open shard set, locked exclusively
+ *      *pred:  students to delete, see purge.h
+ *
+ *  Runs purge_db() on every shard in parallel.
+ *
+ *  returns:  <number>       students deleted
+ *            ERR_DB_FILE    a shard could not be purged
+ *
+ *  console:  M_STD_PURGED  on success
+ */
+int shard_purge(shard_set_t *ss, const purge_pred_t *pred) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+    int count = 0;
+
+    for (int k = 0; k < ss->n; k++) {
+        jobs[k].fn = purge_job;
+        jobs[k].pred = pred;
+    }
+    if (shard_fanout(ss, jobs) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int k = 0; k < ss->n; k++)
+        count += jobs[k].count;
+
+    printf(M_STD_PURGED, count);
+    return count;
+}
+
+/*
+ *  shard_export
+ *      *ss:   open shard set, locked shared
+ *      dest:  snapshot file
+ *
+ *  Scans every shard in parallel, merges the students by id and writes
+ *  them to one snapshot with sst_write(), see sst.h.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_SST_EXPORTED  on success
+ */
+int shard_export(shard_set_t *ss, char *dest) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+    student_t *all;
+    int n, n_blocks;
+
+    for (int k = 0; k < ss->n; k++)
+        jobs[k].fn = collect_job;
+    if (shard_fanout(ss, jobs) != NO_ERROR) {
+        shard_free_jobs(ss, jobs);
+        return ERR_DB_FILE;
+    }
+
+    all = shard_merge(ss, jobs, &n);
+    shard_free_jobs(ss, jobs);
+    if (n < 0)
+        return ERR_DB_FILE;
+    n_blocks = sst_write(dest, all, n);
+    free(all);
+    if (n_blocks < 0)
+        return ERR_DB_FILE;
+
+    printf(M_SST_EXPORTED, dest, n, n_blocks);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_parse_since
+ *      *ss:     open shard set
+ *      text:    one sequence number, or one per shard separated by commas
+ *      *since:  room for SHARD_MAX sequence numbers
+ *
+ *  Every shard has its own change log and sequence numbers.  A single
+ *  number is used for every shard.
+ *
+ *  returns:  NO_ERROR or EXIT_FAIL_ARGS
+ *
+ *  console:  M_ERR_CDC_SINCE  text cant be parsed
+ */
+int shard_parse_since(shard_set_t *ss, const char *text, long long *since) {
+    const char *p = text;
+    int n = 0;
+
+    while (n < SHARD_MAX) {
+        char *end;
+        since[n++] = strtoll(p, &end, 10);
+        if (end == p || since[n - 1] < 0 || (*end != ',' && *end != '\0'))
+            break;
+        if (*end == '\0') {
+            if (n == 1) {
+                for (int k = 1; k < ss->n; k++)
+                    since[k] = since[0];
+                return NO_ERROR;
+            }
+            if (n == ss->n)
+                return NO_ERROR;
+            break;
+        }
+        p = end + 1;
+    }
+    printf(M_ERR_CDC_SINCE, text);
+    return EXIT_FAIL_ARGS;
+}
+
+/*
+ *  shard_changes
+ *      *ss:       open shard set, locked exclusively
+ *      *since:    last sequence number the consumer has, one per shard
+ *      consumer:  name to acknowledge since under, or NULL
+ *
+ *  Prints the change log of every shard after since with cdc_stream(),
+ *  one shard after the other so the output of a shard stays in order.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP or ERR_DB_FILE, see cdc_stream()
+ */
+int shard_changes(shard_set_t *ss, const long long *since, const char *consumer) {
+    for (int k = 0; k < ss->n; k++) {
+        int rc = cdc_stream(ss->fds[k], k, since[k], consumer);
+        if (rc != NO_ERROR)
+            return rc;
+    }
+    return NO_ERROR;
+}
+
+static int shm_build_job(shard_job_t *job) {
+    return shm_build(job->ss->fds[job->k]);
+}
+
+/*
+ *  shard_shm_build
+ *      *ss:  open shard set, locked exclusively
+ *
+ *  Builds the shared memory copy of every shard with shm_build(), in
+ *  parallel.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_SHM_PUBLISHED  on success
+ */
+int shard_shm_build(shard_set_t *ss) {
+    shard_job_t jobs[SHARD_MAX] = {0};
+
+    for (int k = 0; k < ss->n; k++)
+        jobs[k].fn = shm_build_job;
+    if (shard_fanout(ss, jobs) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    printf(M_SHM_PUBLISHED);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_shm_find
+ *      id:  student id
+ *      *s:  where the student is copied
+ *
+ *  Looks a student up in the shared memory copy of its shard without
+ *  opening or locking the database, see shm.h.
+ *
+ *  returns:  NO_ERROR       student copied into *s
+ *            SRCH_NOT_FOUND no such student
+ *            ERR_DB_FILE    no valid copy, use the database
+ */
+int shard_shm_find(int id, student_t *s) {
+    shard_set_t ss;
+    shm_region_t r;
+    int rc = ERR_DB_FILE;
+
+    if (shard_layout(&ss) == NO_ERROR &&
+        shm_map(ss.paths[shard_of(&ss, id)], &r) == NO_ERROR) {
+        rc = shm_read(&r, id, s);
+        shm_unmap(&r);
+    }
+    shard_close(&ss);
+    return rc;
+}
+
+/*
+ *  shard_shm_count
+ *
+ *  Adds up the counts of the shared memory copies of every shard.
+ *
+ *  returns:  number of students, or ERR_DB_FILE if any shard has no valid
+ *            copy
+ */
+int shard_shm_count(void) {
+    shard_set_t ss;
+    int count = 0;
+
+    if (shard_layout(&ss) != NO_ERROR)
+        count = ERR_DB_FILE;
+    for (int k = 0; k < ss.n && count >= 0; k++) {
+        shm_region_t r;
+        int n = ERR_DB_FILE;
+        if (shm_map(ss.paths[k], &r) == NO_ERROR) {
+            n = shm_count(&r);
+            shm_unmap(&r);
+        }
+        count = n < 0 ? ERR_DB_FILE : count + n;
+    }
+    shard_close(&ss);
+    return count;
+}
@@ -0,0 +1,57 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <stdbool.h>
+
+#include "db.h" //get student record and superblock types
+#include "purge.h"  //get purge_pred_t
+
+//A database can be split over several files, for example on different
+//disks.  SHARD_ENV lists the files, separated by commas, and
+//SHARD_MODE_ENV picks how ids are spread over them:
+//  range:  the id range is cut into equal consecutive pieces (default)
+//  hash:   ids are hashed, which spreads sequential ids over every shard
+//
+//Every shard is a normal database file with its own superblock and
+//trigram index, and a student is stored at the same slot it would have
+//in a single file, so get/add/del only have to pick the right file.
+//Each superblock records its place in the layout so a changed SHARD_ENV
+//is caught instead of sending ids to the wrong file.  Without SHARD_ENV
+//the database is the single shard DB_FILE.
+#define SHARD_ENV       "SDBSC_SHARDS"
+#define SHARD_MODE_ENV  "SDBSC_SHARD_MODE"
+#define SHARD_MAX       64
+
+#define SHARD_RANGE     1
+#define SHARD_HASH      2
+
+#define SHARD_ALL       -1          //shard_lock() every shard
+
+typedef struct shard_set{
+    int n;                      //number of shards
+    int mode;                   //SHARD_RANGE or SHARD_HASH
+    char *paths[SHARD_MAX];     //database file of each shard
+    int fds[SHARD_MAX];         //open descriptor of each shard
+    bool logged;                //changes are only made in transactions
+} shard_set_t;
+
+int shard_open(shard_set_t *ss, bool should_truncate);
+void shard_close(shard_set_t *ss);
+int shard_fd(shard_set_t *ss, int id);
+int shard_count_records(shard_set_t *ss);
+int shard_print_db(shard_set_t *ss, int order);
+int shard_search(shard_set_t *ss, char *pattern, int max_edits);
+int shard_compress(shard_set_t *ss);
+int shard_lock(shard_set_t *ss, int id, bool exclusive);
+int shard_zero(shard_set_t *ss);
+int shard_backup(shard_set_t *ss, char *dest);
+int shard_restore(shard_set_t *ss, char *src);
+int shard_purge(shard_set_t *ss, const purge_pred_t *pred);
+int shard_export(shard_set_t *ss, char *dest);
+int shard_parse_since(shard_set_t *ss, const char *text, long long *since);
+int shard_changes(shard_set_t *ss, const long long *since, const char *consumer);
+int shard_shm_build(shard_set_t *ss);
+int shard_shm_find(int id, student_t *s);
+int shard_shm_count(void);
+
+#endif
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "shm.h"
+
+#define SHM_MAX_FDS     1024
+#define SHM_RETRIES     100000      //reads of a slot before giving up on it
+
+#define SHM_SLOTS       (MAX_STD_ID + 1)
+#define SHM_LEN         (sizeof(shm_hdr_t) + SHM_SLOTS * sizeof(shm_slot_t))
+#define REC_WORDS       (sizeof(student_t) / sizeof(uint64_t))
+
+//regions attached by writers, by database fd
+static shm_region_t *attached[SHM_MAX_FDS];
+
+/*
+ *  region_map
+ *      shm_file:  region file
+ *      writable:  map it for writing
+ *      *r:        filled in on success
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the file is missing or not a
+ *            region
+ */
+static int region_map(const char *shm_file, bool writable, shm_region_t *r) {
+    struct stat st;
+    int fd = open(shm_file, writable ? O_RDWR : O_RDONLY);
+
+    if (fd == -1)
+        return ERR_DB_FILE;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size != SHM_LEN) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    r->base = tr_mmap(NULL, SHM_LEN, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->base == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    r->len = SHM_LEN;
+    r->hdr = r->base;
+    r->slots = (shm_slot_t *)(r->hdr + 1);
+    if (r->hdr->magic != SHM_MAGIC || r->hdr->version != SHM_VERSION ||
+        r->hdr->n_slots != SHM_SLOTS) {
+        tr_munmap(r->base, r->len);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+//seqlock writer side: make seq odd, then even again in write_end()
+static uint32_t write_begin(uint32_t *seq) {
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+
+    s += s & 1;                     //a writer that died left it odd
+    __atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return s;
+}
+
+static void write_end(uint32_t *seq, uint32_t s) {
+    __atomic_store_n(seq, s + 2, __ATOMIC_RELEASE);
+}
+
+static void hdr_store(shm_hdr_t *hdr, int valid, int rec_count) {
+    uint32_t s = write_begin(&hdr->seq);
+
+    __atomic_store_n(&hdr->valid, valid, __ATOMIC_RELAXED);
+    if (rec_count >= 0)
+        __atomic_store_n(&hdr->rec_count, rec_count, __ATOMIC_RELAXED);
+    write_end(&hdr->seq, s);
+}
+
+/*
+ *  shm_map
+ *      db_file:  database the region belongs to
+ *      *r:       filled in on success
+ *
+ *  Maps the region of db_file read only.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if there is no region
+ */
+int shm_map(const char *db_file, shm_region_t *r) {
+    char shm_file[PATH_MAX];
+
+    db_path_sidecar(db_file, SHM_EXT, false, shm_file, sizeof(shm_file));
+    return region_map(shm_file, false, r);
+}
+
+void shm_unmap(shm_region_t *r) {
+    if (r->base)
+        tr_munmap(r->base, r->len);
+    r->base = NULL;
+}
+
+/*
+ *  shm_read
+ *      *r:   mapped region
+ *      id:   student id
+ *      *s:   where the student is copied
+ *
+ *  Copies one record without taking a lock.  Retries while the writer is
+ *  in the middle of changing it, and gives up if the counter never
+ *  settles, which only happens if a writer died halfway through.
+ *
+ *  returns:  NO_ERROR       student copied into *s
+ *            SRCH_NOT_FOUND the slot is empty
+ *            ERR_DB_FILE    the region is not valid, use the database
+ */
+int shm_read(shm_region_t *r, int id, student_t *s) {
+    shm_hdr_t *hdr = r->hdr;
+    uint64_t words[REC_WORDS];
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return SRCH_NOT_FOUND;
+
+    shm_slot_t *slot = &r->slots[id];
+    const uint64_t *src = (const uint64_t *)&slot->rec;
+    for (int tries = 0; tries < SHM_RETRIES; tries++) {
+        uint32_t h1 = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        uint32_t s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ((h1 | s1) & 1)
+            continue;
+
+        int valid = __atomic_load_n(&hdr->valid, __ATOMIC_RELAXED);
+        for (size_t w = 0; w < REC_WORDS; w++)
+            words[w] = __atomic_load_n(&src[w], __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != s1 ||
+            __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != h1)
+            continue;
+
+        if (!valid)
+            return ERR_DB_FILE;
+        memcpy(s, words, sizeof(*s));
+        return s->id != 0 ? NO_ERROR : SRCH_NOT_FOUND;
+    }
+    return ERR_DB_FILE;
+}
+
+/*
+ *  shm_count
+ *      *r:  mapped region
+ *
+ *  returns:  number of students, or ERR_DB_FILE if the region is not
+ *            valid
+ */
+int shm_count(shm_region_t *r) {
+    shm_hdr_t *hdr = r->hdr;
+
+    for (int tries = 0; tries < SHM_RETRIES; tries++) {
+        uint32_t h1 = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        if (h1 & 1)
+            continue;
+        int valid = __atomic_load_n(&hdr->valid, __ATOMIC_RELAXED);
+        int count = __atomic_load_n(&hdr->rec_count, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != h1)
+            continue;
+        return valid ? count : ERR_DB_FILE;
+    }
+    return ERR_DB_FILE;
+}
+
+/*
+ *  shm_attach
+ *      fd:  database opened with open_db(), locked exclusively
+ *
+ *  Maps the region of the database for writing, if it has one, so
+ *  checkpoint_db() keeps it up to date.  Called after the lock is taken
+ *  so a region built by -M in the meantime is not missed.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void shm_attach(int fd) {
+    char shm_file[PATH_MAX];
+    shm_region_t r;
+
+    if (fd < 0 || fd >= SHM_MAX_FDS)
+        return;
+    shm_detach(fd);
+
+    db_sidecar(fd, SHM_EXT, false, shm_file, sizeof(shm_file));
+    if (region_map(shm_file, true, &r) != NO_ERROR)
+        return;
+    attached[fd] = malloc(sizeof(r));
+    if (attached[fd] == NULL) {
+        tr_munmap(r.base, r.len);
+        return;
+    }
+    *attached[fd] = r;
+}
+
+void shm_detach(int fd) {
+    if (fd < 0 || fd >= SHM_MAX_FDS || attached[fd] == NULL)
+        return;
+    shm_unmap(attached[fd]);
+    free(attached[fd]);
+    attached[fd] = NULL;
+}
+
+bool shm_attached(int fd) {
+    return fd >= 0 && fd < SHM_MAX_FDS && attached[fd] != NULL;
+}
+
+/*
+ *  shm_publish
+ *      fd:     database with an attached region
+ *      off:    file offset of a 64 byte slot that was written to the file
+ *      *slot:  its contents
+ *
+ *  Copies a student into its slot, or the count from the superblock in
+ *  slot 0 into the header.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void shm_publish(int fd, off_t off, const void *slot) {
+    if (!shm_attached(fd))
+        return;
+
+    shm_region_t *r = attached[fd];
+    int id = off / STUDENT_RECORD_SIZE;
+
+    if (id == SUPER_SLOT) {
+        const db_super_t *sb = slot;
+        hdr_store(r->hdr, r->hdr->valid, sb->rec_count);
+        return;
+    }
+    if (id > MAX_STD_ID)
+        return;
+
+    shm_slot_t *dst = &r->slots[id];
+    const uint64_t *src = slot;
+    uint64_t *words = (uint64_t *)&dst->rec;
+    uint32_t s = write_begin(&dst->seq);
+    for (size_t w = 0; w < REC_WORDS; w++)
+        __atomic_store_n(&words[w], src[w], __ATOMIC_RELAXED);
+    write_end(&dst->seq, s);
+}
+
+/*
+ *  shm_invalidate
+ *      fd:  database with or without an attached region
+ *
+ *  Sends readers back to the database until the region is rebuilt.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void shm_invalidate(int fd) {
+    if (shm_attached(fd))
+        hdr_store(attached[fd]->hdr, 0, -1);
+}
+
+//scan_db() callback for shm_build(), the region is private until renamed
+static int build_one(student_t *s, void *arg) {
+    shm_region_t *r = arg;
+
+    //a damaged record can hold any id, shm_read() never looks those up
+    if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+        return 0;
+    r->slots[s->id].rec = *s;
+    return 0;
+}
+
+/*
+ *  shm_build
+ *      fd:  database opened with open_db(), locked exclusively
+ *
+ *  Builds a new region from the database in a temporary file, renames it
+ *  over the old one and attaches it.  The old region is invalidated first
+ *  so readers that still map it move on.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_CREATE  error creating the region file
+ */
+int shm_build(int fd) {
+    char shm_file[PATH_MAX];
+    char tmp_file[PATH_MAX];
+    db_super_t sb;
+    shm_region_t r;
+
+    db_sidecar(fd, SHM_EXT, false, shm_file, sizeof(shm_file));
+    db_sidecar(fd, SHM_EXT, true, tmp_file, sizeof(tmp_file));
+
+    int shm_fd = open(tmp_file, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (shm_fd == -1 || tr_ftruncate(shm_fd, SHM_LEN) == -1) {
+        if (shm_fd != -1)
+            close(shm_fd);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    r.base = tr_mmap(NULL, SHM_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (r.base == MAP_FAILED) {
+        unlink(tmp_file);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    r.len = SHM_LEN;
+    r.hdr = r.base;
+    r.slots = (shm_slot_t *)(r.hdr + 1);
+    r.hdr->magic = SHM_MAGIC;
+    r.hdr->version = SHM_VERSION;
+    r.hdr->n_slots = SHM_SLOTS;
+
+    int rc = read_super(fd, &sb);
+    if (rc == NO_ERROR)
+        rc = scan_db(fd, build_one, &r);
+    if (rc == NO_ERROR) {
+        r.hdr->rec_count = sb.rec_count;
+        r.hdr->valid = 1;
+    }
+    shm_unmap(&r);
+
+    if (rc != NO_ERROR) {
+        unlink(tmp_file);
+        return ERR_DB_FILE;
+    }
+
+    shm_invalidate(fd);
+    if (rename(tmp_file, shm_file) != 0) {
+        unlink(tmp_file);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    shm_attach(fd);
+    return NO_ERROR;
+}
@@ -0,0 +1,75 @@
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "db.h"     //get student record type
+
+//A copy of the database that readers on the same host can use without
+//locks or system calls, kept in a file next to it (SHM_EXT) that every
+//process maps shared.  It has a header and one slot per possible id, and
+//every slot, and the header, is guarded by a sequence counter (a seqlock):
+//
+//  writer:  seq++ (odd), store the record, seq++ (even)
+//  reader:  read seq, copy the record, read seq again; retry if seq was
+//           odd or changed
+//
+//Only processes holding the exclusive database lock write the region, so
+//there is one writer at a time and readers never wait for it.  Records are
+//published by checkpoint_db() once they are in the database file, so the
+//region never shows a change that could still be lost.
+//
+//-M builds the region from the database.  Operations that change the
+//file behind the pager's back (-z, -R, holes punched by -D, recovering a
+//crash) clear the header's valid flag instead of fixing every slot.
+//Readers then fall back to the database until -M is run again.  A rebuild creates a new
+//file and renames it in place, so a mapping is never truncated under a
+//reader.  Long lived readers should map again when shm_read() reports
+//the region invalid.
+//
+//Enabled for -f and -c by setting SHM_ENV=1.
+#define SHM_EXT         ".shm"
+#define SHM_ENV         "SDBSC_SHM"
+#define SHM_MAGIC       0x4d485353          //"SSHM"
+#define SHM_VERSION     1
+
+typedef struct shm_hdr{
+    int magic;              //SHM_MAGIC
+    int version;            //SHM_VERSION
+    uint32_t seq;           //seqlock over valid and rec_count
+    int valid;              //0 while building or after an invalidation
+    int rec_count;          //live students
+    int n_slots;            //MAX_STD_ID + 1
+    char reserved[40];
+} shm_hdr_t;
+
+typedef struct shm_slot{
+    uint32_t seq;           //seqlock over rec
+    uint32_t pad;
+    student_t rec;          //all zeros for an empty slot
+} shm_slot_t;
+
+typedef struct shm_region{
+    void *base;
+    size_t len;
+    shm_hdr_t *hdr;
+    shm_slot_t *slots;
+} shm_region_t;
+
+//readers
+int shm_map(const char *db_file, shm_region_t *r);
+void shm_unmap(shm_region_t *r);
+int shm_read(shm_region_t *r, int id, student_t *s);
+int shm_count(shm_region_t *r);
+
+//writers, fd is a database opened with open_db() and locked exclusively
+void shm_attach(int fd);
+void shm_detach(int fd);
+bool shm_attached(int fd);
+void shm_publish(int fd, off_t off, const void *slot);
+void shm_invalidate(int fd);
+int shm_build(int fd);
+
+#endif
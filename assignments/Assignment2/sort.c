@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "sort.h"
+
+//students buffered by sort_print(), and the runs written so far
+typedef struct sorter{
+    int order;              //SORT_LNAME or SORT_GPA
+    student_t *recs;
+    sort_entry_t *keys;
+    sort_entry_t *tmp;      //scratch for the radix passes
+    int n;
+    int cap;                //room allocated
+    int max;                //budget, a full buffer becomes a run
+    FILE *runs;             //temporary file, NULL until the first run
+    long long *run_start;   //first student of each run, a run ends where
+    int n_runs;             //the next one starts
+    long long n_written;
+    bool header_printed;
+} sorter_t;
+
+//one run being merged
+typedef struct run_cursor{
+    student_t buf[SORT_MERGE_RECS];
+    int pos;
+    int len;
+    long long next;         //next student of the run to read
+    long long end;
+} run_cursor_t;
+
+/*
+ *  sort_parse
+ *      name:  id, lname or gpa
+ *
+ *  returns:  SORT_ID, SORT_LNAME or SORT_GPA, or -1 for anything else
+ */
+int sort_parse(const char *name) {
+    if (strcmp(name, "id") == 0)
+        return SORT_ID;
+    if (strcmp(name, "lname") == 0)
+        return SORT_LNAME;
+    if (strcmp(name, "gpa") == 0)
+        return SORT_GPA;
+    return -1;
+}
+
+static uint64_t sort_key(int order, const student_t *s) {
+    uint64_t key = 0;
+
+    if (order == SORT_GPA)
+        return (uint64_t)(uint32_t)s->gpa << 32 | (uint32_t)s->id;
+
+    //bytes after the end of the name count as zeros
+    bool ended = false;
+    for (int i = 0; i < 8; i++) {
+        unsigned char c = ended ? 0 : (unsigned char)s->lname[i];
+        ended |= c == 0;
+        key = key << 8 | c;
+    }
+    return key;
+}
+
+//full comparison, the key only orders gpa completely
+static int sort_cmp(int order, const student_t *a, const student_t *b) {
+    if (order == SORT_LNAME) {
+        int c = strncmp(a->lname, b->lname, sizeof(a->lname));
+        if (c != 0)
+            return c;
+        return (a->id > b->id) - (a->id < b->id);
+    }
+    uint64_t ka = sort_key(order, a), kb = sort_key(order, b);
+    return (ka > kb) - (ka < kb);
+}
+
+//qsort_r() comparator for last names sharing a key, arg is the sorter
+static int cmp_tie(const void *a, const void *b, void *arg) {
+    sorter_t *s = arg;
+
+    return sort_cmp(s->order, &s->recs[((const sort_entry_t *)a)->idx],
+                    &s->recs[((const sort_entry_t *)b)->idx]);
+}
+
+/*
+ *  radix_sort
+ *      *a:    keys to sort
+ *      *tmp:  scratch space for n keys
+ *      n:     number of keys
+ *
+ *  LSD radix sort on the 64 bit keys.  The counts of all 8 bytes are
+ *  taken in one pass over the keys, and a byte with a single value is
+ *  skipped since its pass would not move anything.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void radix_sort(sort_entry_t *a, sort_entry_t *tmp, int n) {
+    static size_t counts[8][256];
+    sort_entry_t *src = a, *dst = tmp;
+
+    if (n < 2)
+        return;
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < n; i++) {
+        uint64_t k = a[i].key;
+        for (int b = 0; b < 8; b++)
+            counts[b][(k >> (8 * b)) & 0xff]++;
+    }
+
+    for (int b = 0; b < 8; b++) {
+        int shift = 8 * b;
+        if (counts[b][(a[0].key >> shift) & 0xff] == (size_t)n)
+            continue;
+
+        size_t sum = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t c = counts[b][d];
+            counts[b][d] = sum;
+            sum += c;
+        }
+        for (int i = 0; i < n; i++)
+            dst[counts[b][(src[i].key >> shift) & 0xff]++] = src[i];
+
+        sort_entry_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != a)
+        memcpy(a, src, n * sizeof(*a));
+}
+
+//sorts the buffered students, keys[] ends up in output order
+static void sort_buffer(sorter_t *s) {
+    radix_sort(s->keys, s->tmp, s->n);
+    if (s->order != SORT_LNAME)
+        return;
+
+    for (int i = 0; i < s->n; ) {
+        int j = i + 1;
+        while (j < s->n && s->keys[j].key == s->keys[i].key)
+            j++;
+        if (j - i > 1)
+            qsort_r(&s->keys[i], j - i, sizeof(s->keys[0]), cmp_tie, s);
+        i = j;
+    }
+}
+
+static void emit(sorter_t *s, const student_t *rec) {
+    if (!s->header_printed) {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        s->header_printed = true;
+    }
+    float gpa = rec->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, rec->id, rec->fname, rec->lname, gpa);
+}
+
+/*
+ *  write_run
+ *      *s:  sorter with a full buffer
+ *
+ *  Sorts the buffer and appends it to the run file in order,
+ *  SORT_MERGE_RECS students per write().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_run(sorter_t *s) {
+    student_t out[SORT_MERGE_RECS];
+    long long *grown;
+
+    uint64_t t = tr_start();
+    sort_buffer(s);
+    tr_stop(TR_SORT, t);
+
+    if (s->runs == NULL && (s->runs = tmpfile()) == NULL)
+        return ERR_DB_FILE;
+    grown = realloc(s->run_start, (s->n_runs + 1) * sizeof(*grown));
+    if (grown == NULL)
+        return ERR_DB_FILE;
+    s->run_start = grown;
+    s->run_start[s->n_runs++] = s->n_written;
+
+    int fd = fileno(s->runs);
+    for (int i = 0; i < s->n; ) {
+        int n = 0;
+        while (n < SORT_MERGE_RECS && i < s->n)
+            out[n++] = s->recs[s->keys[i++].idx];
+        ssize_t len = n * sizeof(student_t);
+        if (tr_pwrite(fd, out, len, s->n_written * sizeof(student_t)) != len)
+            return ERR_DB_FILE;
+        s->n_written += n;
+    }
+    s->n = 0;
+    return NO_ERROR;
+}
+
+//scan_db() callback for sort_print()
+static int sort_add(student_t *rec, void *arg) {
+    sorter_t *s = arg;
+
+    if (s->n == s->max && write_run(s) != NO_ERROR) {
+        printf(M_ERR_SORT);
+        return ERR_DB_FILE;
+    }
+    if (s->n == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 1024;
+        if (cap > s->max)
+            cap = s->max;
+        student_t *recs = realloc(s->recs, cap * sizeof(*recs));
+        if (recs != NULL)
+            s->recs = recs;
+        sort_entry_t *keys = realloc(s->keys, cap * sizeof(*keys));
+        if (keys != NULL)
+            s->keys = keys;
+        sort_entry_t *tmp = realloc(s->tmp, cap * sizeof(*tmp));
+        if (tmp != NULL)
+            s->tmp = tmp;
+        if (recs == NULL || keys == NULL || tmp == NULL) {
+            printf(M_ERR_SORT);
+            return ERR_DB_FILE;
+        }
+        s->cap = cap;
+    }
+
+    s->recs[s->n] = *rec;
+    s->keys[s->n].key = sort_key(s->order, rec);
+    s->keys[s->n].idx = s->n;
+    s->n++;
+    return NO_ERROR;
+}
+
+//refills the buffer of a run, returns false once the run is used up
+static bool run_fill(int fd, run_cursor_t *c) {
+    if (c->pos < c->len)
+        return true;
+    if (c->next >= c->end)
+        return false;
+
+    long long n = c->end - c->next;
+    if (n > SORT_MERGE_RECS)
+        n = SORT_MERGE_RECS;
+    ssize_t got = tr_pread(fd, c->buf, n * sizeof(student_t), c->next * sizeof(student_t));
+    if (got <= 0)
+        return false;
+    c->len = got / sizeof(student_t);
+    c->pos = 0;
+    c->next += c->len;
+    return c->len > 0;
+}
+
+//true if run a has to come out before run b
+static bool run_before(sorter_t *s, run_cursor_t *a, run_cursor_t *b) {
+    return sort_cmp(s->order, &a->buf[a->pos], &b->buf[b->pos]) < 0;
+}
+
+static void heap_down(sorter_t *s, run_cursor_t **heap, int n, int i) {
+    while (true) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && run_before(s, heap[l], heap[m]))
+            m = l;
+        if (r < n && run_before(s, heap[r], heap[m]))
+            m = r;
+        if (m == i)
+            return;
+        run_cursor_t *t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+/*
+ *  merge_runs
+ *      *s:  sorter whose students are all in runs
+ *
+ *  Merges the runs with a min heap of the run heads and prints the
+ *  students as they come out.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int merge_runs(sorter_t *s) {
+    int fd = fileno(s->runs);
+    run_cursor_t *cursors = calloc(s->n_runs, sizeof(*cursors));
+    run_cursor_t **heap = calloc(s->n_runs, sizeof(*heap));
+    int n = 0;
+
+    if (cursors == NULL || heap == NULL) {
+        free(cursors);
+        free(heap);
+        return ERR_DB_FILE;
+    }
+    for (int k = 0; k < s->n_runs; k++) {
+        run_cursor_t *c = &cursors[k];
+        c->next = s->run_start[k];
+        c->end = k + 1 < s->n_runs ? s->run_start[k + 1] : s->n_written;
+        if (run_fill(fd, c))
+            heap[n++] = c;
+    }
+    for (int i = n / 2 - 1; i >= 0; i--)
+        heap_down(s, heap, n, i);
+
+    while (n > 0) {
+        run_cursor_t *c = heap[0];
+        emit(s, &c->buf[c->pos++]);
+        if (!run_fill(fd, c))
+            heap[0] = heap[--n];
+        heap_down(s, heap, n, 0);
+    }
+
+    //a run that stopped early could not be read
+    int rc = NO_ERROR;
+    for (int k = 0; k < s->n_runs; k++) {
+        if (cursors[k].next != cursors[k].end)
+            rc = ERR_DB_FILE;
+    }
+    free(cursors);
+    free(heap);
+    return rc;
+}
+
+//budget in students, each needs its record and two keys
+static int sort_budget(void) {
+    const char *env = getenv(SORT_MEM_ENV);
+    long long bytes = env ? atoll(env) : 0;
+
+    if (bytes <= 0)
+        bytes = SORT_MEM;
+    long long max = bytes / (sizeof(student_t) + 2 * sizeof(sort_entry_t));
+    if (max < SORT_MERGE_RECS)
+        max = SORT_MERGE_RECS;
+    if (max > MAX_STD_ID)
+        max = MAX_STD_ID;
+    return max;
+}
+
+/*
+ *  sort_print
+ *      *fds:   database files, every shard
+ *      n_fds:  number of files
+ *      order:  SORT_LNAME or SORT_GPA
+ *
+ *  Prints every student in the order wanted, see sort.h.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  the same as print_db()
+ *            M_ERR_SORT  the students could not be buffered or the runs
+ *                        written
+ */
+int sort_print(const int *fds, int n_fds, int order) {
+    sorter_t s = { .order = order, .max = sort_budget() };
+    int rc = NO_ERROR;
+
+    for (int k = 0; k < n_fds && rc == NO_ERROR; k++)
+        rc = scan_db(fds[k], sort_add, &s);
+
+    uint64_t t;
+    if (rc == NO_ERROR && s.runs == NULL) {
+        t = tr_start();
+        sort_buffer(&s);
+        tr_stop(TR_SORT, t);
+        t = tr_start();
+        for (int i = 0; i < s.n; i++)
+            emit(&s, &s.recs[s.keys[i].idx]);
+        tr_stop(TR_FORMAT, t);
+    } else if (rc == NO_ERROR) {
+        if (s.n > 0 && write_run(&s) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        free(s.recs);
+        free(s.keys);
+        free(s.tmp);
+        s.recs = NULL;
+        s.keys = s.tmp = NULL;
+        t = tr_start();
+        if (rc == NO_ERROR)
+            rc = merge_runs(&s);
+        tr_stop(TR_FORMAT, t);
+        if (rc != NO_ERROR)
+            printf(M_ERR_SORT);
+    }
+
+    if (rc == NO_ERROR && !s.header_printed)
+        printf(M_DB_EMPTY);
+    free(s.recs);
+    free(s.keys);
+    free(s.tmp);
+    free(s.run_start);
+    if (s.runs != NULL)
+        fclose(s.runs);
+    return rc == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+}
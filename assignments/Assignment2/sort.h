@@ -0,0 +1,40 @@
+#ifndef __SORT_H__
+#define __SORT_H__
+
+#include <stdint.h>
+
+#include "db.h"     //get student record type
+
+//-p --order-by lname|gpa prints the students in another order than id
+//without turning them into text first.  Every student gets a 64 bit key
+//that sorts like the order wanted:
+//
+//  gpa:    gpa in the high 32 bits, id in the low ones
+//  lname:  the first 8 bytes of the last name, big endian
+//
+//The keys are sorted with an LSD radix sort, one pass per byte, and
+//bytes that are the same for every key are skipped, so a gpa order is
+//mostly 3 passes.  Last names that share the 8 byte prefix are put in
+//order afterwards by comparing the whole name, then the id.
+//
+//Up to SORT_MEM_ENV bytes (SORT_MEM by default) of students are sorted
+//in memory.  Past that each full buffer is sorted and written as a run
+//to a temporary file, and the runs are merged with a heap while
+//printing.  Text is only formatted for the final output.
+#define SORT_MEM_ENV    "SDBSC_SORT_MEM"
+#define SORT_MEM        (64 * 1024 * 1024)
+#define SORT_MERGE_RECS 256         //students read per run while merging
+
+#define SORT_ID         1
+#define SORT_LNAME      2
+#define SORT_GPA        3
+
+typedef struct sort_entry{
+    uint64_t key;
+    uint32_t idx;           //student the key belongs to
+} sort_entry_t;
+
+int sort_parse(const char *name);
+int sort_print(const int *fds, int n_fds, int order);
+
+#endif
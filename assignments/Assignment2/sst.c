@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "sst.h"
+
+static unsigned int sst_checksum(const unsigned char *p, size_t len) {
+    unsigned int hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static int put_varint(unsigned char *p, unsigned int v) {
+    int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+//returns bytes used, or 0 if the varint runs past end
+static int get_varint(const unsigned char *p, const unsigned char *end, unsigned int *v) {
+    int n = 0;
+
+    *v = 0;
+    for (int shift = 0; p + n < end && shift < 35; shift += 7) {
+        unsigned char b = p[n++];
+        *v |= (unsigned int)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return n;
+    }
+    return 0;
+}
+
+static int put_name(unsigned char *p, const char *name, size_t max) {
+    size_t len = strnlen(name, max);
+
+    p[0] = len;
+    memcpy(p + 1, name, len);
+    return len + 1;
+}
+
+/*
+ *  encode_record
+ *      *p:     output, room for SST_REC_MAX bytes
+ *      *s:     student
+ *      prev:   id of the previous student in the block, 0 for the first
+ *
+ *  returns:  bytes written
+ */
+static int encode_record(unsigned char *p, const student_t *s, int prev) {
+    int n = put_varint(p, s->id - prev);
+
+    n += put_varint(p + n, s->gpa);
+    n += put_name(p + n, s->fname, sizeof(s->fname) - 1);
+    n += put_name(p + n, s->lname, sizeof(s->lname) - 1);
+    return n;
+}
+
+//writes len bytes or fails
+static int write_all(int fd, const void *buf, size_t len) {
+    return tr_write(fd, buf, len) == (ssize_t)len ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  sst_write
+ *      path:   snapshot file
+ *      *recs:  live students sorted by id
+ *      n:      number of students
+ *
+ *  Writes the snapshot described in sst.h to a temporary file, syncs it
+ *  and renames it to path.
+ *
+ *  returns:  number of blocks written, or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_CREATE  error writing the snapshot
+ */
+int sst_write(const char *path, const student_t *recs, int n) {
+    char tmp_file[PATH_MAX];
+    unsigned char block[SST_BLOCK + SST_REC_MAX];
+    sst_hdr_t hdr = { SST_MAGIC, SST_VERSION, n, 0, sizeof(sst_hdr_t), {0} };
+    sst_index_t *index = NULL;
+    int cap = 0;
+    int rc = NO_ERROR;
+
+    db_path_sidecar(path, "", true, tmp_file, sizeof(tmp_file));
+    int fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1) {
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    rc = write_all(fd, &hdr, sizeof(hdr));
+
+    for (int i = 0; i < n && rc == NO_ERROR; ) {
+        sst_index_t ix = { recs[i].id, recs[i].id, recs[i].gpa, recs[i].gpa, 0, 0,
+                           hdr.index_off, 0, 0 };
+        int prev = 0;
+
+        //a block ends at the first record that crosses SST_BLOCK
+        while (i < n && ix.len < SST_BLOCK) {
+            const student_t *s = &recs[i++];
+            ix.len += encode_record(block + ix.len, s, prev);
+            prev = s->id;
+            ix.last_id = s->id;
+            if (s->gpa < ix.min_gpa)
+                ix.min_gpa = s->gpa;
+            if (s->gpa > ix.max_gpa)
+                ix.max_gpa = s->gpa;
+            ix.n_recs++;
+        }
+        ix.checksum = sst_checksum(block, ix.len);
+
+        if (hdr.n_blocks == cap) {
+            cap = cap ? cap * 2 : 64;
+            sst_index_t *grown = realloc(index, cap * sizeof(*index));
+            if (grown == NULL) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            index = grown;
+        }
+        index[hdr.n_blocks++] = ix;
+        hdr.index_off += ix.len;
+        rc = write_all(fd, block, ix.len);
+    }
+
+    if (rc == NO_ERROR)
+        rc = write_all(fd, index, hdr.n_blocks * sizeof(*index));
+    if (rc == NO_ERROR && tr_pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && tr_fsync(fd) == -1)
+        rc = ERR_DB_FILE;
+    free(index);
+    close(fd);
+
+    if (rc == NO_ERROR && rename(tmp_file, path) != 0)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR) {
+        unlink(tmp_file);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    return hdr.n_blocks;
+}
+
+/*
+ *  check_index
+ *      *sst:  snapshot with its header and index read
+ *
+ *  Every block has to lie between the header and the index and be no
+ *  longer than sst_write() makes one, with no more students than its
+ *  bytes can encode (4 each at least), and the blocks have to add up to
+ *  the students in the header.  sst_block() then never reads outside
+ *  the file or allocates for a count the file cannot hold.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int check_index(const sst_t *sst) {
+    long long n_recs = 0;
+
+    for (int b = 0; b < sst->hdr.n_blocks; b++) {
+        const sst_index_t *ix = &sst->index[b];
+
+        if (ix->len < 0 || ix->len > SST_BLOCK + SST_REC_MAX ||
+            ix->off < (long long)sizeof(sst_hdr_t) ||
+            ix->off > sst->hdr.index_off - ix->len ||
+            ix->n_recs < 0 || ix->n_recs > ix->len / 4)
+            return ERR_DB_FILE;
+        n_recs += ix->n_recs;
+    }
+    return n_recs == sst->hdr.n_recs ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  sst_open
+ *      path:  snapshot file
+ *      *sst:  filled in on success
+ *
+ *  Reads the header and the whole index, and checks both against the
+ *  size of the file.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if path is not a snapshot or is
+ *            damaged
+ */
+int sst_open(const char *path, sst_t *sst) {
+    memset(sst, 0, sizeof(*sst));
+    for (int i = 0; i < SST_CACHE; i++)
+        sst->cache[i].block = -1;
+
+    sst->fd = open(path, O_RDONLY);
+    if (sst->fd == -1)
+        return ERR_DB_FILE;
+
+    sst_hdr_t *hdr = &sst->hdr;
+    struct stat st;
+    size_t len;
+    if (fstat(sst->fd, &st) == -1 ||
+        tr_pread(sst->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+        hdr->magic != SST_MAGIC || hdr->version != SST_VERSION ||
+        hdr->n_blocks < 0 || hdr->n_recs < 0 ||
+        hdr->index_off < (long long)sizeof(*hdr) || hdr->index_off > st.st_size ||
+        hdr->n_blocks > (st.st_size - hdr->index_off) / (long long)sizeof(sst_index_t))
+        goto fail;
+
+    len = (size_t)hdr->n_blocks * sizeof(sst_index_t);
+    sst->index = malloc(len ? len : 1);
+    if (sst->index == NULL || tr_pread(sst->fd, sst->index, len, hdr->index_off) != (ssize_t)len ||
+        check_index(sst) != NO_ERROR)
+        goto fail;
+    return NO_ERROR;
+
+fail:
+    sst_close(sst);
+    return ERR_DB_FILE;
+}
+
+void sst_close(sst_t *sst) {
+    for (int i = 0; i < SST_CACHE; i++) {
+        free(sst->cache[i].recs);
+        sst->cache[i].recs = NULL;
+        sst->cache[i].block = -1;
+    }
+    free(sst->index);
+    sst->index = NULL;
+    if (sst->fd != -1)
+        close(sst->fd);
+    sst->fd = -1;
+}
+
+/*
+ *  decode_block
+ *      *ix:    index entry of the block
+ *      *p:     its encoded bytes
+ *      *recs:  room for ix->n_recs students
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the block is damaged
+ */
+static int decode_block(const sst_index_t *ix, const unsigned char *p, student_t *recs) {
+    const unsigned char *end = p + ix->len;
+    int prev = 0;
+
+    if (sst_checksum(p, ix->len) != ix->checksum)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < ix->n_recs; i++) {
+        student_t *s = &recs[i];
+        unsigned int delta, gpa;
+        int n;
+
+        memset(s, 0, sizeof(*s));
+        if ((n = get_varint(p, end, &delta)) == 0)
+            return ERR_DB_FILE;
+        p += n;
+        if ((n = get_varint(p, end, &gpa)) == 0)
+            return ERR_DB_FILE;
+        p += n;
+        s->id = prev + delta;
+        s->gpa = gpa;
+        prev = s->id;
+
+        if (p >= end || p[0] >= sizeof(s->fname) || p + 1 + p[0] >= end)
+            return ERR_DB_FILE;
+        memcpy(s->fname, p + 1, p[0]);
+        p += 1 + p[0];
+        if (p[0] >= sizeof(s->lname) || p + 1 + p[0] > end)
+            return ERR_DB_FILE;
+        memcpy(s->lname, p + 1, p[0]);
+        p += 1 + p[0];
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  sst_block
+ *      *sst:  open snapshot
+ *      b:     block number
+ *
+ *  Finds block b in the cache or reads and decodes it, evicting the entry
+ *  the clock hand stops at.
+ *
+ *  returns:  the decoded students of the block, NULL on error
+ */
+static student_t *sst_block(sst_t *sst, int b) {
+    sst_index_t *ix = &sst->index[b];
+
+    for (int i = 0; i < SST_CACHE; i++) {
+        if (sst->cache[i].block == b) {
+            sst->cache[i].ref = true;
+            tr_cache(true);
+            return sst->cache[i].recs;
+        }
+    }
+    tr_cache(false);
+
+    sst_cached_t *c;
+    while (true) {
+        c = &sst->cache[sst->hand];
+        sst->hand = (sst->hand + 1) % SST_CACHE;
+        if (c->block == -1 || !c->ref)
+            break;
+        c->ref = false;
+    }
+
+    unsigned char *buf = malloc(ix->len ? ix->len : 1);
+    student_t *recs = realloc(c->recs, (ix->n_recs ? ix->n_recs : 1) * sizeof(student_t));
+    if (recs != NULL)
+        c->recs = recs;
+    c->block = -1;
+    if (buf == NULL || recs == NULL ||
+        tr_pread(sst->fd, buf, ix->len, ix->off) != ix->len ||
+        decode_block(ix, buf, recs) != NO_ERROR) {
+        free(buf);
+        return NULL;
+    }
+    free(buf);
+
+    c->block = b;
+    c->ref = true;
+    return recs;
+}
+
+/*
+ *  sst_find
+ *      *sst:  open snapshot
+ *      id:    student id
+ *      *s:    where the student is copied
+ *
+ *  Binary searches the index for the block that can hold id, then the
+ *  block itself.
+ *
+ *  returns:  NO_ERROR       student copied into *s
+ *            SRCH_NOT_FOUND no such student
+ *            ERR_DB_FILE    the block could not be read
+ */
+int sst_find(sst_t *sst, int id, student_t *s) {
+    int lo = 0, hi = sst->hdr.n_blocks - 1;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        sst_index_t *ix = &sst->index[mid];
+
+        if (id < ix->first_id) {
+            hi = mid - 1;
+        } else if (id > ix->last_id) {
+            lo = mid + 1;
+        } else {
+            student_t *recs = sst_block(sst, mid);
+            if (recs == NULL)
+                return ERR_DB_FILE;
+
+            int l = 0, h = ix->n_recs - 1;
+            while (l <= h) {
+                int m = l + (h - l) / 2;
+                if (recs[m].id == id) {
+                    *s = recs[m];
+                    return NO_ERROR;
+                }
+                if (recs[m].id < id)
+                    l = m + 1;
+                else
+                    h = m - 1;
+            }
+            return SRCH_NOT_FOUND;
+        }
+    }
+    return SRCH_NOT_FOUND;
+}
+
+/*
+ *  sst_scan_gpa
+ *      *sst:     open snapshot
+ *      min_gpa:  lowest gpa wanted
+ *      max_gpa:  highest gpa wanted
+ *      fn:       called for every student in the range, in id order
+ *      arg:      passed through to fn
+ *
+ *  Skips every block whose gpa summary lies outside the range.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE if a block could not be read, or the
+ *            non-zero value fn returned to stop the scan
+ */
+int sst_scan_gpa(sst_t *sst, int min_gpa, int max_gpa, sst_fn fn, void *arg) {
+    for (int b = 0; b < sst->hdr.n_blocks; b++) {
+        sst_index_t *ix = &sst->index[b];
+
+        if (ix->max_gpa < min_gpa || ix->min_gpa > max_gpa)
+            continue;
+
+        student_t *recs = sst_block(sst, b);
+        if (recs == NULL)
+            return ERR_DB_FILE;
+        for (int i = 0; i < ix->n_recs; i++) {
+            if (recs[i].gpa >= min_gpa && recs[i].gpa <= max_gpa) {
+                int rc = fn(&recs[i], arg);
+                if (rc != 0)
+                    return rc;
+            }
+        }
+    }
+    return NO_ERROR;
+}
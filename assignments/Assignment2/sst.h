@@ -0,0 +1,80 @@
+#ifndef __SST_H__
+#define __SST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"     //get student record type
+
+//A snapshot written by -E is a read only copy of the database for
+//replicas that only query it.  Instead of a 64 byte slot per possible id
+//it stores the live students sorted by id and packed into blocks of about
+//SST_BLOCK bytes:
+//
+//  header    sst_hdr_t at offset 0
+//  blocks    records encoded as varint(id - previous id in the block),
+//            varint(gpa), then each name as a length byte and its bytes
+//  index     one sst_index_t per block, at hdr.index_off
+//
+//The index is small and read whole when the snapshot is opened.  It keeps
+//the first and last id of each block, so a lookup binary searches it for
+//the one block that can hold the id, and the min and max gpa, so a gpa
+//range query skips the blocks that cannot have a match.  Decoded blocks
+//are kept in a cache of SST_CACHE blocks, evicted with the same CLOCK
+//algorithm as the pager, so repeated lookups in the same block read the
+//file once.  Each block carries an FNV-1a checksum in the index.
+//
+//A snapshot is written to a temporary file and renamed into place, so a
+//replica never opens a half written one.  -Q and -G read it without
+//opening the database.
+#define SST_MAGIC       0x54535353          //"SSST"
+#define SST_VERSION     1
+#define SST_BLOCK       4096                //target encoded block size
+#define SST_REC_MAX     (5 + 5 + 1 + 24 + 1 + 32)  //largest encoded record
+#define SST_CACHE       16                  //decoded blocks kept
+
+typedef struct sst_hdr{
+    int magic;              //SST_MAGIC
+    int version;            //SST_VERSION
+    int n_recs;             //students in the snapshot
+    int n_blocks;           //entries in the index
+    long long index_off;    //file offset of the index
+    char reserved[40];
+} sst_hdr_t;
+
+typedef struct sst_index{
+    int first_id;           //lowest id in the block
+    int last_id;            //highest id in the block
+    int min_gpa;            //lowest gpa in the block
+    int max_gpa;            //highest gpa in the block
+    int n_recs;             //students in the block
+    int len;                //encoded bytes
+    long long off;          //file offset of the block
+    unsigned int checksum;  //FNV-1a of the encoded bytes
+    int reserved;
+} sst_index_t;
+
+typedef struct sst_cached{
+    int block;              //index of the block, -1 for a free entry
+    bool ref;               //used since the clock hand last passed
+    student_t *recs;        //decoded students, sorted by id
+} sst_cached_t;
+
+typedef struct sst{
+    int fd;
+    sst_hdr_t hdr;
+    sst_index_t *index;
+    sst_cached_t cache[SST_CACHE];
+    int hand;
+} sst_t;
+
+//called by sst_scan_gpa() with every student in the gpa range
+typedef int (*sst_fn)(const student_t *s, void *arg);
+
+int sst_write(const char *path, const student_t *recs, int n);
+int sst_open(const char *path, sst_t *sst);
+void sst_close(sst_t *sst);
+int sst_find(sst_t *sst, int id, student_t *s);
+int sst_scan_gpa(sst_t *sst, int min_gpa, int max_gpa, sst_fn fn, void *arg);
+
+#endif
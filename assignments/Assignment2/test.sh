@@ -1,248 +1,714 @@
-#!/usr/bin/env bats
-
-# The setup function runs before every test
-setup_file() {
-    # Delete the student.db file if it exists
-    if [ -f "student.db" ]; then
-        rm "student.db"
-    fi
-}
-
-@test "Check if database is empty to start" {
-    run ./sdbsc -p
-    [ "$status" -eq 0 ]
-    [ "$output" = "Database contains no student records." ]
-}
-
-@test "Add a student 1 to db" {
-    run ./sdbsc -a 1      john doe 3.45
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 1 added to database." ]
-}
-
-@test "Add more students to db" {
-    run ./sdbsc -a 3      jane  doe  3.90
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 3 added to database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-
-    run ./sdbsc -a 63     jim   doe  2.85
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 63 added to database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-
-    run ./sdbsc -a 64     janet doe  3.10
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 64 added to database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-
-    run ./sdbsc -a 99999  big   dude 2.05
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 99999 added to database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Check student count" {
-    run ./sdbsc -c
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Database contains 5 student record(s)." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Make sure adding duplicate student fails" {
-    run ./sdbsc -a 63 dup student 300
-    [ "$status" -eq 1 ]  || {
-        echo "Expecting status of 1, got:  $status"
-        return 1
-    }
-    [ "${lines[0]}" = "Cant add student with ID=63, already exists in db." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Make sure the file size is correct at this time" {
-    run stat --format="%s" ./student.db
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "6400000" ] || {
-        echo "Failed Output:  $output"
-        echo "Expected: 64000000"
-        return 1
-    }
-}
-
-#@test "Make sure the file storage is correct at this time" {
-#    run du -h ./student.db
-#   [ "$status" -eq 0 ]
-#    #note du -h puts a tab between the 2 fields need to match on that
-#    [ "$output" = "12K$(echo -e '\t')./student.db" ] || {
-#        echo "Failed Output:  $output"
-#        echo "12K     ./student.db"
-#        return 1
-#    }
-#}
-
-@test "Find student 3 in db" {
-    run ./sdbsc -f 3
-    
-    # Ensure the command ran successfully
-    [ "$status" -eq 0 ]
-    
-    # Use echo with -n to avoid adding extra newline and normalize spaces
-    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
-
-    # Define the expected output
-    expected_output="3 jane doe 0.03"
-
-    # Compare the normalized output with the expected output
-    [ "$normalized_output" = "$expected_output" ] || {
-        echo "Failed Output:  $normalized_output"
-        echo "Expected: $expected_output"
-        return 1
-    }
-}
-
-@test "Try looking up non-existent student" {
-    run ./sdbsc -f 4
-    [ "$status" -eq 1 ]  || {
-        echo "Expecting status of 1, got:  $status"
-        return 1
-    }
-    [ "${lines[0]}" = "Student 4 was not found in database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Delete student 64 in db" {
-    run ./sdbsc -d 64
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 64 was deleted from database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Try deleting non-existent student" {
-    run ./sdbsc -d 65
-    [ "$status" -eq 1 ]  || {
-        echo "Expecting status of 1, got:  $status"
-        return 1
-    }
-    [ "${lines[0]}" = "Student 65 was not found in database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Check student count again, should be 4 now" {
-    run ./sdbsc -c
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Database contains 4 student record(s)." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Print student records" {
-    # Run the command
-    run ./sdbsc -p
-
-    # Ensure the command ran successfully
-    [ "$status" -eq 0 ]
-
-    # Normalize the output by replacing multiple spaces with a single space
-    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
-
-    # Define the expected output (normalized)
-    expected_output="ID FIRST NAME LAST_NAME GPA 1 john doe 0.03 3 jane doe 0.03 63 jim doe 0.02 99999 big dude 0.02"
-
-    # Compare the normalized output
-    [ "$normalized_output" = "$expected_output" ] || {
-        echo "Failed Output: $normalized_output"
-        echo "Expected Output: $expected_output"
-        return 1
-    }
-}
-
-#if you implemented the compress db function remove the 
-#skip from the tests below
-
-#@test "Double check storage at this point" {
-#    run du -h ./student.db
-#    [ "$status" -eq 0 ]
-#    #note du -h puts a tab between the 2 fields need to match on that
-#    [ "$output" = "12K$(echo -e '\t')./student.db" ] || {
-#        echo "Failed Output:  $output"
-#        echo "12K     ./student.db"
-#        return 1
-#    }
-#}
-
-@test "Compress db - try 1" {
-    skip
-    run ./sdbsc -x
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Database successfully compressed!" ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-#@test "One block should be gone" {
-#    run du -h ./student.db
-#    [ "$status" -eq 0 ]
-#    #note du -h puts a tab between the 2 fields need to match on that
-#    [ "$output" = "8.0K$(echo -e '\t')./student.db" ] || {
-#        echo "Failed Output:  $output"
-#        echo "8.0K     ./student.db"
-#        return 1
-#    }
-#}
-
-@test "Delete student 99999 in db" {
-    skip
-    run ./sdbsc -d 99999
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Student 99999 was deleted from database." ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-@test "Compress db again - try 2" {
-    skip
-    run ./sdbsc -x
-    [ "$status" -eq 0 ]
-    [ "${lines[0]}" = "Database successfully compressed!" ] || {
-        echo "Failed Output:  $output"
-        return 1
-    }
-}
-
-#@test "Should be down to 1 block" {
-#    run du -h ./student.db
-#    [ "$status" -eq 0 ]
-#    #note du -h puts a tab between the 2 fields need to match on that
-#    [ "$output" = "4.0K$(echo -e '\t')./student.db" ] || {
-#        echo "Failed Output:  $output"
-#        echo "4.0K     ./student.db"
-#        return 1
-#    }
-#}
-
-
-
-
-
-
+#!/usr/bin/env bats
+
+# The setup function runs before every test
+setup_file() {
+    # Delete the student.db file if it exists
+    if [ -f "student.db" ]; then
+        rm "student.db"
+    fi
+}
+
+@test "Check if database is empty to start" {
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "Database contains no student records." ]
+}
+
+@test "Add a student 1 to db" {
+    run ./sdbsc -a 1      john doe 3.45
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 1 added to database." ]
+}
+
+@test "Add more students to db" {
+    run ./sdbsc -a 3      jane  doe  3.90
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 3 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -a 63     jim   doe  2.85
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 63 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -a 64     janet doe  3.10
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 64 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -a 99999  big   dude 2.05
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 99999 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Check student count" {
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 5 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Make sure adding duplicate student fails" {
+    run ./sdbsc -a 63 dup student 300
+    [ "$status" -eq 1 ]  || {
+        echo "Expecting status of 1, got:  $status"
+        return 1
+    }
+    [ "${lines[0]}" = "Cant add student with ID=63, already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Make sure the file size is correct at this time" {
+    run stat --format="%s" ./student.db
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "6400000" ] || {
+        echo "Failed Output:  $output"
+        echo "Expected: 64000000"
+        return 1
+    }
+}
+
+#@test "Make sure the file storage is correct at this time" {
+#    run du -h ./student.db
+#   [ "$status" -eq 0 ]
+#    #note du -h puts a tab between the 2 fields need to match on that
+#    [ "$output" = "12K$(echo -e '\t')./student.db" ] || {
+#        echo "Failed Output:  $output"
+#        echo "12K     ./student.db"
+#        return 1
+#    }
+#}
+
+@test "Find student 3 in db" {
+    run ./sdbsc -f 3
+    
+    # Ensure the command ran successfully
+    [ "$status" -eq 0 ]
+    
+    # Use echo with -n to avoid adding extra newline and normalize spaces
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+
+    # Define the expected output
+    expected_output="3 jane doe 0.03"
+
+    # Compare the normalized output with the expected output
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output:  $normalized_output"
+        echo "Expected: $expected_output"
+        return 1
+    }
+}
+
+@test "Try looking up non-existent student" {
+    run ./sdbsc -f 4
+    [ "$status" -eq 1 ]  || {
+        echo "Expecting status of 1, got:  $status"
+        return 1
+    }
+    [ "${lines[0]}" = "Student 4 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Delete student 64 in db" {
+    run ./sdbsc -d 64
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 64 was deleted from database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Try deleting non-existent student" {
+    run ./sdbsc -d 65
+    [ "$status" -eq 1 ]  || {
+        echo "Expecting status of 1, got:  $status"
+        return 1
+    }
+    [ "${lines[0]}" = "Student 65 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Check student count again, should be 4 now" {
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 4 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Print student records" {
+    # Run the command
+    run ./sdbsc -p
+
+    # Ensure the command ran successfully
+    [ "$status" -eq 0 ]
+
+    # Normalize the output by replacing multiple spaces with a single space
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+
+    # Define the expected output (normalized)
+    expected_output="ID FIRST NAME LAST_NAME GPA 1 john doe 0.03 3 jane doe 0.03 63 jim doe 0.02 99999 big dude 0.02"
+
+    # Compare the normalized output
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+#if you implemented the compress db function remove the 
+#skip from the tests below
+
+#@test "Double check storage at this point" {
+#    run du -h ./student.db
+#    [ "$status" -eq 0 ]
+#    #note du -h puts a tab between the 2 fields need to match on that
+#    [ "$output" = "12K$(echo -e '\t')./student.db" ] || {
+#        echo "Failed Output:  $output"
+#        echo "12K     ./student.db"
+#        return 1
+#    }
+#}
+
+@test "Compress db - try 1" {
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compressed!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+#@test "One block should be gone" {
+#    run du -h ./student.db
+#    [ "$status" -eq 0 ]
+#    #note du -h puts a tab between the 2 fields need to match on that
+#    [ "$output" = "8.0K$(echo -e '\t')./student.db" ] || {
+#        echo "Failed Output:  $output"
+#        echo "8.0K     ./student.db"
+#        return 1
+#    }
+#}
+
+@test "Delete student 99999 in db" {
+    run ./sdbsc -d 99999
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 99999 was deleted from database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Compress db again - try 2" {
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compressed!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+#@test "Should be down to 1 block" {
+#    run du -h ./student.db
+#    [ "$status" -eq 0 ]
+#    #note du -h puts a tab between the 2 fields need to match on that
+#    [ "$output" = "4.0K$(echo -e '\t')./student.db" ] || {
+#        echo "Failed Output:  $output"
+#        echo "4.0K     ./student.db"
+#        return 1
+#    }
+#}
+
+@test "Count is rebuilt from the records when the superblock is corrupt" {
+    dd if=/dev/urandom of=./student.db bs=64 count=1 conv=notrunc 2>/dev/null
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Slot 0 holds the superblock, not a student" {
+    run ./sdbsc -f 0
+    [ "$status" -eq 1 ]  || {
+        echo "Expecting status of 1, got:  $status"
+        return 1
+    }
+    [ "${lines[0]}" = "Student 0 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Search students by part of a name" {
+    run ./sdbsc -S jan
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 3 jane doe 0.03"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Name search sees students added after the index was built" {
+    run ./sdbsc -a 70 johnny smith 300
+    [ "$status" -eq 0 ]
+    run ./sdbsc -S MIT
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 70 johnny smith 3.00"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Fuzzy name search allows an edit" {
+    run ./sdbsc -S jonny 1
+    [ "$status" -eq 0 ]
+    [ "${lines[1]%% *}" = "70" ] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+}
+
+@test "Name search with no match" {
+    run ./sdbsc -S zzz
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = 'No students matched "zzz".' ] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+}
+
+@test "Name index with a bad key count is rebuilt" {
+    #n_keys far past the end of the file
+    printf '\377\377\377\177' | dd of=student.tri bs=1 seek=16 conv=notrunc 2>/dev/null
+    run ./sdbsc -S jan
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 3 jane doe 0.03"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+    [ "$(od -A n -t d4 -j 16 -N 4 student.tri | tr -d ' ')" -lt 100 ]
+}
+
+@test "Sharded database routes ids to shards and merges scans" {
+    rm -f shard0.db shard1.db shard0.tri shard1.tri
+    export SDBSC_SHARDS=shard0.db,shard1.db
+    run ./sdbsc -a 90000 bo lee 200
+    [ "$status" -eq 0 ]
+    run ./sdbsc -a 5 ann lee 300
+    [ "$status" -eq 0 ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -S lee
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 5 ann lee 3.00 90000 bo lee 2.00"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+    #range sharding puts the low id in the first shard, the high id in the second
+    [ "$(stat --format=%s shard0.db)" = "384" ]
+    [ "$(stat --format=%s shard1.db)" = "5760064" ]
+}
+
+@test "Changing the shard layout is rejected" {
+    export SDBSC_SHARDS=shard0.db,shard1.db
+    export SDBSC_SHARD_MODE=hash
+    run ./sdbsc -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Shard layout does not match SDBSC_SHARDS, exiting!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Rebuilding a shard superblock keeps its layout" {
+    export SDBSC_SHARDS=shard0.db,shard1.db
+    #a crash leaves both superblocks dirty, the rebuild must keep the stamp
+    printf '\x01' | dd of=shard0.db bs=1 seek=8 conv=notrunc 2>/dev/null
+    printf '\x01' | dd of=shard1.db bs=1 seek=8 conv=notrunc 2>/dev/null
+    SDBSC_SHARD_MODE=hash run ./sdbsc -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Shard layout does not match SDBSC_SHARDS, exiting!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -f 90000
+    [ "$status" -eq 0 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    #without a magic the stamp is lost, the shard is not taken for a new one
+    printf '\x00' | dd of=shard1.db bs=1 seek=0 conv=notrunc 2>/dev/null
+    run ./sdbsc -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Shard layout does not match SDBSC_SHARDS, exiting!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    rm -f shard0.db shard1.db shard0.tri shard1.tri
+}
+
+@test "Backup and restore the database" {
+    ./sdbsc -z
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 99999 jane doe 390
+    run ./sdbsc -B backup.db
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database backed up to backup.db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    #the copy keeps the holes of the original
+    [ "$(stat --format=%s backup.db)" = "$(stat --format=%s student.db)" ]
+    [ "$(stat --format=%b backup.db)" -lt 1000 ]
+
+    ./sdbsc -d 99999
+    run ./sdbsc -R backup.db
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database restored from backup.db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -S jane
+    [ "${lines[1]}" != "" ]
+    rm -f backup.db
+}
+
+@test "Restoring from a file that is not a database fails" {
+    echo "not a database" > backup.db
+    run ./sdbsc -R backup.db
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant restore from backup.db, it is not a student database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    rm -f backup.db
+}
+
+@test "Tracing reports operation counts and timings" {
+    ./sdbsc -z
+    ./sdbsc -a 1 john doe 345
+    run ./sdbsc -T -f 1
+    [ "$status" -eq 0 ]
+    echo "$output" | grep -q '^{"cmd":"f",' || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    echo "$output" | grep -q '"find":{"count":1,'
+    echo "$output" | grep -q '"open":{"count":1,'
+    echo "$output" | grep -q '"locks":1,'
+
+    #a backup copies the file and syncs the copy
+    run ./sdbsc -T -B trace.db
+    [ "$status" -eq 0 ]
+    echo "$output" | grep -q '"syncs":1,'
+    size=$(stat --format=%s student.db)
+    written=$(echo "$output" | grep -o '"bytes_written":[0-9]*' | cut -d: -f2)
+    copies=$(echo "$output" | grep -o '"copies":[0-9]*' | cut -d: -f2)
+    [ "$copies" -ge 1 ]
+    #a reflink clone copies no bytes
+    [ "$written" -ge "$size" ] || [ "$copies" -eq 1 ]
+    rm -f trace.db
+
+    rm -f trace.json
+    SDBSC_TRACE=trace.json ./sdbsc -c
+    SDBSC_TRACE=trace.json ./sdbsc -p
+    [ "$(wc -l < trace.json)" -eq 2 ]
+    grep -q '"print":{"count":1,' trace.json
+    rm -f trace.json
+}
+
+@test "Cached writes reach the file with a clean superblock" {
+    ./sdbsc -z
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 70 jane doe 390
+    #flags word of the superblock is 0 once the pages are written back
+    [ "$(od -A n -t d4 -j 8 -N 4 student.db | tr -d ' ')" = "0" ]
+    [ "$(stat --format=%s student.db)" = "4544" ]
+    run ./sdbsc -f 70
+    [ "${lines[1]}" = "70     jane                     doe                              3.90" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Batch moves a student in one transaction" {
+    ./sdbsc -z
+    ./sdbsc -a 1 john doe 345
+    printf 'a 2 jane doe 390\n# john gets a new id\nm 1 10\n' > batch.txt
+    run ./sdbsc -t batch.txt
+    [ "$status" -eq 0 ]
+    [ "${lines[3]}" = "Transaction committed, 2 operation(s) applied." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -p
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 2 jane doe 3.90 10 john doe 3.45"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+    rm -f batch.txt
+}
+
+@test "Failed batch leaves the database unchanged" {
+    printf 'a 3 ann lee 200\nd 99\n' | {
+        run ./sdbsc -t -
+        [ "$status" -eq 1 ]
+        [ "${lines[2]}" = "Transaction aborted, no changes were made." ] || {
+            echo "Failed Output:  $output"
+            return 1
+        }
+    }
+    run ./sdbsc -f 3
+    [ "$status" -eq 1 ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+    run ./sdbsc -S ann
+    [ "${lines[0]}" = 'No students matched "ann".' ]
+}
+
+@test "Batch with an over-long line is rejected whole" {
+    {
+        printf 'a 3 ann lee 200\na 4 bo li 300'
+        printf '%300s\n' ''
+        printf 'd 4\n'
+    } > batch.txt
+    run ./sdbsc -t batch.txt
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Cant parse line 2 of batch.txt." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+    rm -f batch.txt
+}
+
+@test "Committed batches survive losing the database writes" {
+    ./sdbsc -z
+    ./sdbsc -a 1 john doe 345
+    cp student.db before.db
+    printf 'a 2 jane doe 390\n' | ./sdbsc -t -
+    printf 'm 1 10\n' | ./sdbsc -t -
+    #only the log is synced, the writes to student.db are lost here
+    cat before.db > student.db
+    run ./sdbsc -p
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 2 jane doe 3.90 10 john doe 3.45"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+    [ ! -s student.wal ]
+    #every id on its own page, one more page than a transaction can hold
+    for id in $(seq 1 256); do
+        echo "a $((id * 64)) s$id doe 300"
+    done > batch.txt
+    run ./sdbsc -t batch.txt
+    [ "$status" -eq 1 ]
+    [ "${lines[255]}" = "Transaction too large at operation 256, split the batch." ] || {
+        echo "Failed Output:  ${lines[255]}"
+        return 1
+    }
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+    rm -f before.db batch.txt
+}
+
+@test "Shared memory readers see published changes" {
+    ./sdbsc -z
+    ./sdbsc -a 1 john doe 345
+    run ./sdbsc -M
+    [ "${lines[0]}" = "Database published to shared memory for readers." ]
+    ./sdbsc -a 2 jane doe 390
+    export SDBSC_SHM=1
+    run ./sdbsc -f 2
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2      jane                     doe                              3.90" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    ./sdbsc -d 1
+    run ./sdbsc -f 1
+    [ "$status" -eq 1 ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 1 student record(s)." ]
+
+    #-z invalidates the copy, readers fall back to the database
+    ./sdbsc -z
+    ./sdbsc -a 3 ann lee 200
+    run ./sdbsc -f 3
+    [ "$status" -eq 0 ]
+    rm -f student.shm
+}
+
+@test "Bulk delete by predicate frees empty pages" {
+    ./sdbsc -z
+    for id in $(seq 1 200); do
+        echo "a $id s$id doe $((id % 2 * 100))"
+    done > batch.txt
+    ./sdbsc -t batch.txt
+    before=$(stat --format=%b student.db)
+    run ./sdbsc -D "id<150"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "149 student(s) deleted from database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -D "gpa==0, id>=190"
+    [ "${lines[0]}" = "6 student(s) deleted from database." ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 45 student record(s)." ]
+    run ./sdbsc -f 191
+    [ "$status" -eq 0 ]
+    [ "$(od -A n -t d4 -j 8 -N 4 student.db | tr -d ' ')" = "0" ]
+    #page 1 held ids 64-127, it is now a hole
+    [ "$(stat --format=%b student.db)" -lt "$before" ]
+    run ./sdbsc -D "gpa<<1"
+    [ "$status" -eq 2 ]
+    rm -f batch.txt
+}
+
+@test "Snapshot export answers finds and gpa ranges" {
+    ./sdbsc -z
+    for id in $(seq 1 300); do
+        echo "a $((id * 10)) s$id doe $id"
+    done > batch.txt
+    ./sdbsc -t batch.txt
+    run ./sdbsc -E snap.sst
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database exported to snap.sst, 300 student(s) in 1 block(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(stat --format=%s snap.sst)" -lt "$(stat --format=%s student.db)" ]
+    run ./sdbsc -Q snap.sst 2500 2501
+    [ "$status" -eq 1 ]
+    [ "${lines[1]}" = "2500   s250                     doe                              2.50" ]
+    [ "${lines[2]}" = "Student 2501 was not found in database." ]
+    run ./sdbsc -G snap.sst 120 122
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 1200 s120 doe 1.20 1210 s121 doe 1.21 1220 s122 doe 1.22"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+    run ./sdbsc -G snap.sst 400 500
+    [ "${lines[0]}" = "No students with a gpa between 400 and 500." ]
+    rm -f batch.txt snap.sst
+}
+
+@test "Snapshot with a block outside the file is rejected" {
+    ./sdbsc -z
+    for id in $(seq 1 1000); do
+        echo "a $id s$id doe 100"
+    done > batch.txt
+    ./sdbsc -t batch.txt
+    run ./sdbsc -E snap.sst
+    [ "${lines[0]}" = "Database exported to snap.sst, 1000 student(s) in 3 block(s)." ]
+    index_off=$(od -A n -t d8 -j 16 -N 8 snap.sst | tr -d ' ')
+    #block 0 claims 1 MB, the lookup only needs block 2
+    printf '\000\000\020\000' | dd of=snap.sst bs=1 seek=$((index_off + 20)) conv=notrunc 2>/dev/null
+    run ./sdbsc -Q snap.sst 1000
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant read snapshot snap.sst." ]
+    rm -f batch.txt snap.sst
+}
+
+@test "Change log streams adds and deletes after a sequence number" {
+    ./sdbsc -z
+    rm -f student.cdc student.[0-9]*.cdc
+    run ./sdbsc -W 0
+    [ "$status" -eq 0 ]
+    [ "$output" = "" ]
+    ./sdbsc -a 5 ann lee 310
+    ./sdbsc -a 6 bob kim 250
+    ./sdbsc -d 5
+    run ./sdbsc -W 0
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "0 1 a 5 ann lee 310" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "0 2 a 6 bob kim 250" ]
+    [ "${lines[2]}" = "0 3 d 5" ]
+    run ./sdbsc -W 2 replica
+    [ "$output" = "0 3 d 5" ]
+    ./sdbsc -D "id==6"
+    run ./sdbsc -W 3
+    [ "$output" = "0 4 d 6" ]
+    ./sdbsc -z
+    run ./sdbsc -W 4
+    [ "$output" = "0 5 z" ]
+    run ./sdbsc -W 1,2
+    [ "$status" -eq 2 ]
+    rm -f student.cdc student.[0-9]*.cdc
+}
+
+@test "Print ordered by last name or gpa, in memory and with runs" {
+    ./sdbsc -z
+    ./sdbsc -a 7 amy west 310
+    ./sdbsc -a 3 bob lee 250
+    ./sdbsc -a 5 cal lee 120
+    run ./sdbsc -p --order-by lname
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 3 bob lee 2.50 5 cal lee 1.20 7 amy west 3.10"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+    for id in $(seq 1 600); do
+        echo "a $id s$id n$((id % 17)) $((id * 37 % 501))"
+    done > batch.txt
+    ./sdbsc -z
+    ./sdbsc -t batch.txt
+    expected=$(./sdbsc -p | tail -n +2 | LC_ALL=C sort -b -k4,4n -k1,1n)
+    [ "$(./sdbsc -p --order-by gpa | tail -n +2)" = "$expected" ]
+    [ "$(SDBSC_SORT_MEM=1 ./sdbsc -p --order-by gpa | tail -n +2)" = "$expected" ]
+    expected=$(./sdbsc -p | tail -n +2 | LC_ALL=C sort -b -k3,3 -k1,1n)
+    [ "$(SDBSC_SORT_MEM=1 ./sdbsc -p --order-by lname | tail -n +2)" = "$expected" ]
+    run ./sdbsc -p --order-by fname
+    [ "$status" -eq 2 ]
+    rm -f batch.txt
+}
@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+
+#include "trace.h"
+
+bool trace_enabled = false;
+
+//shard scans run on several threads, so every counter is updated with
+//relaxed atomics; nothing orders against them until the dump at exit
+#define TR_ADD_U64(p, v)    __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+
+typedef struct trace_stat{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[TRACE_BUCKETS];
+} trace_stat_t;
+
+typedef struct trace_io{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t seeks;
+    uint64_t copies;                //copy_file_range() and clones
+    uint64_t syncs;                 //fsync() and fdatasync()
+    uint64_t locks;                 //flock()
+    uint64_t maps;                  //mmap() and munmap()
+    uint64_t allocs;                //fallocate() and ftruncate()
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t io_ns;
+    uint64_t cache_hits;            //pages found in the pager pool, or
+                                    //blocks in the snapshot cache
+    uint64_t cache_misses;          //pages or blocks that had to be read
+} trace_io_t;
+
+static const char *op_names[TR_OPS] = {
+    "open", "lock", "find", "add", "del", "count", "print", "search",
+    "compress", "zero", "backup", "restore", "batch", "publish", "purge", "export",
+    "snapshot", "changes", "scan", "sort", "format"
+};
+
+static trace_stat_t stats[TR_OPS];
+static trace_io_t io;
+static FILE *trace_out;
+static char trace_cmd;
+static uint64_t trace_t0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+ *  trace_dump
+ *
+ *  Registered with atexit() by trace_init(), writes the JSON line
+ *  described in trace.h.
+ */
+static void trace_dump(void) {
+    FILE *f = trace_out;
+
+    fprintf(f, "{\"cmd\":\"%c\",\"wall_ns\":%llu,", trace_cmd,
+            (unsigned long long)(now_ns() - trace_t0));
+    fprintf(f, "\"io\":{\"syscalls\":%llu,\"reads\":%llu,\"writes\":%llu,"
+               "\"seeks\":%llu,\"copies\":%llu,\"syncs\":%llu,\"locks\":%llu,"
+               "\"maps\":%llu,\"allocs\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+               "\"io_ns\":%llu,\"cache_hits\":%llu,\"cache_misses\":%llu},",
+            (unsigned long long)(io.reads + io.writes + io.seeks + io.copies +
+                                 io.syncs + io.locks + io.maps + io.allocs),
+            (unsigned long long)io.reads, (unsigned long long)io.writes,
+            (unsigned long long)io.seeks, (unsigned long long)io.copies,
+            (unsigned long long)io.syncs, (unsigned long long)io.locks,
+            (unsigned long long)io.maps, (unsigned long long)io.allocs,
+            (unsigned long long)io.bytes_read,
+            (unsigned long long)io.bytes_written, (unsigned long long)io.io_ns,
+            (unsigned long long)io.cache_hits, (unsigned long long)io.cache_misses);
+
+    fprintf(f, "\"ops\":{");
+    bool first = true;
+    for (int op = 0; op < TR_OPS; op++) {
+        trace_stat_t *st = &stats[op];
+        if (st->count == 0)
+            continue;
+        fprintf(f, "%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"max_ns\":%llu,"
+                   "\"hist_log2_ns\":[",
+                first ? "" : ",", op_names[op], (unsigned long long)st->count,
+                (unsigned long long)st->total_ns, (unsigned long long)st->max_ns);
+        bool first_b = true;
+        for (int b = 0; b < TRACE_BUCKETS; b++) {
+            if (st->hist[b] == 0)
+                continue;
+            fprintf(f, "%s[%d,%llu]", first_b ? "" : ",", b,
+                    (unsigned long long)st->hist[b]);
+            first_b = false;
+        }
+        fprintf(f, "]}");
+        first = false;
+    }
+    fprintf(f, "}}\n");
+
+    if (f != stderr)
+        fclose(f);
+}
+
+/*
+ *  trace_init
+ *      cmd:           option letter of the command, recorded in the dump
+ *      force_stderr:  true when -T was given
+ *
+ *  Turns tracing on if -T was given or TRACE_ENV is set, see trace.h.  A
+ *  trace file that cannot be opened falls back to stderr.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void trace_init(char cmd, bool force_stderr) {
+    const char *dest = getenv(TRACE_ENV);
+
+    if (!force_stderr && (dest == NULL || *dest == '\0' || strcmp(dest, "0") == 0))
+        return;
+
+    trace_out = stderr;
+    if (!force_stderr && strcmp(dest, "1") != 0 && strcmp(dest, "stderr") != 0) {
+        trace_out = fopen(dest, "a");
+        if (trace_out == NULL)
+            trace_out = stderr;
+    }
+
+    trace_cmd = cmd;
+    trace_t0 = now_ns();
+    trace_enabled = true;
+    atexit(trace_dump);
+}
+
+/*
+ *  tr_start
+ *
+ *  returns:  a timestamp to pass to tr_stop(), 0 when tracing is off
+ */
+uint64_t tr_start(void) {
+    return trace_enabled ? now_ns() : 0;
+}
+
+/*
+ *  tr_stop
+ *      op:     operation that finished
+ *      start:  value tr_start() returned when it began
+ *
+ *  Adds one call of op, taking the time since start, to its counters and
+ *  histogram.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void tr_stop(trace_op_t op, uint64_t start) {
+    if (!trace_enabled)
+        return;
+
+    uint64_t ns = now_ns() - start;
+    trace_stat_t *st = &stats[op];
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (b >= TRACE_BUCKETS)
+        b = TRACE_BUCKETS - 1;
+    TR_ADD_U64(&st->count, 1);
+    TR_ADD_U64(&st->total_ns, ns);
+    TR_ADD_U64(&st->hist[b], 1);
+
+    uint64_t max = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&st->max_ns, &max, ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+//account for one syscall that returned rc after start, and rc bytes
+//unless bytes is NULL
+static void tr_io(uint64_t *calls, uint64_t *bytes, ssize_t rc, uint64_t start) {
+    TR_ADD_U64(&io.io_ns, now_ns() - start);
+    TR_ADD_U64(calls, 1);
+    if (bytes != NULL && rc > 0)
+        TR_ADD_U64(bytes, rc);
+}
+
+/*
+ *  tr_read, tr_write, tr_pread, tr_pwrite, tr_pwritev, tr_lseek
+ *
+ *  Same arguments and return values as the system calls they wrap.
+ */
+ssize_t tr_read(int fd, void *buf, size_t n) {
+    if (!trace_enabled)
+        return read(fd, buf, n);
+
+    uint64_t t = now_ns();
+    ssize_t rc = read(fd, buf, n);
+    tr_io(&io.reads, &io.bytes_read, rc, t);
+    return rc;
+}
+
+ssize_t tr_write(int fd, const void *buf, size_t n) {
+    if (!trace_enabled)
+        return write(fd, buf, n);
+
+    uint64_t t = now_ns();
+    ssize_t rc = write(fd, buf, n);
+    tr_io(&io.writes, &io.bytes_written, rc, t);
+    return rc;
+}
+
+ssize_t tr_pread(int fd, void *buf, size_t n, off_t off) {
+    if (!trace_enabled)
+        return pread(fd, buf, n, off);
+
+    uint64_t t = now_ns();
+    ssize_t rc = pread(fd, buf, n, off);
+    tr_io(&io.reads, &io.bytes_read, rc, t);
+    return rc;
+}
+
+ssize_t tr_pwrite(int fd, const void *buf, size_t n, off_t off) {
+    if (!trace_enabled)
+        return pwrite(fd, buf, n, off);
+
+    uint64_t t = now_ns();
+    ssize_t rc = pwrite(fd, buf, n, off);
+    tr_io(&io.writes, &io.bytes_written, rc, t);
+    return rc;
+}
+
+ssize_t tr_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off) {
+    if (!trace_enabled)
+        return pwritev(fd, iov, iovcnt, off);
+
+    uint64_t t = now_ns();
+    ssize_t rc = pwritev(fd, iov, iovcnt, off);
+    tr_io(&io.writes, &io.bytes_written, rc, t);
+    return rc;
+}
+
+off_t tr_lseek(int fd, off_t off, int whence) {
+    if (!trace_enabled)
+        return lseek(fd, off, whence);
+
+    uint64_t t = now_ns();
+    off_t rc = lseek(fd, off, whence);
+    TR_ADD_U64(&io.io_ns, now_ns() - t);
+    TR_ADD_U64(&io.seeks, 1);
+    return rc;
+}
+
+/*
+ *  tr_copy_file_range, tr_fsync, tr_fdatasync, tr_flock, tr_mmap,
+ *  tr_munmap, tr_fallocate, tr_ftruncate
+ *
+ *  Same arguments and return values as the system calls they wrap.  The
+ *  bytes a copy moves count as both read and written.
+ */
+ssize_t tr_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                           size_t len, unsigned int flags) {
+    if (!trace_enabled)
+        return copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
+
+    uint64_t t = now_ns();
+    ssize_t rc = copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
+    tr_io(&io.copies, &io.bytes_written, rc, t);
+    if (rc > 0)
+        TR_ADD_U64(&io.bytes_read, rc);
+    return rc;
+}
+
+int tr_fsync(int fd) {
+    if (!trace_enabled)
+        return fsync(fd);
+
+    uint64_t t = now_ns();
+    int rc = fsync(fd);
+    tr_io(&io.syncs, NULL, rc, t);
+    return rc;
+}
+
+int tr_fdatasync(int fd) {
+    if (!trace_enabled)
+        return fdatasync(fd);
+
+    uint64_t t = now_ns();
+    int rc = fdatasync(fd);
+    tr_io(&io.syncs, NULL, rc, t);
+    return rc;
+}
+
+int tr_flock(int fd, int op) {
+    if (!trace_enabled)
+        return flock(fd, op);
+
+    uint64_t t = now_ns();
+    int rc = flock(fd, op);
+    tr_io(&io.locks, NULL, rc, t);
+    return rc;
+}
+
+void *tr_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+    if (!trace_enabled)
+        return mmap(addr, len, prot, flags, fd, off);
+
+    uint64_t t = now_ns();
+    void *rc = mmap(addr, len, prot, flags, fd, off);
+    tr_io(&io.maps, NULL, 0, t);
+    return rc;
+}
+
+int tr_munmap(void *addr, size_t len) {
+    if (!trace_enabled)
+        return munmap(addr, len);
+
+    uint64_t t = now_ns();
+    int rc = munmap(addr, len);
+    tr_io(&io.maps, NULL, rc, t);
+    return rc;
+}
+
+int tr_fallocate(int fd, int mode, off_t off, off_t len) {
+    if (!trace_enabled)
+        return fallocate(fd, mode, off, len);
+
+    uint64_t t = now_ns();
+    int rc = fallocate(fd, mode, off, len);
+    tr_io(&io.allocs, NULL, rc, t);
+    return rc;
+}
+
+int tr_ftruncate(int fd, off_t len) {
+    if (!trace_enabled)
+        return ftruncate(fd, len);
+
+    uint64_t t = now_ns();
+    int rc = ftruncate(fd, len);
+    tr_io(&io.allocs, NULL, rc, t);
+    return rc;
+}
+
+/*
+ *  tr_clone
+ *      dest_fd:  file to make a copy of src_fd
+ *      src_fd:   file to copy
+ *
+ *  Shares every extent of src_fd with dest_fd with the FICLONE ioctl,
+ *  where the filesystem supports reflinks.
+ *
+ *  returns:  0, or -1 with errno set
+ */
+int tr_clone(int dest_fd, int src_fd) {
+    if (!trace_enabled)
+        return ioctl(dest_fd, FICLONE, src_fd);
+
+    uint64_t t = now_ns();
+    int rc = ioctl(dest_fd, FICLONE, src_fd);
+    tr_io(&io.copies, NULL, rc, t);
+    return rc;
+}
+
+/*
+ *  tr_cache
+ *      hit:  true if the pager found the page in its pool
+ *
+ *  returns:  nothing, this is a void function
+ */
+void tr_cache(bool hit) {
+    if (trace_enabled)
+        TR_ADD_U64(hit ? &io.cache_hits : &io.cache_misses, 1);
+}
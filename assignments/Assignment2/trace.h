@@ -0,0 +1,87 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//Tracing is off unless the -T flag is given before the option, which
+//writes to stderr, or TRACE_ENV is set: "1" or "stderr" for stderr, any
+//other value names a file the trace is appended to.  When it is on, every
+//system call on the database and its side files that moves, copies,
+//syncs, locks, maps or sizes data goes through the tr_ wrappers below,
+//which count calls and bytes and time spent in the kernel, and the
+//operations in trace_op_t are timed into log2 histograms.  At exit one
+//JSON object is written on a single line:
+//
+//  {"cmd":"f","wall_ns":N,
+//   "io":{"syscalls":N,"reads":N,"writes":N,"seeks":N,"copies":N,
+//         "syncs":N,"locks":N,"maps":N,"allocs":N,
+//         "bytes_read":N,"bytes_written":N,"io_ns":N,
+//         "cache_hits":N,"cache_misses":N},
+//   "ops":{"open":{"count":N,"total_ns":N,"max_ns":N,
+//                  "hist_log2_ns":[[b,count],...]},...}}
+//
+//syscalls is the sum of the counts after it: copies are copy_file_range()
+//and reflink clones, syncs fsync() and fdatasync(), locks flock(), maps
+//mmap() and munmap(), allocs fallocate() and ftruncate().  Bytes a copy
+//moves count as both read and written; a clone moves none.  Opening,
+//closing, stat'ing and renaming files is not counted.
+//
+//A histogram pair [b,count] counts the calls that took 2^b to 2^(b+1)-1
+//ns; only operations that ran and buckets that are not empty are listed.
+//When tracing is off each wrapper costs one branch.
+#define TRACE_ENV       "SDBSC_TRACE"
+#define TRACE_BUCKETS   48              //2^47 ns is about 39 hours
+
+typedef enum trace_op{
+    TR_OPEN,            //opening and validating every shard
+    TR_LOCK,            //waiting for the shard locks
+    TR_FIND,            //-f
+    TR_ADD,             //-a
+    TR_DEL,             //-d
+    TR_COUNT,           //-c
+    TR_PRINT,           //-p
+    TR_SEARCH,          //-S
+    TR_COMPRESS,        //-x
+    TR_ZERO,            //-z
+    TR_BACKUP,          //-B
+    TR_RESTORE,         //-R
+    TR_BATCH,           //-t
+    TR_PUBLISH,         //-M
+    TR_PURGE,           //-D
+    TR_EXPORT,          //-E
+    TR_SNAPSHOT,        //-Q and -G, reading a snapshot
+    TR_CHANGES,         //-W
+    TR_SCAN,            //one pass of scan_db() over a shard
+    TR_SORT,            //sorting keys for -p --order-by
+    TR_FORMAT,          //formatting students for output
+    TR_OPS
+} trace_op_t;
+
+extern bool trace_enabled;
+
+void trace_init(char cmd, bool force_stderr);
+uint64_t tr_start(void);
+void tr_stop(trace_op_t op, uint64_t start);
+
+ssize_t tr_read(int fd, void *buf, size_t n);
+ssize_t tr_write(int fd, const void *buf, size_t n);
+ssize_t tr_pread(int fd, void *buf, size_t n, off_t off);
+ssize_t tr_pwrite(int fd, const void *buf, size_t n, off_t off);
+ssize_t tr_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off);
+off_t tr_lseek(int fd, off_t off, int whence);
+ssize_t tr_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                           size_t len, unsigned int flags);
+int tr_clone(int dest_fd, int src_fd);
+int tr_fsync(int fd);
+int tr_fdatasync(int fd);
+int tr_flock(int fd, int op);
+void *tr_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
+int tr_munmap(void *addr, size_t len);
+int tr_fallocate(int fd, int mode, off_t off, off_t len);
+int tr_ftruncate(int fd, off_t len);
+void tr_cache(bool hit);
+
+#endif
@@ -0,0 +1,787 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <limits.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "trace.h"
+#include "pager.h"
+#include "trigram.h"
+
+#define TRI_NUM_KEYS    (1 << TRI_KEY_BITS)
+
+//an open, validated index file
+typedef struct tri_index{
+    unsigned char *map;
+    size_t size;
+    tri_hdr_t *hdr;
+    tri_key_t *keys;
+    tri_log_t *log;
+    int n_log;
+} tri_index_t;
+
+//walks one compressed posting list in id order
+typedef struct tri_cursor{
+    const unsigned char *list;
+    const tri_skip_t *skips;
+    int nblocks;
+    unsigned int count;
+    int block;
+    unsigned int left;      //ids still to decode in the current block
+    const unsigned char *p;
+    const unsigned char *end;   //end of the list, where the next one starts
+    int cur;                //id the cursor is on
+    bool done;
+} tri_cursor_t;
+
+/*
+ *  tri_fold
+ *      c:  a character from a name or search pattern
+ *
+ *  Maps a character into the 6 bit trigram alphabet.  Letters are case
+ *  folded, digits get their own codes and everything else shares the
+ *  remaining codes.
+ *
+ *  returns:  a code between 1 and 63
+ */
+static unsigned int tri_fold(unsigned char c) {
+    c = tolower(c);
+    if (c >= 'a' && c <= 'z')
+        return 1 + (c - 'a');
+    if (c >= '0' && c <= '9')
+        return 27 + (c - '0');
+    return 37 + (c % 27);
+}
+
+static unsigned int tri_key(const char *p) {
+    return (tri_fold(p[0]) << 12) | (tri_fold(p[1]) << 6) | tri_fold(p[2]);
+}
+
+/*
+ *  tri_keys
+ *      str:   characters to take trigrams from
+ *      len:   number of characters in str
+ *      keys:  where the distinct keys are added
+ *      n:     number of keys already in keys
+ *
+ *  Adds every trigram key of str that is not already in keys.  Names are
+ *  at most 31 characters, so a linear duplicate check is cheapest.
+ *
+ *  returns:  the new number of keys
+ */
+static int tri_keys(const char *str, int len, unsigned int *keys, int n) {
+    for (int i = 0; i + 3 <= len; i++) {
+        unsigned int k = tri_key(str + i);
+        int j;
+        for (j = 0; j < n; j++) {
+            if (keys[j] == k)
+                break;
+        }
+        if (j == n)
+            keys[n++] = k;
+    }
+    return n;
+}
+
+static void put_varint(unsigned char **p, unsigned int v) {
+    while (v >= 0x80) {
+        *(*p)++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *(*p)++ = v;
+}
+
+//returns bytes used, or 0 if the varint runs past end
+static int get_varint(const unsigned char *p, const unsigned char *end, unsigned int *v) {
+    int n = 0;
+
+    *v = 0;
+    for (int shift = 0; p + n < end && shift < 35; shift += 7) {
+        unsigned char b = p[n++];
+        *v |= (unsigned int)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return n;
+    }
+    return 0;
+}
+
+/*
+ *  tri_build
+ *      fd:   linux file descriptor of the database
+ *      *sb:  current superblock, its epoch and generation are recorded
+ *
+ *  Scans the database once and writes a fresh base index with an empty
+ *  change log.  Students are read in id order, so a counting sort on the
+ *  trigram key leaves every posting list already sorted.  The index is
+ *  written to a temporary file and renamed over the old one.
+ *
+ *  returns:  NO_ERROR       index written
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  M_ERR_DB_READ   error reading the database
+ *            M_ERR_DB_WRITE  error writing the index
+ */
+int tri_build(int fd, db_super_t *sb) {
+    student_t recs[64];
+    off_t offset = STUDENT_RECORD_SIZE;
+    unsigned int *pair_key = NULL;
+    int *pair_id = NULL;
+    int n_pairs = 0, cap = 0;
+    unsigned int *bucket = calloc(TRI_NUM_KEYS + 1, sizeof(unsigned int));
+    int rc = ERR_DB_FILE;
+
+    if (!bucket) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //pass 1: collect (key, id) pairs and count the ids per key
+    while (true) {
+        ssize_t bytes_read = pager_read(fd, recs, sizeof(recs), offset);
+        if (bytes_read < 0) {
+            printf(M_ERR_DB_READ);
+            goto out;
+        }
+        if (bytes_read == 0)
+            break;
+        offset += bytes_read;
+
+        int n = bytes_read / STUDENT_RECORD_SIZE;
+        for (int i = 0; i < n; i++) {
+            unsigned int keys[2 * TRI_MAX_PATTERN];
+            int nk;
+
+            //a damaged record can hold any id, tri_match() only reads
+            //slots in range
+            if (recs[i].id < MIN_STD_ID || recs[i].id > MAX_STD_ID)
+                continue;
+            nk = tri_keys(recs[i].fname, strnlen(recs[i].fname, sizeof(recs[i].fname)), keys, 0);
+            nk = tri_keys(recs[i].lname, strnlen(recs[i].lname, sizeof(recs[i].lname)), keys, nk);
+
+            if (n_pairs + nk > cap) {
+                cap = cap ? cap * 2 : 4096;
+                unsigned int *nkey = realloc(pair_key, cap * sizeof(*pair_key));
+                int *nid = realloc(pair_id, cap * sizeof(*pair_id));
+                if (nkey)
+                    pair_key = nkey;
+                if (nid)
+                    pair_id = nid;
+                if (!nkey || !nid) {
+                    printf(M_ERR_DB_READ);
+                    goto out;
+                }
+            }
+            for (int j = 0; j < nk; j++) {
+                pair_key[n_pairs] = keys[j];
+                pair_id[n_pairs] = recs[i].id;
+                n_pairs++;
+                bucket[keys[j] + 1]++;
+            }
+        }
+    }
+
+    //pass 2: scatter the ids so they are grouped by key, still in id order
+    int n_keys = 0;
+    for (int k = 0; k < TRI_NUM_KEYS; k++) {
+        if (bucket[k + 1])
+            n_keys++;
+        bucket[k + 1] += bucket[k];
+    }
+    int *sorted = malloc((n_pairs ? n_pairs : 1) * sizeof(int));
+    unsigned int *pos = malloc(TRI_NUM_KEYS * sizeof(unsigned int));
+    if (!sorted || !pos) {
+        free(sorted);
+        free(pos);
+        printf(M_ERR_DB_READ);
+        goto out;
+    }
+    memcpy(pos, bucket, TRI_NUM_KEYS * sizeof(unsigned int));
+    for (int i = 0; i < n_pairs; i++)
+        sorted[pos[pair_key[i]]++] = pair_id[i];
+    free(pos);
+
+    //encode: header, key table, then one posting list per key.  A varint
+    //is at most 5 bytes, so this bounds the image size.
+    size_t max_size = sizeof(tri_hdr_t) + n_keys * sizeof(tri_key_t) +
+                      n_keys * (sizeof(tri_skip_t) + sizeof(int)) +
+                      (size_t)n_pairs * (sizeof(tri_skip_t) + 5);
+    unsigned char *img = calloc(1, max_size);
+    if (!img) {
+        free(sorted);
+        printf(M_ERR_DB_READ);
+        goto out;
+    }
+    tri_hdr_t *hdr = (tri_hdr_t *)img;
+    tri_key_t *table = (tri_key_t *)(img + sizeof(tri_hdr_t));
+    unsigned char *p = (unsigned char *)(table + n_keys);
+    int t = 0;
+
+    for (int k = 0; k < TRI_NUM_KEYS; k++) {
+        unsigned int count = bucket[k + 1] - bucket[k];
+        if (count == 0)
+            continue;
+
+        int *ids = sorted + bucket[k];
+        int nblocks = (count + TRI_BLOCK - 1) / TRI_BLOCK;
+        unsigned char *list = p;
+        tri_skip_t *skips = (tri_skip_t *)list;
+
+        table[t].key = k;
+        table[t].count = count;
+        table[t].off = list - img;
+        t++;
+
+        p = list + nblocks * sizeof(tri_skip_t);
+        for (unsigned int i = 0; i < count; i++) {
+            if (i % TRI_BLOCK == 0) {
+                skips[i / TRI_BLOCK].first_id = ids[i];
+                skips[i / TRI_BLOCK].data_off = p - list;
+            } else {
+                put_varint(&p, ids[i] - ids[i - 1]);
+            }
+        }
+        //keep the next skip table aligned
+        while ((p - img) % sizeof(int))
+            p++;
+    }
+    free(sorted);
+
+    hdr->magic = TRI_MAGIC;
+    hdr->version = TRI_VERSION;
+    hdr->epoch = sb->epoch;
+    hdr->base_gen = sb->generation;
+    hdr->n_keys = n_keys;
+    hdr->log_off = p - img;
+
+    char tri_file[PATH_MAX];
+    char tmp_file[PATH_MAX];
+    db_sidecar(fd, TRI_EXT, false, tri_file, sizeof(tri_file));
+    db_sidecar(fd, TRI_EXT, true, tmp_file, sizeof(tmp_file));
+
+    int tri_fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (tri_fd == -1) {
+        free(img);
+        printf(M_ERR_DB_WRITE);
+        goto out;
+    }
+    if (tr_write(tri_fd, img, hdr->log_off) != hdr->log_off) {
+        close(tri_fd);
+        free(img);
+        printf(M_ERR_DB_WRITE);
+        goto out;
+    }
+    close(tri_fd);
+    free(img);
+
+    if (rename(tmp_file, tri_file) != 0) {
+        printf(M_ERR_DB_WRITE);
+        goto out;
+    }
+    rc = NO_ERROR;
+
+out:
+    free(bucket);
+    free(pair_key);
+    free(pair_id);
+    return rc;
+}
+
+/*
+ *  tri_note
+ *      fd:   linux file descriptor of the database
+ *      *sb:  superblock after the change was committed
+ *      id:   student id that was added or deleted
+ *      op:   TRI_OP_ADD or TRI_OP_DEL
+ *
+ *  Appends a change to the index log.  If there is no index yet there is
+ *  nothing to maintain, it is built by the first search.  A failure here
+ *  is not an error for the caller: the gap in generations makes the next
+ *  search rebuild the index.
+ *
+ *  returns:  NO_ERROR
+ *
+ *  console:  Does not produce any console I/O
+ */
+int tri_note(int fd, db_super_t *sb, int id, int op) {
+    tri_log_t ent = { id, op, sb->generation };
+    char tri_file[PATH_MAX];
+    int tri_fd = open(db_sidecar(fd, TRI_EXT, false, tri_file, sizeof(tri_file)),
+                      O_WRONLY | O_APPEND);
+
+    if (tri_fd == -1)
+        return NO_ERROR;
+    //a short write needs no handling: a torn entry leaves the log
+    //misaligned and a missing one leaves a generation gap, either way
+    //tri_open() rejects the index and the next search rebuilds it
+    (void)tr_write(tri_fd, &ent, sizeof(ent));
+    close(tri_fd);
+    return NO_ERROR;
+}
+
+//offset where the posting list of key table entry i ends
+static size_t tri_list_end(const tri_index_t *ix, int i) {
+    return i + 1 < ix->hdr->n_keys ? ix->keys[i + 1].off : (unsigned int)ix->hdr->log_off;
+}
+
+/*
+ *  tri_check_keys
+ *      *ix:  mapped index whose header and log offset have been checked
+ *
+ *  The key table has to fit before the log and be sorted for tri_find().
+ *  The posting lists have to follow it in key order, as tri_build() writes
+ *  them, each with its skip entries inside it and pointing inside it, so
+ *  a cursor never leaves the list it walks.
+ *
+ *  returns:  true if every key and posting list is in bounds
+ */
+static bool tri_check_keys(const tri_index_t *ix) {
+    const tri_hdr_t *hdr = ix->hdr;
+    size_t prev = sizeof(tri_hdr_t) + (size_t)hdr->n_keys * sizeof(tri_key_t);
+
+    if (hdr->n_keys < 0 ||
+        (size_t)hdr->n_keys > (hdr->log_off - sizeof(tri_hdr_t)) / sizeof(tri_key_t))
+        return false;
+
+    for (int i = 0; i < hdr->n_keys; i++) {
+        const tri_key_t *k = &ix->keys[i];
+        size_t end = tri_list_end(ix, i);
+        size_t nblocks = ((size_t)k->count + TRI_BLOCK - 1) / TRI_BLOCK;
+
+        if ((i > 0 && k->key <= ix->keys[i - 1].key) || k->count == 0 ||
+            k->off < prev || k->off % sizeof(int) != 0 ||
+            end < k->off || end > (size_t)hdr->log_off ||
+            nblocks > (end - k->off) / sizeof(tri_skip_t))
+            return false;
+
+        const tri_skip_t *skips = (const tri_skip_t *)(ix->map + k->off);
+        for (size_t b = 0; b < nblocks; b++) {
+            if (skips[b].data_off < nblocks * sizeof(tri_skip_t) ||
+                skips[b].data_off > end - k->off)
+                return false;
+        }
+        prev = k->off;
+    }
+    return true;
+}
+
+/*
+ *  tri_open
+ *      fd:   linux file descriptor of the database
+ *      *ix:  filled in with the mapped index
+ *      *sb:  current superblock
+ *
+ *  Maps the index file and checks that it describes the database as it is now:
+ *  same epoch, and a change log whose generations continue the base
+ *  without gaps up to the current generation.  The key table and posting
+ *  lists are checked against the size of the file, see tri_check_keys().
+ *
+ *  returns:  true if the index can be used, false if it must be rebuilt
+ */
+static bool tri_open(int fd, tri_index_t *ix, db_super_t *sb) {
+    struct stat st;
+    char tri_file[PATH_MAX];
+    int tri_fd = open(db_sidecar(fd, TRI_EXT, false, tri_file, sizeof(tri_file)), O_RDONLY);
+
+    memset(ix, 0, sizeof(*ix));
+    if (tri_fd == -1)
+        return false;
+    if (fstat(tri_fd, &st) == -1 || st.st_size < (off_t)sizeof(tri_hdr_t)) {
+        close(tri_fd);
+        return false;
+    }
+    ix->map = tr_mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, tri_fd, 0);
+    close(tri_fd);
+    if (ix->map == MAP_FAILED) {
+        ix->map = NULL;
+        return false;
+    }
+    ix->size = st.st_size;
+    ix->hdr = (tri_hdr_t *)ix->map;
+    ix->keys = (tri_key_t *)(ix->map + sizeof(tri_hdr_t));
+
+    tri_hdr_t *hdr = ix->hdr;
+    if (hdr->magic != TRI_MAGIC || hdr->version != TRI_VERSION ||
+        hdr->epoch != sb->epoch || hdr->log_off < (int)sizeof(tri_hdr_t) ||
+        (size_t)hdr->log_off > ix->size ||
+        (ix->size - hdr->log_off) % sizeof(tri_log_t) != 0 ||
+        !tri_check_keys(ix))
+        return false;
+
+    ix->log = (tri_log_t *)(ix->map + hdr->log_off);
+    ix->n_log = (ix->size - hdr->log_off) / sizeof(tri_log_t);
+    if (ix->n_log > TRI_LOG_MAX)
+        return false;
+    for (int i = 0; i < ix->n_log; i++) {
+        if (ix->log[i].generation != hdr->base_gen + i + 1)
+            return false;
+    }
+    return hdr->base_gen + ix->n_log == sb->generation;
+}
+
+static void tri_close(tri_index_t *ix) {
+    if (ix->map)
+        tr_munmap(ix->map, ix->size);
+    ix->map = NULL;
+}
+
+static const tri_key_t *tri_find(tri_index_t *ix, unsigned int key) {
+    int lo = 0, hi = ix->hdr->n_keys - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (ix->keys[mid].key == key)
+            return &ix->keys[mid];
+        if (ix->keys[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+static void cur_load(tri_cursor_t *c, int block) {
+    unsigned int in_block = c->count - block * TRI_BLOCK;
+
+    if (in_block > TRI_BLOCK)
+        in_block = TRI_BLOCK;
+    c->block = block;
+    c->cur = c->skips[block].first_id;
+    c->p = c->list + c->skips[block].data_off;
+    c->left = in_block - 1;
+}
+
+static void cur_init(tri_cursor_t *c, tri_index_t *ix, const tri_key_t *k) {
+    c->list = ix->map + k->off;
+    c->end = ix->map + tri_list_end(ix, k - ix->keys);
+    c->skips = (const tri_skip_t *)c->list;
+    c->count = k->count;
+    c->nblocks = (k->count + TRI_BLOCK - 1) / TRI_BLOCK;
+    c->done = false;
+    cur_load(c, 0);
+}
+
+static bool cur_next(tri_cursor_t *c) {
+    if (c->left > 0) {
+        unsigned int delta;
+        int n = get_varint(c->p, c->end, &delta);
+
+        //deltas cut off by the end of the list end it early
+        if (n == 0) {
+            c->done = true;
+            return false;
+        }
+        c->p += n;
+        c->cur += delta;
+        c->left--;
+        return true;
+    }
+    if (c->block + 1 < c->nblocks) {
+        cur_load(c, c->block + 1);
+        return true;
+    }
+    c->done = true;
+    return false;
+}
+
+/*
+ *  cur_seek
+ *      *c:      cursor to move forward
+ *      target:  id to look for
+ *
+ *  Moves the cursor to the first id >= target.  Whole blocks are skipped
+ *  with a binary search over the skip entries, so only the block that can
+ *  hold target is decoded.
+ *
+ *  returns:  false if the list has no id >= target
+ */
+static bool cur_seek(tri_cursor_t *c, int target) {
+    if (c->done)
+        return false;
+    if (c->cur >= target)
+        return true;
+
+    if (c->block + 1 < c->nblocks && c->skips[c->block + 1].first_id <= target) {
+        int lo = c->block + 1, hi = c->nblocks - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (c->skips[mid].first_id <= target)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        cur_load(c, lo);
+    }
+    while (c->cur < target) {
+        if (!cur_next(c))
+            return false;
+    }
+    return true;
+}
+
+/*
+ *  field_contains
+ *      field:  fixed size name field from a student record
+ *      sz:     size of the field
+ *      pat:    pattern to look for
+ *      m:      length of the pattern
+ *      k:      allowed edit distance, 0 for an exact match
+ *
+ *  Case insensitive substring test.  With k > 0 this is an approximate
+ *  substring match (Sellers): the pattern may match any part of the field
+ *  with at most k insertions, deletions or substitutions.
+ *
+ *  returns:  true on a match
+ */
+static bool field_contains(const char *field, int sz, const char *pat, int m, int k) {
+    int n = strnlen(field, sz);
+    int col[TRI_MAX_PATTERN + 1];
+
+    if (k == 0) {
+        for (int i = 0; i + m <= n; i++) {
+            int j = 0;
+            while (j < m && tolower((unsigned char)field[i + j]) == tolower((unsigned char)pat[j]))
+                j++;
+            if (j == m)
+                return true;
+        }
+        return false;
+    }
+
+    //col[i] is the cost of matching pat[0..i) ending at the current text
+    //position; a match may start anywhere so row 0 stays zero
+    for (int i = 0; i <= m; i++)
+        col[i] = i;
+    if (col[m] <= k)
+        return true;
+    for (int j = 0; j < n; j++) {
+        int diag = col[0];
+        for (int i = 1; i <= m; i++) {
+            int up = col[i];
+            int cost = tolower((unsigned char)pat[i - 1]) != tolower((unsigned char)field[j]);
+            int best = diag + cost;
+            if (col[i - 1] + 1 < best)
+                best = col[i - 1] + 1;
+            if (up + 1 < best)
+                best = up + 1;
+            col[i] = best;
+            diag = up;
+        }
+        if (col[m] <= k)
+            return true;
+    }
+    return false;
+}
+
+static bool student_matches(student_t *s, const char *pat, int m, int k) {
+    return field_contains(s->fname, sizeof(s->fname), pat, m, k) ||
+           field_contains(s->lname, sizeof(s->lname), pat, m, k);
+}
+
+static int cmp_key_count(const void *a, const void *b) {
+    const tri_key_t *x = *(const tri_key_t * const *)a;
+    const tri_key_t *y = *(const tri_key_t * const *)b;
+    return (x->count > y->count) - (x->count < y->count);
+}
+
+/*
+ *  tri_candidates
+ *      *ix:         validated index
+ *      keys, nk:    distinct trigram keys of the pattern
+ *      k:           allowed edit distance
+ *      mark:        one byte per possible id, set to 1 for each candidate
+ *
+ *  For an exact search the posting lists are intersected, shortest list
+ *  first, seeking through the others with their skip entries.  For a fuzzy
+ *  search an id is a candidate if it holds at least nk - 3k of the keys,
+ *  since one edit can destroy at most three trigrams.  Ids in the change
+ *  log are always candidates.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void tri_candidates(tri_index_t *ix, unsigned int *keys, int nk, int k,
+                           unsigned char *mark) {
+    const tri_key_t *lists[2 * TRI_MAX_PATTERN];
+    int nl = 0;
+
+    for (int i = 0; i < nk; i++) {
+        const tri_key_t *tk = tri_find(ix, keys[i]);
+        if (tk)
+            lists[nl++] = tk;
+    }
+
+    if (k == 0 && nl == nk) {
+        tri_cursor_t cur[2 * TRI_MAX_PATTERN];
+
+        qsort(lists, nl, sizeof(lists[0]), cmp_key_count);
+        for (int i = 0; i < nl; i++)
+            cur_init(&cur[i], ix, lists[i]);
+        do {
+            int id = cur[0].cur;
+            bool all = true;
+            for (int i = 1; i < nl && all; i++)
+                all = cur_seek(&cur[i], id) && cur[i].cur == id;
+            if (all && id >= MIN_STD_ID && id <= MAX_STD_ID)
+                mark[id] = 1;
+        } while (cur_next(&cur[0]));
+    } else if (k > 0) {
+        int need = nk - 3 * k;
+        for (int i = 0; i < nl; i++) {
+            tri_cursor_t c;
+            cur_init(&c, ix, lists[i]);
+            do {
+                if (c.cur >= MIN_STD_ID && c.cur <= MAX_STD_ID && mark[c.cur] < 255)
+                    mark[c.cur]++;
+            } while (cur_next(&c));
+        }
+        for (int id = 0; id <= MAX_STD_ID; id++)
+            mark[id] = mark[id] >= need;
+    }
+
+    for (int i = 0; i < ix->n_log; i++) {
+        if (ix->log[i].op == TRI_OP_ADD && ix->log[i].id >= MIN_STD_ID &&
+            ix->log[i].id <= MAX_STD_ID)
+            mark[ix->log[i].id] = 1;
+    }
+}
+
+/*
+ *  tri_match
+ *      fd:         linux file descriptor of the database
+ *      pattern:    part of a first or last name to look for
+ *      max_edits:  0 for a substring search, up to TRI_MAX_EDITS for a
+ *                  fuzzy search
+ *      **found:    set to a malloc'ed array of the matching students, in
+ *                  id order, the caller frees it
+ *      *n_found:   set to the number of matching students
+ *
+ *  Looks students up by name through the trigram index, rebuilding the
+ *  index first if it is missing or out of date.  Candidates from the index
+ *  are always checked against the record in the database.  Patterns too
+ *  short to have enough trigrams fall back to checking every slot.
+ *
+ *  returns:  NO_ERROR       search done, *n_found may be zero
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  M_ERR_DB_READ  error reading the database or index
+ */
+int tri_match(int fd, char *pattern, int max_edits, student_t **found, int *n_found) {
+    db_super_t sb;
+    tri_index_t ix;
+    unsigned int keys[TRI_MAX_PATTERN];
+    int m = strlen(pattern);
+    int nk;
+    unsigned char *mark;
+    int cap = 0;
+    int rc = ERR_DB_FILE;
+
+    *found = NULL;
+    *n_found = 0;
+    if (m > TRI_MAX_PATTERN)
+        return NO_ERROR;
+    nk = tri_keys(pattern, m, keys, 0);
+
+    if (read_super(fd, &sb) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    mark = calloc(MAX_STD_ID + 1, 1);
+    if (!mark) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (nk - 3 * max_edits > 0) {
+        if (!tri_open(fd, &ix, &sb)) {
+            tri_close(&ix);
+            if (tri_build(fd, &sb) != NO_ERROR)
+                goto out;
+            if (!tri_open(fd, &ix, &sb)) {
+                tri_close(&ix);
+                printf(M_ERR_DB_READ);
+                goto out;
+            }
+        }
+        tri_candidates(&ix, keys, nk, max_edits, mark);
+        tri_close(&ix);
+    } else {
+        //not selective enough for the index, check every slot
+        memset(mark, 1, MAX_STD_ID + 1);
+    }
+
+    //check the candidates in id order so the output matches print_db()
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID && id <= sb.max_id; id++) {
+        student_t s;
+
+        if (!mark[id])
+            continue;
+        ssize_t bytes_read = pager_read(fd, &s, sizeof(s), (off_t)id * STUDENT_RECORD_SIZE);
+        if (bytes_read < 0) {
+            printf(M_ERR_DB_READ);
+            goto out;
+        }
+        if (bytes_read != STUDENT_RECORD_SIZE || s.id == 0)
+            continue;
+        if (!student_matches(&s, pattern, m, max_edits))
+            continue;
+
+        if (*n_found == cap) {
+            cap = cap ? cap * 2 : 256;
+            student_t *nf = realloc(*found, cap * sizeof(student_t));
+            if (!nf) {
+                printf(M_ERR_DB_READ);
+                goto out;
+            }
+            *found = nf;
+        }
+        (*found)[(*n_found)++] = s;
+    }
+    rc = NO_ERROR;
+
+out:
+    if (rc != NO_ERROR) {
+        free(*found);
+        *found = NULL;
+        *n_found = 0;
+    }
+    free(mark);
+    return rc;
+}
+
+/*
+ *  tri_search
+ *      fd:         linux file descriptor of the database
+ *      pattern:    part of a first or last name to look for
+ *      max_edits:  0 for a substring search, up to TRI_MAX_EDITS for a
+ *                  fuzzy search
+ *
+ *  Prints the students tri_match() finds.
+ *
+ *  returns:  NO_ERROR       at least one student matched and was printed
+ *            SRCH_NOT_FOUND no student matched
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  the matching students in the print_db() format
+ *            M_SRCH_NO_MATCH  no student matched
+ *            M_ERR_DB_READ    error reading the database or index
+ */
+int tri_search(int fd, char *pattern, int max_edits) {
+    student_t *found;
+    int n_found;
+
+    if (tri_match(fd, pattern, max_edits, &found, &n_found) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (n_found == 0) {
+        printf(M_SRCH_NO_MATCH, pattern);
+        return SRCH_NOT_FOUND;
+    }
+    print_students(found, n_found);
+    free(found);
+    return NO_ERROR;
+}
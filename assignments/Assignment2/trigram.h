@@ -0,0 +1,67 @@
+#ifndef __TRIGRAM_H__
+#define __TRIGRAM_H__
+
+#include "db.h" //get student record and superblock types
+
+//The trigram index lives next to the database in the file named by
+//db_sidecar(fd, TRI_EXT, ...), "student.tri" for the default database.
+//It has two parts:
+//  1. A base index built by scanning the database.  For every trigram seen
+//     in a first or last name it stores the sorted list of student ids
+//     that contain it, delta and varint encoded in blocks of TRI_BLOCK ids
+//     with a skip entry per block so lists can be intersected without
+//     decoding them completely.
+//  2. A change log appended by add_student() and del_student().  Each entry
+//     carries the superblock generation it produced, so a search can tell
+//     if every change since the base was built has been logged.  If not,
+//     or the log got longer than TRI_LOG_MAX, the index is rebuilt.
+//
+//Trigrams are case insensitive.  Characters are folded into a 6 bit
+//alphabet so a trigram key fits in 18 bits; folding can only add false
+//candidates, and every candidate is checked against the real record.
+#define TRI_MAGIC       0x49525453          //"STRI"
+#define TRI_VERSION     1
+#define TRI_BLOCK       64                  //ids per posting block
+#define TRI_LOG_MAX     1024                //log entries before a rebuild
+#define TRI_KEY_BITS    18
+#define TRI_MAX_EDITS   2                   //largest fuzzy edit distance
+#define TRI_MAX_PATTERN 31                  //longest name field less NUL
+
+#define TRI_OP_ADD      1
+#define TRI_OP_DEL      2
+
+typedef struct tri_hdr{
+    int magic;              //TRI_MAGIC
+    int version;            //TRI_VERSION
+    unsigned int epoch;     //superblock epoch the base was built from
+    int base_gen;           //superblock generation the base was built from
+    int n_keys;             //entries in the key table
+    int log_off;            //file offset of the first change log entry
+} tri_hdr_t;
+
+//one entry per distinct trigram, sorted by key
+typedef struct tri_key{
+    unsigned int key;       //18 bit folded trigram
+    unsigned int count;     //number of ids in the posting list
+    unsigned int off;       //file offset of the posting list
+} tri_key_t;
+
+//a posting list starts with one of these per block, followed by the
+//varint deltas of every id in the block except the first
+typedef struct tri_skip{
+    int first_id;           //first id in the block
+    unsigned int data_off;  //offset of the block deltas from the list start
+} tri_skip_t;
+
+typedef struct tri_log{
+    int id;                 //student id that changed
+    int op;                 //TRI_OP_ADD or TRI_OP_DEL
+    int generation;         //superblock generation after the change
+} tri_log_t;
+
+int tri_build(int fd, db_super_t *sb);
+int tri_note(int fd, db_super_t *sb, int id, int op);
+int tri_match(int fd, char *pattern, int max_edits, student_t **found, int *n_found);
+int tri_search(int fd, char *pattern, int max_edits);
+
+#endif
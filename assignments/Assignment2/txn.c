@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+//database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "pager.h"
+#include "trace.h"
+#include "trigram.h"
+#include "txn.h"
+#include "shm.h"
+#include "cdc.h"
+
+//trigram change kept back until the transaction is applied
+typedef struct txn_note{
+    db_super_t sb;
+    int id;
+    int op;
+} txn_note_t;
+
+//the open transaction, fd is -1 when there is none
+static struct {
+    int fd;
+    txn_note_t *notes;
+    int n_notes;
+    int cap_notes;
+} txn = { -1, NULL, 0, 0 };
+
+//log image built by txn_commit(), header first
+typedef struct txn_image{
+    txn_hdr_t *hdr;
+    size_t len;
+    size_t cap;
+} txn_image_t;
+
+static unsigned int txn_checksum(const txn_hdr_t *hdr, size_t len) {
+    const unsigned char *p = (const unsigned char *)hdr;
+    txn_hdr_t h = *hdr;
+    unsigned int hash = 2166136261u;
+
+    h.checksum = 0;
+    for (size_t i = 0; i < sizeof(h); i++)
+        hash = (hash ^ ((const unsigned char *)&h)[i]) * 16777619u;
+    for (size_t i = sizeof(h); i < len; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static char *txn_log_name(int fd, char *out, size_t sz) {
+    return db_sidecar(fd, TXN_EXT, false, out, sz);
+}
+
+/*
+ *  txn_begin
+ *      fd:  linux file descriptor returned by open_db(), locked exclusively
+ *
+ *  returns:  NO_ERROR       transaction open
+ *            ERR_DB_OP      a transaction is already open
+ *            ERR_DB_FILE    the checkpoint before it failed
+ */
+int txn_begin(int fd) {
+    if (txn.fd != -1)
+        return ERR_DB_OP;
+    if (checkpoint_db(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    pager_hold(fd, true);
+    txn.fd = fd;
+    txn.n_notes = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  txn_active
+ *      fd:  linux file descriptor
+ *
+ *  returns:  true if a transaction is open on fd
+ */
+bool txn_active(int fd) {
+    return fd != -1 && txn.fd == fd;
+}
+
+/*
+ *  txn_defer_note
+ *      fd, sb, id, op:  the arguments for tri_note()
+ *
+ *  Keeps a trigram change back until txn_commit() has applied it.  Losing
+ *  a note only costs an index rebuild, so running out of memory is not an
+ *  error.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void txn_defer_note(int fd, db_super_t *sb, int id, int op) {
+    (void)fd;
+    if (txn.n_notes == txn.cap_notes) {
+        int cap = txn.cap_notes ? txn.cap_notes * 2 : 16;
+        txn_note_t *notes = realloc(txn.notes, cap * sizeof(*notes));
+        if (notes == NULL)
+            return;
+        txn.notes = notes;
+        txn.cap_notes = cap;
+    }
+    txn.notes[txn.n_notes++] = (txn_note_t){ *sb, id, op };
+}
+
+//pager_collect() callback, appends one slot to the log image
+static int add_slot(off_t off, const void *data, void *arg) {
+    txn_image_t *img = arg;
+
+    if (img->len + sizeof(txn_slot_t) > img->cap) {
+        size_t cap = img->cap * 2;
+        txn_hdr_t *hdr = realloc(img->hdr, cap);
+        if (hdr == NULL)
+            return ERR_DB_FILE;
+        img->hdr = hdr;
+        img->cap = cap;
+    }
+
+    txn_slot_t *slot = (txn_slot_t *)((char *)img->hdr + img->len);
+    slot->off = off;
+    memcpy(slot->data, data, PAGER_SLOT);
+    img->len += sizeof(txn_slot_t);
+    img->hdr->n_slots++;
+    return NO_ERROR;
+}
+
+//empties the log so it is never replayed
+static void retire_log(int fd) {
+    char log_file[PATH_MAX];
+    int log_fd = open(txn_log_name(fd, log_file, sizeof(log_file)), O_WRONLY);
+
+    if (log_fd == -1)
+        return;
+    if (tr_ftruncate(log_fd, 0) == -1) {
+        int magic = 0;
+        tr_pwrite(log_fd, &magic, sizeof(magic), 0);
+    }
+    close(log_fd);
+}
+
+//makes the database writes of every record durable, then drops the log
+static int settle_log(int fd) {
+    if (tr_fdatasync(fd) == -1)
+        return ERR_DB_FILE;
+    retire_log(fd);
+    return NO_ERROR;
+}
+
+/*
+ *  write_log
+ *      fd:     database the log belongs to
+ *      *img:   complete record
+ *      *size:  set to the size of the log after it
+ *
+ *  Appends the record with one pwrite() and syncs the log.  A log that
+ *  does not start with a record is emptied first.  The log file is kept
+ *  between transactions, the first time it is created the directory is
+ *  synced too so the file itself survives a crash.  A record that is not
+ *  fully written is cut off again, so the next one follows the last
+ *  good record, or if that fails the log is settled.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_log(int fd, txn_image_t *img, off_t *size) {
+    char log_file[PATH_MAX];
+    bool created = true;
+    int rc = ERR_DB_FILE;
+    int magic = 0;
+    struct stat st;
+
+    txn_log_name(fd, log_file, sizeof(log_file));
+    int log_fd = open(log_file, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (log_fd == -1 && errno == EEXIST) {
+        created = false;
+        log_fd = open(log_file, O_RDWR);
+    }
+    if (log_fd == -1)
+        return ERR_DB_FILE;
+
+    off_t end = 0;
+    if (tr_pread(log_fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+        magic == TXN_MAGIC && fstat(log_fd, &st) == 0)
+        end = st.st_size;
+    else if (tr_ftruncate(log_fd, 0) == -1) {
+        close(log_fd);
+        return ERR_DB_FILE;
+    }
+
+    if (tr_pwrite(log_fd, img->hdr, img->len, end) == (ssize_t)img->len &&
+        tr_fdatasync(log_fd) == 0)
+        rc = NO_ERROR;
+    else if (tr_ftruncate(log_fd, end) == -1)
+        settle_log(fd);
+    *size = end + img->len;
+    close(log_fd);
+
+    if (rc == NO_ERROR && created) {
+        char dir[PATH_MAX];
+        char *slash;
+
+        snprintf(dir, sizeof(dir), "%s", log_file);
+        slash = strrchr(dir, '/');
+        if (slash)
+            *slash = '\0';
+        else
+            snprintf(dir, sizeof(dir), ".");
+
+        int dir_fd = open(dir, O_RDONLY);
+        if (dir_fd == -1 || tr_fsync(dir_fd) == -1)
+            rc = ERR_DB_FILE;
+        if (dir_fd != -1)
+            close(dir_fd);
+    }
+    return rc;
+}
+
+static void txn_end(int fd) {
+    pager_hold(fd, false);
+    txn.fd = -1;
+    txn.n_notes = 0;
+}
+
+/*
+ *  txn_commit
+ *      fd:  linux file descriptor with an open transaction
+ *
+ *  See txn.h.  If the log cannot be written the transaction is aborted.
+ *
+ *  returns:  NO_ERROR       transaction applied
+ *            ERR_DB_OP      no transaction is open on fd
+ *            ERR_DB_FILE    database or log I/O issue
+ *
+ *  console:  M_ERR_DB_WRITE  error writing the log or the database
+ */
+int txn_commit(int fd) {
+    txn_image_t img = { NULL, sizeof(txn_hdr_t), 64 * sizeof(txn_slot_t) };
+    db_super_t sb;
+
+    if (!txn_active(fd))
+        return ERR_DB_OP;
+    if (!pager_dirty(fd)) {
+        txn_end(fd);
+        return NO_ERROR;
+    }
+
+    img.hdr = calloc(1, img.cap);
+    if (img.hdr == NULL || read_super(fd, &sb) != NO_ERROR ||
+        pager_collect(fd, add_slot, &img) != NO_ERROR) {
+        free(img.hdr);
+        txn_abort(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    img.hdr->magic = TXN_MAGIC;
+    img.hdr->epoch = sb.epoch;
+    img.hdr->generation = sb.generation;
+    img.hdr->checksum = txn_checksum(img.hdr, img.len);
+
+    off_t log_size;
+    int rc = write_log(fd, &img, &log_size);
+    free(img.hdr);
+    if (rc != NO_ERROR) {
+        txn_abort(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    //committed, now apply it.  If this fails the log is left for
+    //txn_recover()
+    pager_hold(fd, false);
+    if (checkpoint_db(fd) != NO_ERROR) {
+        txn_end(fd);
+        return ERR_DB_FILE;
+    }
+    if (log_size > TXN_LOG_MAX)
+        settle_log(fd);
+
+    for (int i = 0; i < txn.n_notes; i++)
+        tri_note(fd, &txn.notes[i].sb, txn.notes[i].id, txn.notes[i].op);
+    txn_end(fd);
+    return NO_ERROR;
+}
+
+/*
+ *  txn_abort
+ *      fd:  linux file descriptor with an open transaction
+ *
+ *  Forgets every change made since txn_begin().
+ *
+ *  returns:  nothing, this is a void function
+ */
+void txn_abort(int fd) {
+    if (!txn_active(fd))
+        return;
+    pager_drop(fd);
+    txn_end(fd);
+}
+
+//next record after rec, the caller checked that rec is complete
+static txn_hdr_t *next_record(txn_hdr_t *rec) {
+    return (txn_hdr_t *)((char *)rec + sizeof(*rec) + (size_t)rec->n_slots * sizeof(txn_slot_t));
+}
+
+/*
+ *  read_log
+ *      fd:     database the log belongs to
+ *      *len:   set to the bytes of complete records at the start
+ *      *size:  set to the size of the log file
+ *      **last: set to the last complete record
+ *
+ *  Reads the whole log and checks its records in order.  The first one
+ *  that is torn or fails its checksum ends it, it never committed.
+ *
+ *  returns:  the log, or NULL if it does not start with a complete record
+ */
+static txn_hdr_t *read_log(int fd, size_t *len, size_t *size, txn_hdr_t **last) {
+    char log_file[PATH_MAX];
+    struct stat st;
+    txn_hdr_t *img = NULL;
+    int log_fd = open(txn_log_name(fd, log_file, sizeof(log_file)), O_RDONLY);
+
+    if (log_fd == -1)
+        return NULL;
+    if (fstat(log_fd, &st) == 0 && st.st_size >= (off_t)sizeof(txn_hdr_t) &&
+        (img = malloc(st.st_size)) != NULL &&
+        tr_pread(log_fd, img, st.st_size, 0) != st.st_size) {
+        free(img);
+        img = NULL;
+    }
+    close(log_fd);
+    if (img == NULL)
+        return NULL;
+
+    *size = st.st_size;
+    *len = 0;
+    *last = NULL;
+    for (txn_hdr_t *rec = img; *size - *len >= sizeof(*rec); rec = next_record(rec)) {
+        size_t room = (*size - *len - sizeof(*rec)) / sizeof(txn_slot_t);
+        if (rec->magic != TXN_MAGIC || rec->n_slots < 0 || (size_t)rec->n_slots > room)
+            break;
+        size_t rec_len = sizeof(*rec) + (size_t)rec->n_slots * sizeof(txn_slot_t);
+        if (txn_checksum(rec, rec_len) != rec->checksum)
+            break;
+        *len += rec_len;
+        *last = rec;
+    }
+    if (*last == NULL) {
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+//orders slots by offset, and by their place in the log for the same one
+static int cmp_slot(const void *a, const void *b) {
+    const txn_slot_t *x = *(const txn_slot_t * const *)a;
+    const txn_slot_t *y = *(const txn_slot_t * const *)b;
+
+    if (x->off != y->off)
+        return x->off < y->off ? -1 : 1;
+    return x < y ? -1 : (x > y);
+}
+
+/*
+ *  log_in_file
+ *      fd:    database the log belongs to
+ *      *img:  log read by read_log()
+ *      len:   bytes of complete records
+ *
+ *  Compares the last contents the log has for every slot with the file,
+ *  through the pager, whose pages are dropped again afterwards.
+ *
+ *  returns:  true if the file has all of them
+ */
+static bool log_in_file(int fd, txn_hdr_t *img, size_t len) {
+    int n = 0;
+    bool same = true;
+
+    for (txn_hdr_t *rec = img; (char *)rec < (char *)img + len; rec = next_record(rec))
+        n += rec->n_slots;
+    txn_slot_t **slots = malloc((n ? n : 1) * sizeof(*slots));
+    if (slots == NULL)
+        return false;
+    n = 0;
+    for (txn_hdr_t *rec = img; (char *)rec < (char *)img + len; rec = next_record(rec)) {
+        for (int i = 0; i < rec->n_slots; i++)
+            slots[n++] = (txn_slot_t *)(rec + 1) + i;
+    }
+    qsort(slots, n, sizeof(*slots), cmp_slot);
+
+    for (int i = 0; i < n && same; i++) {
+        char data[PAGER_SLOT];
+        if (i + 1 < n && slots[i + 1]->off == slots[i]->off)
+            continue;
+        same = pager_read(fd, data, PAGER_SLOT, slots[i]->off) == PAGER_SLOT &&
+               memcmp(data, slots[i]->data, PAGER_SLOT) == 0;
+    }
+    free(slots);
+    pager_drop(fd);
+    return same;
+}
+
+/*
+ *  txn_pending
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  returns:  true if a log that was not settled is next to the database,
+ *            txn_applied() and txn_recover() decide what it still needs
+ */
+bool txn_pending(int fd) {
+    char log_file[PATH_MAX];
+    int magic = 0;
+    int log_fd = open(txn_log_name(fd, log_file, sizeof(log_file)), O_RDONLY);
+
+    if (log_fd == -1)
+        return false;
+    if (tr_pread(log_fd, &magic, sizeof(magic), 0) != sizeof(magic))
+        magic = 0;
+    close(log_fd);
+    return magic == TXN_MAGIC;
+}
+
+/*
+ *  txn_applied
+ *      fd:  linux file descriptor returned by open_db(), locked
+ *
+ *  returns:  true if the log only holds complete records and the file
+ *            already has everything they changed, so it can be left
+ *            unsettled and appended to
+ */
+bool txn_applied(int fd) {
+    size_t len, size;
+    txn_hdr_t *last;
+    txn_hdr_t *img = read_log(fd, &len, &size, &last);
+    bool applied = img != NULL && len == size && log_in_file(fd, img, len);
+
+    free(img);
+    return applied;
+}
+
+/*
+ *  txn_recover
+ *      fd:  linux file descriptor returned by open_db(), locked exclusively
+ *
+ *  Settles the log, see txn.h.  If the file does not have everything the
+ *  committed records changed, they are replayed in order first, slot 0
+ *  last with SUPER_DIRTY set.  A torn record is a transaction that never
+ *  committed and is ignored.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_WRITE  error writing the database
+ */
+int txn_recover(int fd) {
+    size_t len, size;
+    db_super_t sb;
+    txn_hdr_t *last;
+    txn_hdr_t *img = read_log(fd, &len, &size, &last);
+
+    if (img == NULL) {
+        retire_log(fd);
+        return NO_ERROR;
+    }
+
+    pager_drop(fd);
+    if (tr_pread(fd, &sb, sizeof(sb), SUPER_SLOT) != sizeof(sb))
+        memset(&sb, 0, sizeof(sb));
+    if (super_check(&sb) && (sb.epoch != last->epoch || sb.generation > last->generation)) {
+        free(img);
+        retire_log(fd);
+        return NO_ERROR;
+    }
+    if (log_in_file(fd, img, len)) {
+        free(img);
+        if (settle_log(fd) != NO_ERROR) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    //the slots are written straight to the file
+    shm_invalidate(fd);
+    cdc_reset(fd);
+
+    int rc = NO_ERROR;
+    bool has_super = false;
+    for (txn_hdr_t *rec = img; (char *)rec < (char *)img + len && rc == NO_ERROR;
+         rec = next_record(rec)) {
+        txn_slot_t *slots = (txn_slot_t *)(rec + 1);
+        for (int i = 0; i < rec->n_slots && rc == NO_ERROR; i++) {
+            if (slots[i].off == SUPER_SLOT) {
+                memcpy(&sb, slots[i].data, sizeof(sb));
+                has_super = true;
+            } else if (tr_pwrite(fd, slots[i].data, PAGER_SLOT, slots[i].off) != PAGER_SLOT) {
+                rc = ERR_DB_FILE;
+            }
+        }
+    }
+    if (rc == NO_ERROR && tr_fdatasync(fd) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && has_super) {
+        sb.flags |= SUPER_DIRTY;
+        if (write_super(fd, &sb) != NO_ERROR || checkpoint_db(fd) != NO_ERROR ||
+            tr_fdatasync(fd) == -1)
+            rc = ERR_DB_FILE;
+    }
+    free(img);
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    retire_log(fd);
+    return NO_ERROR;
+}
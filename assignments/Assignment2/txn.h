@@ -0,0 +1,73 @@
+#ifndef __TXN_H__
+#define __TXN_H__
+
+#include <stdbool.h>
+
+#include "db.h"     //get student record and superblock types
+#include "pager.h"  //get PAGER_SLOT
+
+//A transaction groups several add_student()/del_student() calls on one
+//database file so they are applied all together or not at all.
+//
+//  txn_begin()   checkpoints the file and holds its pages in the pager, so
+//                nothing written after this reaches the file by itself.
+//  txn_commit()  appends every changed 64 byte slot, the superblock
+//                included, to the redo log next to the database (TXN_EXT)
+//                as one record with a single write() and makes it durable
+//                with one fdatasync().  That is the commit point and the
+//                only sync.  The held pages are then written to the
+//                database without syncing it, and the log is kept.
+//  txn_abort()   drops the held pages, the file was never touched.
+//
+//Held pages cannot leave the pool, so one transaction can change at most
+//TXN_MAX_PAGES pages of 64 ids.  run_batch() checks pager_room() before
+//each operation and fails a larger batch with ERR_TXN_SIZE.
+//
+//The database writes of committed transactions only become durable when
+//the log is settled: the database is synced and the log truncated.  That
+//happens when the log grows past TXN_LOG_MAX, and when a command that
+//changes the file without a transaction locks it, see shard_lock().
+//Other commands leave a log whose records are all in the file alone, and
+//the next transaction appends to it.
+//
+//Trigram log entries are kept back until the changes are applied, so an
+//aborted transaction never shows up in the index.
+//
+//A crash can lose database writes the log still has.  The next process to
+//lock the database finds the file differs from the log and replays every
+//record with txn_recover(), marking the superblock dirty so load_super()
+//recounts the file.  The log is only replayed while the superblock on disk
+//is from before its last record (same epoch, generation not past it), so
+//a log whose truncation was lost never overwrites later changes.
+//
+//There is one transaction at a time per process, on a single file.
+#define TXN_EXT         ".wal"
+#define TXN_MAGIC       0x4c415754          //"TWAL"
+#define TXN_LOG_MAX     (4 * 1024 * 1024)   //log size that settles it
+#define TXN_MAX_PAGES   (PAGER_FRAMES - 1)  //page 0 always stays in the pool
+
+//one record per committed transaction, the slots follow the header
+typedef struct txn_hdr{
+    int magic;              //TXN_MAGIC
+    int n_slots;            //number of txn_slot_t that follow
+    unsigned int epoch;     //superblock epoch of the transaction
+    int generation;         //superblock generation after the transaction
+    unsigned int checksum;  //FNV-1a of the header (checksum 0) and slots
+    int reserved;
+} txn_hdr_t;
+
+typedef struct txn_slot{
+    long long off;                  //file offset of the slot
+    char data[PAGER_SLOT];          //contents after the transaction
+} txn_slot_t;
+
+int txn_begin(int fd);
+int txn_commit(int fd);
+void txn_abort(int fd);
+bool txn_active(int fd);
+void txn_defer_note(int fd, db_super_t *sb, int id, int op);
+bool txn_pending(int fd);
+bool txn_applied(int fd);
+int txn_recover(int fd);
+
+#endif